@@ -18,13 +18,38 @@
 #define DISTRHO_PLUGIN_INFO_H_INCLUDED
 
 #define DISTRHO_PLUGIN_BRAND "soerenbnoergaard"
+
+// Channel layout. The default is stereo. Other layouts, e.g. 5.1 or
+// first-order ambisonics, are built as separate plugins with
+// `make CHANNELS=N` or `make INPUTS=N OUTPUTS=M`, which define
+// GUNSHOT_NUM_INPUTS and GUNSHOT_NUM_OUTPUTS.
+#ifdef GUNSHOT_NUM_INPUTS
+#define GUNSHOT_STRINGIFY_(x) #x
+#define GUNSHOT_STRINGIFY(x) GUNSHOT_STRINGIFY_(x)
+#define GUNSHOT_LAYOUT GUNSHOT_STRINGIFY(GUNSHOT_NUM_INPUTS) "x" GUNSHOT_STRINGIFY(GUNSHOT_NUM_OUTPUTS)
+
+#define DISTRHO_PLUGIN_NAME  "gunshot " GUNSHOT_LAYOUT
+#define DISTRHO_PLUGIN_URI   "http://github.com/soerenbnoergaard/gunshot#" GUNSHOT_LAYOUT
+#define GUNSHOT_LABEL        "gunshot_" GUNSHOT_LAYOUT
+
+#define DISTRHO_PLUGIN_NUM_INPUTS      GUNSHOT_NUM_INPUTS
+#define DISTRHO_PLUGIN_NUM_OUTPUTS     GUNSHOT_NUM_OUTPUTS
+#else
 #define DISTRHO_PLUGIN_NAME  "gunshot"
 #define DISTRHO_PLUGIN_URI   "http://github.com/soerenbnoergaard/gunshot"
+#define GUNSHOT_LABEL        "gunshot"
 
-#define DISTRHO_PLUGIN_HAS_UI          1
-#define DISTRHO_PLUGIN_IS_RT_SAFE      1
 #define DISTRHO_PLUGIN_NUM_INPUTS      2
 #define DISTRHO_PLUGIN_NUM_OUTPUTS     2
+#endif
+
+#if DISTRHO_PLUGIN_NUM_INPUTS < 1 || DISTRHO_PLUGIN_NUM_INPUTS > 16 || \
+    DISTRHO_PLUGIN_NUM_OUTPUTS < 1 || DISTRHO_PLUGIN_NUM_OUTPUTS > 16
+#error "1 to 16 inputs and outputs are supported"
+#endif
+
+#define DISTRHO_PLUGIN_HAS_UI          1
+#define DISTRHO_PLUGIN_IS_RT_SAFE      1
 #define DISTRHO_PLUGIN_WANT_PROGRAMS   0
 #define DISTRHO_PLUGIN_WANT_STATE      1
 #define DISTRHO_PLUGIN_WANT_FULL_STATE 1
@@ -32,4 +57,40 @@
 #define DISTRHO_UI_USER_RESIZABLE      0
 #define DISTRHO_UI_USE_NANOVG          1
 
+// Parameter indices, shared by the plugin and the UI. The output parameters
+// report the timing of the audio thread (see block_stats.h) and the quality
+// tier in use. New parameters are added at the end so that the indices saved
+// by hosts stay valid.
+#define NUM_PARAMETERS 17
+
+#define PARAM_DRY 0
+#define PARAM_WET 1
+#define PARAM_HIGHPASS 2
+#define PARAM_LOWPASS 3
+#define PARAM_MORPH 4
+#define PARAM_RUN_AVG 5
+#define PARAM_RUN_MAX 6
+#define PARAM_WAIT_AVG 7
+#define PARAM_WAIT_MAX 8
+#define PARAM_OVERRUNS 9
+#define PARAM_TAIL_MISSES 10
+#define PARAM_LENGTH 11
+#define PARAM_DECAY 12
+#define PARAM_PRE_DELAY 13
+#define PARAM_QUALITY 14
+#define PARAM_RENDER 15
+#define PARAM_QUALITY_USED 16
+
+// Values of PARAM_RENDER. Hosts do not tell plugins when they render
+// offline, so in Auto the pace of run() decides whether HQ is used, see
+// render_detector.h. Live never renders as offline, e.g. for hosts that run
+// ahead of real time while playing live. Offline always does, e.g. for
+// exports that are slower than real time and for the command line tools.
+// Only Offline also drops the deadlines of the engine, since a host that
+// runs ahead of real time may still have them.
+#define RENDER_AUTO 0
+#define RENDER_LIVE 1
+#define RENDER_OFFLINE 2
+#define NUM_RENDER_MODES 3
+
 #endif // DISTRHO_PLUGIN_INFO_H_INCLUDED
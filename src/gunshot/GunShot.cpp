@@ -19,25 +19,134 @@
 #include "utils.h"
 #include "log.h"
 #include "biquad.h"
+#include "block_stats.h"
+#include "render_detector.h"
+#include "routing.h"
 #include "plugin_state.hpp"
 #include "convolver.hpp"
+#include "partition_planner.hpp"
+#include "trace.hpp"
+#include "denormal.hpp"
+#include "snapshot_channel.hpp"
+#include "wake_semaphore.hpp"
 
-#include "fftconvolver/FFTConvolver.h"
-#include "fftconvolver/TwoStageFFTConvolver.h"
 #include "fftconvolver/Utilities.h"
 #include "samplerate.h"
 
-#define NUM_PARAMETERS 4
-#define NUM_PROGRAMS 0
-#define NUM_STATES 1
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdint.h>
 
-#define PARAM_DRY 0
-#define PARAM_WET 1
-#define PARAM_HIGHPASS 2
-#define PARAM_LOWPASS 3
+#define NUM_PROGRAMS 0
+#define NUM_STATES (PLUGIN_STATE_NUM_SLOTS + 1)
+#define NUM_SLOTS PLUGIN_STATE_NUM_SLOTS
+
+// The routing matrix is stored after the impulse response slots.
+#define STATE_ROUTING NUM_SLOTS
+
+// Longer blocks from the host are processed in chunks of this size, which is
+// also the size of the scratch buffers for in-place processing.
+#define MAX_CHUNK_FRAMES 1024
+
+// The late reverb is convolved at a lower sample rate when the host runs at
+// a high one, but never below this rate, so that the audible band is kept.
+#define LATE_TAIL_MIN_SAMPLE_RATE_Hz 44100.0
+
+// Longest pre-delay. The convolvers keep enough input spectra for it, so the
+// pre-delay can change without a new engine.
+#define PRE_DELAY_MAX_ms 200.0
+
+// Worker groups that each convolver splits its tail partitions across, so
+// that a long impulse response can use more than one core. All convolvers of
+// the process share the same threads, one per core besides the tail thread,
+// up to this many. The rounding of the output depends on the number of
+// groups, not threads, so it is the same live and offline on any machine.
+#define TAIL_WORKERS_MAX 3
+
+// Quality tiers. Each engine is built for one tier, the one that run() plays.
+// Eco resamples with a cheaper converter, cuts the impulse responses where
+// the energy that is left falls below ECO_TRUNCATION_dB, and convolves the
+// late reverb at a lower rate. HQ is always used for offline rendering.
+#define QUALITY_ECO 0
+#define QUALITY_HQ 1
+#define NUM_QUALITIES 2
+#define ECO_TRUNCATION_dB -60.0
+#define ECO_LATE_TAIL_MIN_SAMPLE_RATE_Hz 22050.0
+
+// Parameter values as the host and the UI set them. They are handed to run()
+// as a whole, without any calculation, because the host may set parameters
+// from the audio thread.
+typedef struct {
+    uint32_t serial; // Changes with every publishParameters()
+    float dry_dB;
+    float wet_dB;
+    float highpass_Hz;
+    float lowpass_Hz;
+    float morph;
+    float length_pct;
+    float decay_dB_per_s;
+    float pre_delay_ms;
+    float quality;
+    float render;
+} param_values_t;
+
+// Everything run() needs from the parameters. It is calculated by run() from
+// param_values_t in the first block after a parameter changed, so the
+// coefficients are calculated at most once per block.
+typedef struct {
+    float dry_lin;
+    float wet_lin;
+    biquad_coefficients_t highpass;
+    biquad_coefficients_t lowpass;
+    float slot_gains[PLUGIN_STATE_NUM_SLOTS];
+    float length;    // Fraction of the impulse response that is kept
+    float decay;     // Per sample, see Convolver::setEnvelope()
+    uint32_t pre_delay; // In samples
+    uint32_t quality;
+    uint32_t render;
+} param_snapshot_t;
+
+// Everything that is rebuilt when an impulse response, the routing or the
+// quality tier changes: one convolver per input, with one path per route
+// from the input.
+typedef struct engine_s {
+    Convolver convolvers[DISTRHO_PLUGIN_NUM_INPUTS];
+    uint32_t quality;          // Tier of the convolvers
+    bool offline;              // Built for Render set to Offline, see configure()
+    bool drains_previous;      // The engine it replaces rings out, see takeEngine()
+    size_t drain_length;       // Frames that the engine rings after its last input
+    uint32_t num_paths[DISTRHO_PLUGIN_NUM_INPUTS];
+    uint32_t path_outputs[DISTRHO_PLUGIN_NUM_INPUTS][PARTITIONED_CONVOLVER_MAX_PATHS];
+    size_t ir_length;          // Before Eco cuts the impulse responses
+    struct engine_s *retired_next; // Next engine that run() handed back, see takeEngine()
+} engine_t;
 
 START_NAMESPACE_DISTRHO
 
+class GunShotPlugin;
+
+// Builds the engine for a new quality tier or render mode off the audio
+// thread, see GunShotPlugin::requestEngine().
+class EngineBuilderThread : public MyThread
+{
+public:
+    explicit EngineBuilderThread(GunShotPlugin &plugin) :
+        MyThread("EngineBuilderThread"),
+        _plugin(plugin)
+    {
+    }
+
+    virtual void run();
+
+private:
+    GunShotPlugin &_plugin;
+
+    EngineBuilderThread(const EngineBuilderThread&);
+    EngineBuilderThread& operator=(const EngineBuilderThread&);
+};
+
 // -----------------------------------------------------------------------------------------------------------
 
 /**
@@ -46,30 +155,87 @@ START_NAMESPACE_DISTRHO
 class GunShotPlugin : public Plugin
 {
 public:
-    GunShotPlugin() : Plugin(NUM_PARAMETERS, NUM_PROGRAMS, NUM_STATES)
+    GunShotPlugin() : Plugin(NUM_PARAMETERS, NUM_PROGRAMS, NUM_STATES),
+        param_channel(param_values_t()),
+        param_pending(false)
     {
         int err;
-        err = plugin_state_init_dirac(&state, getSampleRate());
-        if (err) {
-            throw "Could not reset state";
+        memset(silence, 0, sizeof(silence));
+        for (uint32_t s = 0; s < NUM_SLOTS; s++) {
+            for (uint32_t q = 0; q < NUM_QUALITIES; q++) {
+                resampled[q][s] = nullptr;
+                resampled_length[q][s] = 0;
+            }
+            err = plugin_state_init_dirac(&state[s], getSampleRate());
+            if (err) {
+                throw "Could not reset state";
+            }
         }
 
-#ifdef GUNSHOT_LOG_FILE
-        // log_init();
-        log_write("Call: GunShotPlugin()");
-#endif
-        inL = NULL;
-        inR = NULL;
-        bufferSizeChanged(getBufferSize());
+        log_init();
+        log_write_level(LOG_LEVEL_DEBUG, "Call: GunShotPlugin()");
+
+        block_stats_init(&stats);
+        render_detector_init(&render_detector);
+        plan = PartitionPlanner::getDefaultPlan(getBufferSize());
+
+        // Neutral until initParameter() sets the defaults
+        param_dry_dB = 0.0f;
+        param_wet_dB = 0.0f;
+        param_highpass_Hz = 0.0f;
+        param_lowpass_Hz = BIQUAD_MAX_Hz + 1.0;
+        param_morph = 0.0f;
+        param_length_pct = 100.0f;
+        param_decay_dB_per_s = 0.0f;
+        param_pre_delay_ms = 0.0f;
+        param_quality = QUALITY_HQ;
+        param_render = RENDER_AUTO;
+        param_serial = 0;
+        param_publishing.clear();
+        params_serial = 0;
+        publishParameters();
+
+        for (uint32_t o = 0; o < DISTRHO_PLUGIN_NUM_OUTPUTS; o++) {
+            biquad_clear(&highpass_states[o]);
+            biquad_clear(&lowpass_states[o]);
+        }
+
+        char routing_text[ROUTING_TEXT_LENGTH];
+        routing_init_default(&routing, DISTRHO_PLUGIN_NUM_INPUTS, DISTRHO_PLUGIN_NUM_OUTPUTS);
+        routing_format(&routing, routing_text, ROUTING_TEXT_LENGTH);
+        routing_cache = String(routing_text);
+
+        engine = newEngine();
+        next_engine.store(nullptr);
+        retired_engines.store(nullptr);
+        draining_engine = nullptr;
+        draining_frames = 0;
+        active.store(false);
+        wanted_quality.store(NUM_QUALITIES);
+        wanted_offline.store(false);
+        engine_requests.store(0);
+        engine_requests_served.store(0);
+        built_quality = NUM_QUALITIES;
+        built_offline = false;
+        quality_used.store(QUALITY_HQ);
+        builder.reset(new EngineBuilderThread(*this));
+        builder->startThread();
     }
 
     ~GunShotPlugin() override
     {
-        plugin_state_free(&state);
-        convolver_left.reset();
-        convolver_right.reset();
-        free(inL);
-        free(inR);
+        builder->signalThreadShouldExit();
+        build_wake.post();
+        builder->stopThread(-1);
+        for (uint32_t s = 0; s < NUM_SLOTS; s++) {
+            plugin_state_free(&state[s]);
+            invalidateSlot(s);
+        }
+        deleteEngine(engine);
+        deleteEngine(draining_engine);
+        deleteEngine(next_engine.load());
+        freeRetiredEngines();
+        log_close();
     }
 
 protected:
@@ -82,7 +248,7 @@ protected:
     */
     const char* getLabel() const override
     {
-        return "gunshot";
+        return GUNSHOT_LABEL;
     }
 
    /**
@@ -132,8 +298,13 @@ protected:
     */
     int64_t getUniqueId() const override
     {
+#ifdef GUNSHOT_NUM_INPUTS
+        // Each channel layout is a plugin of its own
+        return d_cconst('g', 'S', 'a' + DISTRHO_PLUGIN_NUM_INPUTS, 'a' + DISTRHO_PLUGIN_NUM_OUTPUTS);
+#else
         // SBN: I just made something up
         return d_cconst('d', 'L', 'b', 'q');
+#endif
     }
 
    /* --------------------------------------------------------------------------------------------------------
@@ -145,7 +316,7 @@ protected:
     */
     void initParameter(uint32_t index, Parameter& parameter) override
     {
-        log_write("Call: initParameter()");
+        log_write_level(LOG_LEVEL_DEBUG, "Call: initParameter()");
         switch (index) {
         case PARAM_DRY:
             parameter.hints  = kParameterIsAutomable;
@@ -157,7 +328,7 @@ protected:
             parameter.ranges.max = 20.0f;
 
             param_dry_dB = parameter.ranges.def;
-            param_dry_lin = convert_dB_to_linear(param_dry_dB);
+            publishParameters();
             break;
 
         case PARAM_WET:
@@ -170,7 +341,7 @@ protected:
             parameter.ranges.max = 20.0f;
 
             param_wet_dB = parameter.ranges.def;
-            param_wet_lin = convert_dB_to_linear(param_wet_dB);
+            publishParameters();
             break;
 
         case PARAM_HIGHPASS:
@@ -183,15 +354,7 @@ protected:
             parameter.ranges.max = 1000.0f;
 
             param_highpass_Hz = parameter.ranges.def;
-
-            if (param_highpass_Hz < BIQUAD_MIN_Hz) {
-                param_highpass_data_left = biquad_calculate_nofilter(true);
-            }
-            else {
-                param_highpass_data_left = biquad_calculate_highpass(param_highpass_Hz, getSampleRate(), true);
-            }
-
-            param_highpass_data_right = param_highpass_data_left;
+            publishParameters();
             break;
 
         case PARAM_LOWPASS:
@@ -204,15 +367,142 @@ protected:
             parameter.ranges.max = BIQUAD_MAX_Hz + 1.0;
 
             param_lowpass_Hz = parameter.ranges.def;
+            publishParameters();
+            break;
+
+        case PARAM_MORPH:
+            parameter.hints  = kParameterIsAutomable;
+            parameter.name   = "Morph";
+            parameter.symbol = "morph";
+            parameter.unit   = "";
+            parameter.ranges.def = 0.0f;
+            parameter.ranges.min = 0.0f;
+            parameter.ranges.max = NUM_SLOTS - 1;
 
-            if (param_lowpass_Hz > BIQUAD_MAX_Hz) {
-                param_lowpass_data_left = biquad_calculate_nofilter(true);
+            param_morph = parameter.ranges.def;
+            publishParameters();
+            break;
+
+        case PARAM_LENGTH:
+            parameter.hints  = kParameterIsAutomable;
+            parameter.name   = "Length";
+            parameter.symbol = "length";
+            parameter.unit   = "%";
+            parameter.ranges.def = 100.0f;
+            parameter.ranges.min = 1.0f;
+            parameter.ranges.max = 100.0f;
+
+            param_length_pct = parameter.ranges.def;
+            publishParameters();
+            break;
+
+        case PARAM_DECAY:
+            parameter.hints  = kParameterIsAutomable;
+            parameter.name   = "Decay";
+            parameter.symbol = "decay";
+            parameter.unit   = "dB/s";
+            parameter.ranges.def = 0.0f;
+            parameter.ranges.min = 0.0f;
+            parameter.ranges.max = 200.0f;
+
+            param_decay_dB_per_s = parameter.ranges.def;
+            publishParameters();
+            break;
+
+        case PARAM_PRE_DELAY:
+            parameter.hints  = kParameterIsAutomable;
+            parameter.name   = "Pre-delay";
+            parameter.symbol = "predelay";
+            parameter.unit   = "ms";
+            parameter.ranges.def = 0.0f;
+            parameter.ranges.min = 0.0f;
+            parameter.ranges.max = PRE_DELAY_MAX_ms;
+
+            param_pre_delay_ms = parameter.ranges.def;
+            publishParameters();
+            break;
+
+        case PARAM_QUALITY:
+            parameter.hints  = kParameterIsAutomable | kParameterIsInteger;
+            parameter.name   = "Quality";
+            parameter.symbol = "quality";
+            parameter.ranges.def = QUALITY_HQ;
+            parameter.ranges.min = 0;
+            parameter.ranges.max = NUM_QUALITIES - 1;
+            parameter.enumValues.count = NUM_QUALITIES;
+            parameter.enumValues.restrictedMode = true;
+            {
+                ParameterEnumerationValue* const values = new ParameterEnumerationValue[NUM_QUALITIES];
+                values[QUALITY_ECO].label = "Eco";
+                values[QUALITY_ECO].value = QUALITY_ECO;
+                values[QUALITY_HQ].label = "HQ";
+                values[QUALITY_HQ].value = QUALITY_HQ;
+                parameter.enumValues.values = values;
             }
-            else {
-                param_lowpass_data_left = biquad_calculate_lowpass(param_lowpass_Hz, getSampleRate(), true);
+
+            param_quality = parameter.ranges.def;
+            publishParameters();
+            break;
+
+        case PARAM_RENDER:
+            parameter.hints  = kParameterIsInteger;
+            parameter.name   = "Render";
+            parameter.symbol = "render";
+            parameter.ranges.def = RENDER_AUTO;
+            parameter.ranges.min = 0;
+            parameter.ranges.max = NUM_RENDER_MODES - 1;
+            parameter.enumValues.count = NUM_RENDER_MODES;
+            parameter.enumValues.restrictedMode = true;
+            {
+                ParameterEnumerationValue* const values = new ParameterEnumerationValue[NUM_RENDER_MODES];
+                values[RENDER_AUTO].label = "Auto";
+                values[RENDER_AUTO].value = RENDER_AUTO;
+                values[RENDER_LIVE].label = "Live";
+                values[RENDER_LIVE].value = RENDER_LIVE;
+                values[RENDER_OFFLINE].label = "Offline";
+                values[RENDER_OFFLINE].value = RENDER_OFFLINE;
+                parameter.enumValues.values = values;
             }
 
-            param_lowpass_data_right = param_lowpass_data_left;
+            param_render = parameter.ranges.def;
+            publishParameters();
+            break;
+
+        case PARAM_RUN_AVG:
+            initTimingParameter(parameter, "Run time avg", "run_avg", "us");
+            break;
+
+        case PARAM_RUN_MAX:
+            initTimingParameter(parameter, "Run time max", "run_max", "us");
+            break;
+
+        case PARAM_WAIT_AVG:
+            initTimingParameter(parameter, "Wait time avg", "wait_avg", "us");
+            break;
+
+        case PARAM_WAIT_MAX:
+            initTimingParameter(parameter, "Wait time max", "wait_max", "us");
+            break;
+
+        case PARAM_OVERRUNS:
+            initTimingParameter(parameter, "Overruns", "overruns", "");
+            parameter.hints |= kParameterIsInteger;
+            parameter.ranges.max = 1000000.0f;
+            break;
+
+        case PARAM_TAIL_MISSES:
+            initTimingParameter(parameter, "Tail misses", "tail_misses", "");
+            parameter.hints |= kParameterIsInteger;
+            parameter.ranges.max = 1000000.0f;
+            break;
+
+        case PARAM_QUALITY_USED:
+            parameter.hints  = kParameterIsOutput | kParameterIsInteger;
+            parameter.name   = "Quality used";
+            parameter.symbol = "quality_used";
+            parameter.ranges.def = QUALITY_HQ;
+            parameter.ranges.min = 0;
+            parameter.ranges.max = NUM_QUALITIES - 1;
             break;
 
         default:
@@ -220,6 +510,20 @@ protected:
         }
     }
 
+   /**
+      Read-only parameters reporting the timing of the audio thread.
+    */
+    void initTimingParameter(Parameter& parameter, const char *name, const char *symbol, const char *unit)
+    {
+        parameter.hints  = kParameterIsOutput;
+        parameter.name   = name;
+        parameter.symbol = symbol;
+        parameter.unit   = unit;
+        parameter.ranges.def = 0.0f;
+        parameter.ranges.min = 0.0f;
+        parameter.ranges.max = 100000.0f;
+    }
+
     /**
       Set the state key and default value of @a index.
       This function will be called once, shortly after the plugin is created.
@@ -229,46 +533,51 @@ protected:
     */
     void initState(uint32_t index, String& stateKey, String& defaultStateValue) override
     {
-        log_write("Call: initState()");
+        log_write_level(LOG_LEVEL_DEBUG, "Call: initState()");
+        std::lock_guard<std::mutex> lock(build_mutex);
 
         int err;
         char *str = NULL;
         uint32_t length = 0;
 
-        switch (index) {
-        case 0:
-            // Generate String-representation of default state
-            err = plugin_state_init_dirac(&state, getSampleRate());
-            if (err) {
-                log_write("Error resetting state");
-                return;
-            }
+        if (index == STATE_ROUTING) {
+            stateKey = ROUTING_STATE_KEY;
+            defaultStateValue = routing_cache;
+            return;
+        }
 
-            err = plugin_state_serialize(&state, &str, &length);
-            if (err) {
-                log_write("Error serializing state");
-                return;
-            }
+        if (index >= NUM_SLOTS) {
+            log_write_level(LOG_LEVEL_ERROR, "Index out of range");
+            return;
+        }
 
-            // Cache default value
-            state_cache = String(str);
+        // Generate String-representation of default state
+        plugin_state_free(&state[index]);
+        err = plugin_state_init_dirac(&state[index], getSampleRate());
+        if (err) {
+            log_write_level(LOG_LEVEL_ERROR, "Error resetting state");
+            return;
+        }
 
-            // Clean up
-            free(str);
+        err = plugin_state_serialize(&state[index], &str, &length);
+        if (err) {
+            log_write_level(LOG_LEVEL_ERROR, "Error serializing state");
+            return;
+        }
 
-            // Output the result
-            stateKey = "state";
-            defaultStateValue = state_cache;
+        // Cache default value
+        state_cache[index] = String(str);
 
-            // Initialize convolution engines
-            update();
+        // Clean up
+        free(str);
 
-            break;
+        // Output the result
+        stateKey = plugin_state_key(index);
+        defaultStateValue = state_cache[index];
 
-        default:
-            log_write("Index out of range");
-            break;
-        }
+        // Initialize convolution engines
+        invalidateSlot(index);
+        update();
     }
 
    /* --------------------------------------------------------------------------------------------------------
@@ -280,7 +589,6 @@ protected:
     */
     float getParameterValue(uint32_t index) const override
     {
-        log_write("Call: getParameterValue()");
         switch (index) {
         case PARAM_DRY:
             return param_dry_dB;
@@ -298,6 +606,56 @@ protected:
             return param_lowpass_Hz;
             break;
 
+        case PARAM_MORPH:
+            return param_morph;
+            break;
+
+        case PARAM_LENGTH:
+            return param_length_pct;
+            break;
+
+        case PARAM_DECAY:
+            return param_decay_dB_per_s;
+
+        case PARAM_PRE_DELAY:
+            return param_pre_delay_ms;
+
+        case PARAM_QUALITY:
+            return param_quality;
+            break;
+
+        case PARAM_RENDER:
+            return param_render;
+            break;
+
+        case PARAM_QUALITY_USED:
+            return quality_used.load();
+            break;
+
+        case PARAM_RUN_AVG:
+            return stats.run_avg_us;
+            break;
+
+        case PARAM_RUN_MAX:
+            return stats.run_max_us;
+            break;
+
+        case PARAM_WAIT_AVG:
+            return stats.wait_avg_us;
+            break;
+
+        case PARAM_WAIT_MAX:
+            return stats.wait_max_us;
+            break;
+
+        case PARAM_OVERRUNS:
+            return stats.overruns;
+            break;
+
+        case PARAM_TAIL_MISSES:
+            return stats.tail_misses;
+            break;
+
         default:
             return 0.0;
             break;
@@ -312,48 +670,57 @@ protected:
     */
     void setParameterValue(uint32_t index, float value) override
     {
-#ifdef GUNSHOT_LOG_FILE
-        log_write("Call: setParameterValue()");
-        char line[1024];
-        sprintf(line, "parameter[%d] = %f", index, value);
-        log_write(line);
-#endif
+        log_write_values(LOG_LEVEL_DEBUG, "Call: setParameterValue() index, value:", index, value);
 
         switch (index) {
         case PARAM_DRY:
             param_dry_dB = value;
-            param_dry_lin = convert_dB_to_linear(value);
+            publishParameters();
             break;
 
         case PARAM_WET:
             param_wet_dB = value;
-            param_wet_lin = convert_dB_to_linear(value);
+            publishParameters();
             break;
 
         case PARAM_HIGHPASS:
             param_highpass_Hz = value;
-
-            if (param_highpass_Hz < BIQUAD_MIN_Hz) {
-                param_highpass_data_left = biquad_calculate_nofilter(false);
-            }
-            else {
-                param_highpass_data_left = biquad_calculate_highpass(param_highpass_Hz, getSampleRate(), false);
-            }
-
-            param_highpass_data_right = param_highpass_data_left;
+            publishParameters();
             break;
 
         case PARAM_LOWPASS:
             param_lowpass_Hz = value;
+            publishParameters();
+            break;
 
-            if (param_lowpass_Hz > BIQUAD_MAX_Hz) {
-                param_lowpass_data_left = biquad_calculate_nofilter(false);
-            }
-            else {
-                param_lowpass_data_left = biquad_calculate_lowpass(param_lowpass_Hz, getSampleRate(), false);
-            }
+        case PARAM_MORPH:
+            param_morph = value;
+            publishParameters();
+            break;
+
+        case PARAM_LENGTH:
+            param_length_pct = value;
+            publishParameters();
+            break;
 
-            param_lowpass_data_right = param_lowpass_data_left;
+        case PARAM_DECAY:
+            param_decay_dB_per_s = value;
+            publishParameters();
+            break;
+
+        case PARAM_PRE_DELAY:
+            param_pre_delay_ms = value;
+            publishParameters();
+            break;
+
+        case PARAM_QUALITY:
+            param_quality = value;
+            publishParameters();
+            break;
+
+        case PARAM_RENDER:
+            param_render = value;
+            publishParameters();
             break;
 
         default:
@@ -370,11 +737,15 @@ protected:
      */
     String getState(const char* key) const override
     {
-        log_write("Call: getState()");
+        log_write_level(LOG_LEVEL_DEBUG, "Call: getState()");
 
         // Return the cached version of `state` instead of re-serializing it.
-        if (std::strcmp(key, "state") == 0) {
-            return state_cache;
+        int slot = plugin_state_slot_from_key(key);
+        if (slot >= 0) {
+            return state_cache[slot];
+        }
+        else if (std::strcmp(key, ROUTING_STATE_KEY) == 0) {
+            return routing_cache;
         }
         else {
             return String("");
@@ -389,16 +760,33 @@ protected:
     */
     void setState(const char* key, const char* value) override
     {
-        log_write("Call: setState()");
+        TRACE_ZONE("setState");
+        log_write_level(LOG_LEVEL_DEBUG, "Call: setState()");
         // log_write(value);
+        std::lock_guard<std::mutex> lock(build_mutex);
         int err;
-        if (std::strcmp(key, "state") == 0) {
-            err = plugin_state_deserialize(&state, (char *)value, std::strlen(value));
+        int slot = plugin_state_slot_from_key(key);
+        if (slot >= 0) {
+            // The slot keeps its impulse response unless the new one is valid
+            plugin_state_t new_state;
+            err = plugin_state_deserialize(&new_state, (char *)value, std::strlen(value));
             if (err) {
-                log_write("Error deserializing state");
+                log_write_level(LOG_LEVEL_ERROR, "Error deserializing state");
                 return;
             }
-            state_cache = String(value);
+            plugin_state_free(&state[slot]);
+            state[slot] = new_state;
+            state_cache[slot] = String(value);
+            invalidateSlot(slot);
+            update();
+        }
+        else if (std::strcmp(key, ROUTING_STATE_KEY) == 0) {
+            err = routing_parse(&routing, value, DISTRHO_PLUGIN_NUM_INPUTS, DISTRHO_PLUGIN_NUM_OUTPUTS);
+            if (err) {
+                log_write_level(LOG_LEVEL_ERROR, "Error parsing routing");
+                return;
+            }
+            routing_cache = String(value);
             update();
         }
     }
@@ -407,71 +795,532 @@ protected:
     * Audio/MIDI Processing */
 
    /**
-      Update non-real-time parameters.
+      Sample rate convert an impulse response to the current sample rate
+      with the given libsamplerate converter. The channels are stored after
+      each other in the output, which is allocated with malloc() and must be
+      freed by the caller.
     */
-    void update(void)
+    int resampleImpulseResponse(const plugin_state_t *S, int converter, float **output, uint32_t *output_length)
+    {
+        TRACE_ZONE("resample");
+        uint32_t c;
+        uint32_t n;
+        int err;
+        SRC_DATA src_data;
+
+        src_data.src_ratio = getSampleRate() / S->ir_sample_rate_Hz;
+        src_data.input_frames = S->ir_num_samples_per_channel;
+        src_data.output_frames = (uint32_t)(src_data.src_ratio * S->ir_num_samples_per_channel) + 1;
+
+        float *out = (float *)malloc(sizeof(float) * S->ir_num_channels * src_data.output_frames);
+        if (out == nullptr) {
+            return 1;
+        }
+
+        // All channels have the same length, so the first one gives the
+        // position of the others.
+        uint32_t length = 0;
+        for (c = 0; c < S->ir_num_channels; c++) {
+            src_data.data_in = S->ir[c];
+            src_data.data_out = out + c * length;
+            err = src_simple(&src_data, converter, 1);
+            if (err) {
+                free(out);
+                return 1;
+            }
+            length = src_data.output_frames_gen;
+        }
+
+        // Increasing the sample rate also increases the amplitude so the
+        // impulse response is scaled down before initializing the
+        // convolver.
+        for (n = 0; n < S->ir_num_channels * length; n++) {
+            out[n] /= src_data.src_ratio;
+        }
+
+        *output = out;
+        *output_length = length;
+        return 0;
+    }
+
+   /**
+      Cut an impulse response where the energy that is left falls below
+      ECO_TRUNCATION_dB of its total energy in every channel, and return the
+      new length. The channels are moved to stay after each other.
+    */
+    static uint32_t truncateImpulseResponse(float *ir, uint32_t num_channels, uint32_t length)
     {
-        log_write("Call: update()");
+        const double threshold = pow(10.0, ECO_TRUNCATION_dB / 10.0);
+        uint32_t truncated = 0;
+        uint32_t c;
         uint32_t n;
-        uint32_t err;
-        static SRC_DATA src_data_left;
-        static SRC_DATA src_data_right;
 
-        // Sample rate convert left channel
-        src_data_left.data_in  = state.ir_left;
-        src_data_right.data_in = state.ir_right;
+        for (c = 0; c < num_channels; c++) {
+            const float *x = ir + c * length;
+            double total = 0.0;
+            for (n = 0; n < length; n++) {
+                total += (double)x[n] * x[n];
+            }
+            double left = 0.0;
+            n = length;
+            while (n > 0 && left + (double)x[n - 1] * x[n - 1] <= threshold * total) {
+                left += (double)x[n - 1] * x[n - 1];
+                n--;
+            }
+            truncated = std::max(truncated, n);
+        }
+
+        for (c = 1; c < num_channels; c++) {
+            memmove(ir + c * truncated, ir + c * length, sizeof(float) * truncated);
+        }
+        return truncated;
+    }
+
+   /**
+      Update non-real-time parameters. Slots without a resampled impulse
+      response are resampled first, see invalidateSlot(). Only the tier and
+      render mode that run() asked for are resampled and built, or before
+      run() has asked, the ones that the parameters select. Called with
+      build_mutex held.
+    */
+    void update(void)
+    {
+        TRACE_ZONE("update");
+        log_write_level(LOG_LEVEL_DEBUG, "Call: update()");
+        int err;
+
+        uint32_t q = wanted_quality.load();
+        bool offline = wanted_offline.load();
+        if (q >= NUM_QUALITIES) {
+            offline = (param_render == RENDER_OFFLINE);
+            q = (offline || param_quality >= 0.5f) ? QUALITY_HQ : QUALITY_ECO;
+        }
+
+        // Sample rate convert the slots that changed
+        const int converter = (q == QUALITY_ECO) ? SRC_SINC_FASTEST : SRC_SINC_BEST_QUALITY;
+        for (uint32_t s = 0; s < NUM_SLOTS; s++) {
+            if (resampled[q][s] == nullptr) {
+                err = resampleImpulseResponse(&state[s], converter, &resampled[q][s], &resampled_length[q][s]);
+                if (err) {
+                    resampled[q][s] = nullptr;
+                    return;
+                }
+                if (q == QUALITY_ECO) {
+                    resampled_length[q][s] = truncateImpulseResponse(resampled[q][s], state[s].ir_num_channels, resampled_length[q][s]);
+                }
+            }
+        }
+
+        configure(getPlan(q, offline), q, offline);
+    }
+
+   /**
+      Partitioning for tier @a q. The partition sizes are tuned for this CPU
+      in the background the first time a buffer size and impulse response
+      length are seen. Offline renders always use the default sizes, so that
+      their output is the same on every machine.
+    */
+    PartitionPlan getPlan(uint32_t q, bool offline)
+    {
+        if (offline) {
+            return PartitionPlanner::getDefaultPlan(getBufferSize());
+        }
+        return planner.getPlan(getBufferSize(), getResampledLength(q));
+    }
+
+   /**
+      Drop the resampled impulse response of a slot, so that the next
+      update() resamples it.
+    */
+    void invalidateSlot(uint32_t s)
+    {
+        for (uint32_t q = 0; q < NUM_QUALITIES; q++) {
+            free(resampled[q][s]);
+            resampled[q][s] = nullptr;
+        }
+    }
 
-        src_data_left.src_ratio  = getSampleRate() / state.ir_sample_rate_Hz;
-        src_data_right.src_ratio = getSampleRate() / state.ir_sample_rate_Hz;
+   /**
+      Length of the longest impulse response of tier @a q, which the
+      partitioning is planned for.
+    */
+    uint32_t getResampledLength(uint32_t q) const
+    {
+        uint32_t length = 0;
+        for (uint32_t s = 0; s < NUM_SLOTS; s++) {
+            length = std::max(length, resampled_length[q][s]);
+        }
+        return length;
+    }
 
-        src_data_left.input_frames  = state.ir_num_samples_per_channel;
-        src_data_right.input_frames = state.ir_num_samples_per_channel;
+   /**
+      Length of the longest impulse response at the current sample rate,
+      before Eco cuts it. The length parameter is a fraction of this, so it
+      means the same in both tiers.
+    */
+    uint32_t getImpulseResponseLength(void) const
+    {
+        uint32_t length = 0;
+        for (uint32_t s = 0; s < NUM_SLOTS; s++) {
+            const double ratio = getSampleRate() / state[s].ir_sample_rate_Hz;
+            length = std::max(length, (uint32_t)(ratio * state[s].ir_num_samples_per_channel));
+        }
+        return length;
+    }
 
-        src_data_left.output_frames  = (uint32_t)(src_data_left.src_ratio  * state.ir_num_samples_per_channel) + 1;
-        src_data_right.output_frames = (uint32_t)(src_data_right.src_ratio * state.ir_num_samples_per_channel) + 1;
+   /**
+      Ask for an engine of quality tier @a q, built for an offline render
+      or not, unless it has been asked for already. Called by run(), so the
+      engine is built by the engine builder thread, see buildEngines().
+    */
+    void requestEngine(uint32_t q, bool offline)
+    {
+        const bool offline_changed = (wanted_offline.exchange(offline) != offline);
+        if (wanted_quality.exchange(q) != q || offline_changed) {
+            engine_requests.fetch_add(1);
+            build_wake.post();
+        }
+    }
 
-        src_data_left.data_out  = nullptr;
-        src_data_right.data_out = nullptr;
+   /**
+      Wait until the builder thread has served the requests of run() so far
+      and take the engine it built, if any. Called by run() when rendering
+      offline, where there is no deadline, so that the block the engine
+      takes over at does not depend on how long it takes to build.
+    */
+    void waitForEngine(void)
+    {
+        const uint64_t requests = engine_requests.load();
+        while (engine_requests_served.load() < requests) {
+            served_wake.wait();
+        }
+        takeEngine();
+    }
 
-        src_data_left.data_out  = (float *)malloc(sizeof(float) * src_data_left.output_frames);
-        src_data_right.data_out = (float *)malloc(sizeof(float) * src_data_right.output_frames);
+   /**
+      Body of the engine builder thread: builds an engine for the tier and
+      render mode that run() asked for, unless the last engine was built for
+      them already.
+    */
+    void buildEngines(MyThread &thread)
+    {
+        while (true) {
+            build_wake.wait();
+            if (thread.shouldThreadExit()) {
+                return;
+            }
+            const uint64_t requests = engine_requests.load();
+            {
+                std::lock_guard<std::mutex> lock(build_mutex);
+                if (wanted_quality.load() != built_quality || wanted_offline.load() != built_offline) {
+                    update();
+                }
+            }
+            engine_requests_served.store(requests);
+            served_wake.post();
+        }
+    }
 
-        if (src_data_left.data_out == nullptr) {
+   /**
+      Decimation factor of the late tail that keeps its sample rate at or
+      above @a min_sample_rate_Hz.
+    */
+    uint32_t getTailDecimation(double min_sample_rate_Hz) const
+    {
+        uint32_t factor = 1;
+        while (factor < POLYPHASE_MAX_FACTOR && getSampleRate() / (2 * factor) >= min_sample_rate_Hz) {
+            factor *= 2;
+        }
+        return factor;
+    }
+
+   /**
+      Build a new engine of quality tier @a q from the resampled impulse
+      responses and hand it to run(). The other tier's resampled impulse
+      responses are dropped, so only one tier is held at a time. An engine
+      for an @a offline render must be deterministic, so the whole impulse
+      response is loaded before it is handed over and the tail is convolved
+      in the audio thread, where it is never skipped.
+    */
+    void configure(const PartitionPlan &new_plan, uint32_t q, bool offline)
+    {
+        TRACE_ZONE("configure");
+        uint32_t i;
+        uint32_t k;
+        uint32_t r;
+        uint32_t s;
+        engine_t *e = newEngine();
+        e->quality = q;
+        e->offline = offline;
+        e->ir_length = getImpulseResponseLength();
+        const size_t max_delay = (size_t)ceil(PRE_DELAY_MAX_ms * getSampleRate() / 1000.0);
+
+        // After this much silence the engine has no reverb left, including
+        // the tail blocks that are still queued or precalculated. When only
+        // the tier or the render mode changes, the previous engine rings out
+        // this long on top of the new one.
+        e->drain_length = getResampledLength(q) + max_delay + (CONVOLVER_TAIL_JOBS + 2) * new_plan.tailBlockSize;
+        e->drains_previous = (q != built_quality || offline != built_offline);
+        const routing_route_t *routes[PARTITIONED_CONVOLVER_MAX_PATHS];
+        const fftconvolver::Sample *irs[PARTITIONED_CONVOLVER_MAX_PATHS * NUM_SLOTS];
+        size_t ir_lengths[PARTITIONED_CONVOLVER_MAX_PATHS * NUM_SLOTS];
+        const uint32_t tail_decimation =
+            getTailDecimation((q == QUALITY_ECO) ? ECO_LATE_TAIL_MIN_SAMPLE_RATE_Hz : LATE_TAIL_MIN_SAMPLE_RATE_Hz);
+
+        // Load impulse reponses into convolvers. Each input has one
+        // convolver with one path per route from that input.
+        for (i = 0; i < DISTRHO_PLUGIN_NUM_INPUTS; i++) {
+            uint32_t paths = 0;
+            for (r = 0; r < routing.num_routes; r++) {
+                if (routing.routes[r].input == i) {
+                    e->path_outputs[i][paths] = routing.routes[r].output;
+                    routes[paths++] = &routing.routes[r];
+                }
+            }
+
+            e->num_paths[i] = paths;
+            if (paths == 0) {
+                continue;
+            }
+            for (k = 0; k < paths; k++) {
+                for (s = 0; s < NUM_SLOTS; s++) {
+                    uint32_t channel = routes[k]->ir_channel % state[s].ir_num_channels;
+                    irs[k * NUM_SLOTS + s] = (fftconvolver::Sample *)(resampled[q][s] + channel * resampled_length[q][s]);
+                    ir_lengths[k * NUM_SLOTS + s] = resampled_length[q][s];
+                }
+            }
+            e->convolvers[i].setTailDecimation(tail_decimation);
+            e->convolvers[i].setTailWorkerCount(TAIL_WORKERS_MAX);
+            e->convolvers[i].setBackgroundLoading(!offline);
+            e->convolvers[i].setSynchronousTail(offline);
+            e->convolvers[i].setHugePages(true);
+            e->convolvers[i].setMaxDelay(max_delay);
+            e->convolvers[i].init(new_plan.headBlockSize, new_plan.tailBlockSize, irs, ir_lengths, NUM_SLOTS, paths);
+        }
+
+        for (s = 0; s < NUM_SLOTS; s++) {
+            for (uint32_t other = 0; other < NUM_QUALITIES; other++) {
+                if (other != q) {
+                    free(resampled[other][s]);
+                    resampled[other][s] = nullptr;
+                }
+            }
+        }
+        plan = new_plan;
+        built_quality = q;
+        built_offline = offline;
+        installEngine(e);
+    }
+
+    engine_t *newEngine(void)
+    {
+        engine_t *e = new engine_t;
+        e->ir_length = 0;
+        e->quality = QUALITY_HQ;
+        e->offline = false;
+        e->drains_previous = false;
+        e->drain_length = 0;
+        e->retired_next = nullptr;
+        for (uint32_t i = 0; i < DISTRHO_PLUGIN_NUM_INPUTS; i++) {
+            e->num_paths[i] = 0;
+        }
+        return e;
+    }
+
+    static void deleteEngine(engine_t *e)
+    {
+        if (e == nullptr) {
             return;
         }
-        if (src_data_right.data_out == nullptr) {
+        for (uint32_t i = 0; i < DISTRHO_PLUGIN_NUM_INPUTS; i++) {
+            e->convolvers[i].reset();
+        }
+        delete e;
+    }
+
+   /**
+      Hand a new engine to run() without blocking the audio thread or waiting
+      for it. The engine is left in next_engine for run() to swap in at the
+      start of its next block, also while the plugin is deactivated, so that
+      `engine` is only ever changed by run(). An engine that run() has not
+      picked up yet is simply replaced. Engines that run() handed back are
+      freed here, by deactivate() and by the destructor.
+    */
+    void installEngine(engine_t *e)
+    {
+        TRACE_ZONE("installEngine");
+        freeRetiredEngines();
+        deleteEngine(next_engine.exchange(e, std::memory_order_acq_rel));
+    }
+
+   /**
+      Swap in the engine from installEngine(), if any. Called by run() at the
+      start of a block. When the new engine only changes the quality tier,
+      the previous one keeps ringing out on silence, see processChunk(), so
+      the reverb carries on across the switch. Otherwise it is retired.
+    */
+    void takeEngine(void)
+    {
+        engine_t *e = next_engine.exchange(nullptr, std::memory_order_acq_rel);
+        if (e == nullptr) {
             return;
         }
+        if (e->drains_previous) {
+            retireEngine(draining_engine);
+            draining_engine = engine;
+            draining_frames = engine->drain_length;
+        }
+        else {
+            retireEngine(engine);
+        }
+        engine = e;
+    }
 
-        err = src_simple(&src_data_left, SRC_SINC_BEST_QUALITY, 1);
-        if (err) {
+   /**
+      Hand an engine back from run(). It is pushed onto retired_engines,
+      which is only contended by freeRetiredEngines() taking the whole list,
+      so the audio thread never waits for it.
+    */
+    void retireEngine(engine_t *e)
+    {
+        if (e == nullptr) {
             return;
         }
-        err = src_simple(&src_data_right, SRC_SINC_BEST_QUALITY, 1);
-        if (err) {
+        engine_t *retired = retired_engines.load(std::memory_order_relaxed);
+        do {
+            e->retired_next = retired;
+        } while (!retired_engines.compare_exchange_weak(retired, e, std::memory_order_release,
+                                                        std::memory_order_relaxed));
+    }
+
+   /**
+      Free the engines that run() handed back. Called off the audio thread.
+    */
+    void freeRetiredEngines(void)
+    {
+        engine_t *e = retired_engines.exchange(nullptr, std::memory_order_acquire);
+        while (e != nullptr) {
+            engine_t *next = e->retired_next;
+            deleteEngine(e);
+            e = next;
+        }
+    }
+
+   /**
+      Adapt the partitioning to the current buffer size. The resampled
+      impulse responses are reused, and when the tail block size stays the
+      same, only the head of each convolver is transformed again while the
+      later tail keeps its spectra.
+    */
+    void replan(void)
+    {
+        TRACE_ZONE("replan");
+        const uint32_t q = built_quality;
+        const bool offline = built_offline;
+        if (q >= NUM_QUALITIES) {
+            update();
             return;
         }
+        for (uint32_t s = 0; s < NUM_SLOTS; s++) {
+            if (resampled[q][s] == nullptr) {
+                update();
+                return;
+            }
+        }
 
-        // Increasing the sample rate also increases the amplitude so the
-        // impulse response is scaled down before initializing the
-        // convolver.
-        for (n = 0; n < src_data_left.output_frames_gen; n++) {
-            src_data_left.data_out[n] /= src_data_left.src_ratio;
-            src_data_right.data_out[n] /= src_data_right.src_ratio;
+        // The engine is changed in place, which is only safe while run() is
+        // not called.
+        const PartitionPlan new_plan = getPlan(q, offline);
+        if (!active.load() && next_engine.load() == nullptr && engine->quality == q && engine->offline == offline &&
+            new_plan.tailBlockSize == plan.tailBlockSize) {
+            bool done = true;
+            for (uint32_t i = 0; i < DISTRHO_PLUGIN_NUM_INPUTS; i++) {
+                if (engine->num_paths[i] > 0 && !engine->convolvers[i].setHeadBlockSize(new_plan.headBlockSize)) {
+                    done = false;
+                }
+            }
+            if (done) {
+                plan = new_plan;
+                return;
+            }
+        }
+        configure(new_plan, q, offline);
+    }
+
+   /**
+      Hand the current parameter values to run(). Called on whichever thread
+      changes a parameter, which may be the audio thread, so it only copies
+      the values; run() calculates what it needs from them, see
+      calculateParameters(). Parameters can be changed from several threads
+      at once, e.g. by the host from run() and by the UI, but the channel
+      takes one producer at a time. A thread that finds another one
+      publishing leaves it a pending change, which that thread publishes
+      before it lets go, so no thread waits.
+    */
+    void publishParameters(void)
+    {
+        param_pending.store(true);
+        while (param_pending.load() && !param_publishing.test_and_set(std::memory_order_acquire)) {
+            param_pending.store(false);
+            param_values_t v;
+            v.serial = ++param_serial;
+            v.dry_dB = param_dry_dB;
+            v.wet_dB = param_wet_dB;
+            v.highpass_Hz = param_highpass_Hz;
+            v.lowpass_Hz = param_lowpass_Hz;
+            v.morph = param_morph;
+            v.length_pct = param_length_pct;
+            v.decay_dB_per_s = param_decay_dB_per_s;
+            v.pre_delay_ms = param_pre_delay_ms;
+            v.quality = param_quality;
+            v.render = param_render;
+            param_channel.write(v);
+            param_publishing.clear(std::memory_order_release);
+        }
+    }
+
+   /**
+      Calculate the parameter snapshot from parameter values. Called by run()
+      on the audio thread, only in the first block after the values changed.
+    */
+    param_snapshot_t calculateParameters(const param_values_t &v)
+    {
+        param_snapshot_t p;
+
+        p.dry_lin = convert_dB_to_linear(v.dry_dB);
+        p.wet_lin = convert_dB_to_linear(v.wet_dB);
+
+        if (v.highpass_Hz < BIQUAD_MIN_Hz) {
+            p.highpass = biquad_calculate_nofilter();
+        }
+        else {
+            p.highpass = biquad_calculate_highpass(v.highpass_Hz, getSampleRate());
         }
 
-        uint32_t fft_block_size_head = 1;
-        while (fft_block_size_head < getBufferSize()) {
-            fft_block_size_head *= 2;
+        if (v.lowpass_Hz > BIQUAD_MAX_Hz) {
+            p.lowpass = biquad_calculate_nofilter();
         }
-        uint32_t fft_block_size_tail = fft_block_size_head > 8192 ? fft_block_size_head : 8192;
+        else {
+            p.lowpass = biquad_calculate_lowpass(v.lowpass_Hz, getSampleRate());
+        }
+
+        // The morph parameter crossfades neighbouring slots with equal power.
+        for (uint32_t s = 0; s < NUM_SLOTS; s++) {
+            float d = fabsf(v.morph - s);
+            p.slot_gains[s] = (d < 1.0f) ? cosf(0.5f * M_PI * d) : 0.0f;
+        }
+
+        // Length and decay shape the loaded impulse responses in the engine
+        p.length = v.length_pct / 100.0f;
+        p.decay = v.decay_dB_per_s * M_LN10 / 20.0 / getSampleRate();
+
+        // The pre-delay only delays the wet signal
+        p.pre_delay = (uint32_t)lrintf(v.pre_delay_ms * getSampleRate() / 1000.0f);
 
-        // Load impulse reponse into convolver
-        convolver_left.init(fft_block_size_head, fft_block_size_tail, (fftconvolver::Sample *)src_data_left.data_out, src_data_left.output_frames_gen);
-        convolver_right.init(fft_block_size_head, fft_block_size_tail, (fftconvolver::Sample *)src_data_right.data_out, src_data_right.output_frames_gen);
+        p.quality = (v.quality < 0.5f) ? QUALITY_ECO : QUALITY_HQ;
+        p.render = std::min((uint32_t)lrintf(v.render), (uint32_t)(NUM_RENDER_MODES - 1));
 
-        free(src_data_left.data_out);
-        free(src_data_right.data_out);
+        return p;
     }
 
    /**
@@ -480,33 +1329,195 @@ protected:
     */
     void run(const float** inputs, float** outputs, uint32_t frames) override
     {
+        TRACE_THREAD_NAME("audio");
+        TRACE_ZONE("run");
+        ScopedNoDenormals no_denormals;
+        const auto start = std::chrono::steady_clock::now();
+
+        // Parameter and engine changes take effect at block boundaries
+        takeEngine();
+        const param_values_t &values = param_channel.read();
+        if (values.serial != params_serial) {
+            params = calculateParameters(values);
+            params_serial = values.serial;
+        }
+        const param_snapshot_t &p = params;
+
+        // Offline renders use HQ, and with Render set to Offline an engine
+        // without deadlines. The engine for another tier or render mode is
+        // built off the audio thread, and this one plays until it is handed
+        // over. Without deadlines, run() waits for it instead.
+        const bool fast = render_detector_add(&render_detector, std::chrono::duration<double>(start.time_since_epoch()).count(),
+                                              frames, getSampleRate());
+        const bool offline = p.render == RENDER_OFFLINE;
+        const uint32_t quality = (offline || (p.render == RENDER_AUTO && fast)) ? QUALITY_HQ : p.quality;
+        if (quality != engine->quality || offline != engine->offline) {
+            requestEngine(quality, offline);
+            if (offline) {
+                waitForEngine();
+            }
+        }
+        quality_used.store(engine->quality, std::memory_order_relaxed);
+
+        engine_t *const engines[2] = { engine, draining_engine };
+        for (engine_t *e : engines) {
+            if (e == nullptr) {
+                continue;
+            }
+            const size_t length = (p.length < 1.0f) ? (size_t)(p.length * e->ir_length) : SIZE_MAX;
+            for (uint32_t i = 0; i < DISTRHO_PLUGIN_NUM_INPUTS; i++) {
+                for (uint32_t s = 0; s < NUM_SLOTS; s++) {
+                    e->convolvers[i].setSlotGain(s, p.slot_gains[s]);
+                }
+                e->convolvers[i].setEnvelope(length, p.decay);
+                e->convolvers[i].setDelay(p.pre_delay);
+            }
+        }
+
+        // The host may send more frames than getBufferSize()
+        for (uint32_t offset = 0; offset < frames; offset += MAX_CHUNK_FRAMES) {
+            const uint32_t chunk = std::min(frames - offset, (uint32_t)MAX_CHUNK_FRAMES);
+            processChunk(p, inputs, outputs, offset, chunk);
+        }
+
+        for (uint32_t o = 0; o < DISTRHO_PLUGIN_NUM_OUTPUTS; o++) {
+            biquad_flush_denormals(&highpass_states[o]);
+            biquad_flush_denormals(&lowpass_states[o]);
+        }
+
+        // Timing of this block
+        const auto end = std::chrono::steady_clock::now();
+        float run_us = std::chrono::duration<float, std::micro>(end - start).count();
+        uint64_t wait_ns = 0;
+        uint32_t tail_misses = 0;
+        for (engine_t *e : engines) {
+            for (uint32_t i = 0; i < DISTRHO_PLUGIN_NUM_INPUTS && e != nullptr; i++) {
+                wait_ns += e->convolvers[i].takeWaitTime();
+                tail_misses += e->convolvers[i].takeTailMisses();
+            }
+        }
+        float wait_us = 1e-3f * wait_ns;
+        block_stats_add(&stats, frames, getSampleRate(), run_us, wait_us, tail_misses);
+
+        if (draining_engine != nullptr && draining_frames == 0) {
+            retireEngine(draining_engine);
+            draining_engine = nullptr;
+        }
+    }
+
+   /**
+      True if the two blocks of @a frames samples share any memory.
+    */
+    static bool overlaps(const float *a, const float *b, uint32_t frames)
+    {
+        const uintptr_t x = (uintptr_t)a;
+        const uintptr_t y = (uintptr_t)b;
+        const uintptr_t bytes = sizeof(float) * frames;
+        return x < y + bytes && y < x + bytes;
+    }
+
+   /**
+      Process at most MAX_CHUNK_FRAMES frames starting at @a offset.
+    */
+    void processChunk(const param_snapshot_t &p, const float **inputs, float **outputs, uint32_t offset, uint32_t frames)
+    {
+        uint32_t i;
+        uint32_t k;
         uint32_t n;
-        float* outL = outputs[0];
-        float* outR = outputs[1];
+        uint32_t o;
+        const float *in[DISTRHO_PLUGIN_NUM_INPUTS];
+        float *out[DISTRHO_PLUGIN_NUM_OUTPUTS];
+        bool written[DISTRHO_PLUGIN_NUM_OUTPUTS];
+
+        for (o = 0; o < DISTRHO_PLUGIN_NUM_OUTPUTS; o++) {
+            out[o] = outputs[o] + offset;
+            written[o] = false;
+        }
 
-        // There seems to be an issue when reading directly from the `inputs`
-        // buffers, so instead, a local copy is created.
-        memcpy(inL, inputs[0], sizeof(float)*frames);
-        memcpy(inR, inputs[1], sizeof(float)*frames);
+        // Hosts may process in place, i.e. use the same buffer for an input
+        // and an output. The convolvers write their output before they have
+        // read all of their input, so an input that shares memory with any
+        // output is copied first. Other inputs are read directly.
+        for (i = 0; i < DISTRHO_PLUGIN_NUM_INPUTS; i++) {
+            in[i] = inputs[i] + offset;
+            for (o = 0; o < DISTRHO_PLUGIN_NUM_OUTPUTS; o++) {
+                if (overlaps(in[i], out[o], frames)) {
+                    memcpy(scratch_inputs[i], in[i], sizeof(float)*frames);
+                    in[i] = scratch_inputs[i];
+                    break;
+                }
+            }
+        }
 
-        // Real-time audio processing
-        convolver_left.process((fftconvolver::Sample *)inL, (fftconvolver::Sample *)outL, frames);
-        convolver_right.process((fftconvolver::Sample *)inR, (fftconvolver::Sample *)outR, frames);
+        // Real-time audio processing. The first route to an output is
+        // written to it directly and further routes are added to it.
+        for (i = 0; i < DISTRHO_PLUGIN_NUM_INPUTS; i++) {
+            const uint32_t paths = engine->num_paths[i];
+            fftconvolver::Sample *path_buffers[PARTITIONED_CONVOLVER_MAX_PATHS];
 
-        // Filter and mix
-        for (n = 0; n < frames; n++) {
+            if (paths == 0) {
+                continue;
+            }
+            for (k = 0; k < paths; k++) {
+                o = engine->path_outputs[i][k];
+                path_buffers[k] = written[o] ? scratch_routes[k] : out[o];
+                written[o] = true;
+            }
+
+            engine->convolvers[i].process((const fftconvolver::Sample *)in[i], path_buffers, frames);
+
+            for (k = 0; k < paths; k++) {
+                if (path_buffers[k] == scratch_routes[k]) {
+                    o = engine->path_outputs[i][k];
+                    for (n = 0; n < frames; n++) {
+                        out[o][n] += scratch_routes[k][n];
+                    }
+                }
+            }
+        }
+
+        // The engine of the tier that was left rings out on silence into its
+        // own routes, see takeEngine()
+        for (i = 0; i < DISTRHO_PLUGIN_NUM_INPUTS && draining_engine != nullptr; i++) {
+            const uint32_t paths = draining_engine->num_paths[i];
+            fftconvolver::Sample *drain_buffers[PARTITIONED_CONVOLVER_MAX_PATHS];
+
+            if (paths == 0) {
+                continue;
+            }
+            for (k = 0; k < paths; k++) {
+                drain_buffers[k] = scratch_drain[k];
+            }
+            draining_engine->convolvers[i].process(silence, drain_buffers, frames);
+            for (k = 0; k < paths; k++) {
+                o = draining_engine->path_outputs[i][k];
+                if (written[o]) {
+                    for (n = 0; n < frames; n++) {
+                        out[o][n] += scratch_drain[k][n];
+                    }
+                }
+                else {
+                    memcpy(out[o], scratch_drain[k], sizeof(float)*frames);
+                    written[o] = true;
+                }
+            }
+        }
+        draining_frames -= std::min(draining_frames, (size_t)frames);
 
-            // High-pass filter
-            outL[n] = biquad_process_sample(&param_highpass_data_left,  outL[n]);
-            outR[n] = biquad_process_sample(&param_highpass_data_right, outR[n]);
+        // Filter and mix. Output o gets the dry signal of input o.
+        for (o = 0; o < DISTRHO_PLUGIN_NUM_OUTPUTS; o++) {
+            float *y = out[o];
+            const float *x = o < DISTRHO_PLUGIN_NUM_INPUTS ? in[o] : nullptr;
 
-            // Low-pass filter
-            outL[n] = biquad_process_sample(&param_lowpass_data_left,  outL[n]);
-            outR[n] = biquad_process_sample(&param_lowpass_data_right, outR[n]);
+            if (!written[o]) {
+                memset(y, 0, sizeof(float)*frames);
+            }
 
-            // Mix with dry signal
-            outL[n] = param_dry_lin * inL[n] + param_wet_lin * outL[n];
-            outR[n] = param_dry_lin * inR[n] + param_wet_lin * outR[n];
+            for (n = 0; n < frames; n++) {
+                y[n] = biquad_process_sample(&p.highpass, &highpass_states[o], y[n]);
+                y[n] = biquad_process_sample(&p.lowpass, &lowpass_states[o], y[n]);
+                y[n] = (x != nullptr) ? p.dry_lin * x[n] + p.wet_lin * y[n] : p.wet_lin * y[n];
+            }
         }
     }
 
@@ -519,57 +1530,141 @@ protected:
     */
     void sampleRateChanged(double newSampleRate) override
     {
-        // FIXME: Should the filter coefficients be updated? Or will the
-        // parameters automatically be reset?
+        // The filter coefficients depend on the sample rate, so run()
+        // calculates them again for the new serial
         newSampleRate = newSampleRate;
+        std::lock_guard<std::mutex> lock(build_mutex);
+        publishParameters();
+        for (uint32_t s = 0; s < NUM_SLOTS; s++) {
+            invalidateSlot(s);
+        }
         update();
     }
 
    /**
-      Optional callback to inform the plugin about a buffer size change.@n
+      Optional callback to inform the plugin about a buffer size change.
       This function will only be called when the plugin is deactivated.
-      @note This value is only a hint!@n
-            Hosts might call run() with a higher or lower number of frames.
-      @see getBufferSize()
     */
-    void bufferSizeChanged(uint32_t newBufferSize)
+    void bufferSizeChanged(uint32_t newBufferSize) override
     {
-        if (inL != NULL) {
-            free(inL);
-        }
-        if (inR != NULL) {
-            free(inR);
-        }
-        inL = (float *)std::malloc(sizeof(float) * newBufferSize);
-        inR = (float *)std::malloc(sizeof(float) * newBufferSize);
+        newBufferSize = newBufferSize;
+        std::lock_guard<std::mutex> lock(build_mutex);
+        replan();
     }
 
-    // -------------------------------------------------------------------------------------------------------
-
-private:
-    // Temporary input buffers.
-    float *inL;
-    float *inR;
-
-    plugin_state_t state;
-    String state_cache; // Serialized version of `state` which can be quickly returned in `getState()`.
-
-    Convolver convolver_left;
-    Convolver convolver_right;
-
-    float param_dry_dB;
-    float param_dry_lin;
+   /**
+      Activate/deactivate the plugin. While the plugin is deactivated run() is
+      not called, so engines can be swapped and changed in place.
+    */
+    void activate() override
+    {
+        active.store(true);
+    }
 
-    float param_wet_dB;
-    float param_wet_lin;
+    void deactivate() override
+    {
+        active.store(false);
+        freeRetiredEngines();
+    }
 
-    float param_highpass_Hz;
-    biquad_t param_highpass_data_left;
-    biquad_t param_highpass_data_right;
+    // -------------------------------------------------------------------------------------------------------
 
-    float param_lowpass_Hz;
-    biquad_t param_lowpass_data_left;
-    biquad_t param_lowpass_data_right;
+private:
+    friend class EngineBuilderThread;
+
+    // Copies of inputs that share memory with an output, outputs of routes
+    // that are added to an output, and the outputs and input of a tier that
+    // rings out, see processChunk().
+    float scratch_inputs[DISTRHO_PLUGIN_NUM_INPUTS][MAX_CHUNK_FRAMES];
+    float scratch_routes[PARTITIONED_CONVOLVER_MAX_PATHS][MAX_CHUNK_FRAMES];
+    float scratch_drain[PARTITIONED_CONVOLVER_MAX_PATHS][MAX_CHUNK_FRAMES];
+    float silence[MAX_CHUNK_FRAMES];
+
+    plugin_state_t state[NUM_SLOTS];
+    String state_cache[NUM_SLOTS]; // Serialized version of `state` which can be quickly returned in `getState()`.
+
+    routing_t routing;
+    String routing_cache;
+
+    // The engine used by run(). New engines are built off the audio thread
+    // by configure(), e.g. in the LV2 worker, and handed over through
+    // next_engine; run() hands the previous ones back through
+    // retired_engines. See installEngine() and takeEngine().
+    engine_t *engine;
+    std::atomic<engine_t *> next_engine;
+    std::atomic<engine_t *> retired_engines;
+    std::atomic<bool> active;
+
+    // Engine of the quality tier that was left, which rings out until
+    // draining_frames reach zero. Only used by run().
+    engine_t *draining_engine;
+    size_t draining_frames;
+
+    // Quality tier and render mode that run() asks for, NUM_QUALITIES until
+    // it has asked; those of the last engine built, guarded by build_mutex;
+    // and the tier of the engine that run() plays. The builder thread builds
+    // the wanted engine when it is woken, see requestEngine().
+    std::atomic<uint32_t> wanted_quality;
+    std::atomic<bool> wanted_offline;
+    uint32_t built_quality;
+    bool built_offline;
+    std::atomic<uint32_t> quality_used;
+    WakeSemaphore build_wake;
+
+    // Requests of run() that woke the builder thread, and those it has
+    // served, built or not, see waitForEngine().
+    std::atomic<uint64_t> engine_requests;
+    std::atomic<uint64_t> engine_requests_served;
+    WakeSemaphore served_wake;
+    std::unique_ptr<EngineBuilderThread> builder;
+
+    // Held while the impulse responses, the routing or the sample rate change
+    // and while an engine is built from them, so that the host thread and the
+    // builder thread take turns.
+    std::mutex build_mutex;
+    PartitionPlanner planner;
+    PartitionPlan plan;
+
+    // Impulse response of each slot at the current sample rate, for the tier
+    // that was built last, with the channels after each other. Kept so that
+    // the convolvers can be set up again without resampling; nullptr when
+    // the slot must be resampled.
+    float *resampled[NUM_QUALITIES][NUM_SLOTS];
+    uint32_t resampled_length[NUM_QUALITIES][NUM_SLOTS];
+
+    // Parameter values, set and read from any thread
+    std::atomic<float> param_dry_dB;
+    std::atomic<float> param_wet_dB;
+
+    std::atomic<float> param_highpass_Hz;
+    std::atomic<float> param_lowpass_Hz;
+
+    std::atomic<float> param_morph;
+
+    std::atomic<float> param_length_pct;
+    std::atomic<float> param_decay_dB_per_s;
+    std::atomic<float> param_pre_delay_ms;
+    std::atomic<float> param_quality;
+    std::atomic<float> param_render;
+
+    // Parameter values for run(), see publishParameters(). The serial is
+    // only changed by the thread that is publishing.
+    SnapshotChannel<param_values_t> param_channel;
+    uint32_t param_serial;
+    std::atomic<bool> param_pending;
+    std::atomic_flag param_publishing;
+
+    // Snapshot that run() calculated from the values of serial params_serial,
+    // only used by run()
+    param_snapshot_t params;
+    uint32_t params_serial;
+
+    // Filter delay lines of each output, only used by run()
+    biquad_state_t highpass_states[DISTRHO_PLUGIN_NUM_OUTPUTS];
+    biquad_state_t lowpass_states[DISTRHO_PLUGIN_NUM_OUTPUTS];
+
+    block_stats_t stats;
+    render_detector_t render_detector;
 
    /**
       Set our plugin class as non-copyable and add a leak detector just in case.
@@ -577,6 +1672,13 @@ private:
     DISTRHO_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(GunShotPlugin)
 };
 
+void EngineBuilderThread::run()
+{
+    TRACE_THREAD_NAME("engine builder");
+    ScopedNoDenormals noDenormals;
+    _plugin.buildEngines(*this);
+}
+
 /* ------------------------------------------------------------------------------------------------------------
  * Plugin entry point, called by DPF to create a new plugin instance. */
 
@@ -16,6 +16,7 @@
 
 #include "DistrhoUI.hpp"
 #include "DistrhoDefines.h"
+#include "DistrhoPluginInfo.h"
 #include "Window.hpp"
 #include "extra/String.hpp"
 
@@ -40,9 +41,19 @@ class GunShotUI : public UI
 public:
     GunShotUI() : UI(800, 120)
     {
+        log_init();
         fFont = createFontFromMemory("sans", dejavusans_ttf, dejavusans_ttf_length, false);
         error_message = "";
         filebrowser_start_dir = String();
+        browsing_slot = 0;
+        for (uint32_t n = 0; n < NUM_PARAMETERS; n++) {
+            parameters[n] = 0.0f;
+        }
+    }
+
+    ~GunShotUI() override
+    {
+        log_close();
     }
 
 protected:
@@ -50,9 +61,21 @@ protected:
     * DSP/Plugin Callbacks */
 
    /**
-      This plugin has no parameters, so we can safely ignore this.
+      A parameter has changed on the plugin side.
+      Only the timing outputs are shown in the UI. The other parameters are
+      controlled from the generic UI of the host.
     */
-    void parameterChanged(uint32_t, float) override {}
+    void parameterChanged(uint32_t index, float value) override
+    {
+        if (index >= NUM_PARAMETERS) {
+            return;
+        }
+
+        parameters[index] = value;
+        if (index >= PARAM_RUN_AVG && index <= PARAM_TAIL_MISSES) {
+            repaint();
+        }
+    }
 
    /**
       A state has changed on the plugin side.
@@ -62,15 +85,17 @@ protected:
     {
         int err;
         plugin_state_t state;
+        int slot = plugin_state_slot_from_key(key);
 
-        if (std::strcmp(key, "state") == 0) {
+        if (slot >= 0) {
             err = plugin_state_deserialize(&state, (char *)value, std::strlen(value));
             if (err) {
-                log_write("Error deserializing state in UI");
+                log_write_level(LOG_LEVEL_ERROR, "Error deserializing state in UI");
                 return;
             }
 
-            shown_filename = String(state.filename);
+            shown_filename[slot] = String(state.filename);
+            plugin_state_free(&state);
         }
 
         repaint();
@@ -95,17 +120,40 @@ protected:
         closePath();
 
         drawCenter(h/2 - 1.5*l, "GUNSHOT CONVOLVER", 0xff, 0x00, 0x00);
-        drawCenter(h/2 - 0.5*l,  shown_filename, 0xff, 0xff, 0xff);
-        drawCenter(h/2 + 0.5*l, "Click to load impulse response", 0x99, 0x99, 0x99);
+
+        // One column per impulse response slot
+        for (uint32_t slot = 0; slot < PLUGIN_STATE_NUM_SLOTS; slot++) {
+            float x = getWidth() * (2*slot + 1) / (2*PLUGIN_STATE_NUM_SLOTS);
+            char label[] = "Click to load impulse response A";
+            label[sizeof(label) - 2] = 'A' + slot;
+
+            drawText(x, h/2 - 0.5*l, shown_filename[slot], 0xff, 0xff, 0xff);
+            drawText(x, h/2 + 0.5*l, label, 0x99, 0x99, 0x99);
+        }
+
         drawCenter(h/2 + 1.5*l,  error_message, 0xff, 0xff, 0x00);
+
+        // Audio thread timing
+        char timing[256];
+        snprintf(timing, sizeof(timing), "Run: %.0f us avg, %.0f us max    Wait: %.0f us avg, %.0f us max    Overruns: %.0f    Tail misses: %.0f",
+                 parameters[PARAM_RUN_AVG], parameters[PARAM_RUN_MAX],
+                 parameters[PARAM_WAIT_AVG], parameters[PARAM_WAIT_MAX],
+                 parameters[PARAM_OVERRUNS], parameters[PARAM_TAIL_MISSES]);
+        fontSize(12.0f);
+        drawCenter(h - 0.5*l, timing, 0x66, 0x66, 0x66);
     }
 
     void drawCenter(const float y, const char* const s, uint8_t r, uint8_t g, uint8_t b)
+    {
+        drawText(getWidth()/2, y, s, r, g, b);
+    }
+
+    void drawText(const float x, const float y, const char* const s, uint8_t r, uint8_t g, uint8_t b)
     {
         beginPath();
         fillColor(r, g, b);
         textAlign(ALIGN_CENTER|ALIGN_MIDDLE);
-        text(getWidth()/2, y, s, NULL);
+        text(x, y, s, NULL);
         closePath();
     }
 
@@ -165,8 +213,8 @@ protected:
         err = plugin_state_init(&state, filename);
 
         if (err) {
-            error_message = "ERROR: Supported formats: Uncompressed WAV and AIFF";
-            log_write(error_message);
+            error_message = "ERROR: Supported formats: Uncompressed WAV, RF64, W64 and AIFF";
+            log_write_level(LOG_LEVEL_ERROR, error_message);
             return;
         }
 
@@ -176,11 +224,11 @@ protected:
         err = plugin_state_serialize(&state, &str, &length);
         if (err) {
             error_message = "ERROR: Could not serialize impulse response";
-            log_write(error_message);
+            log_write_level(LOG_LEVEL_ERROR, error_message);
             return;
         }
-        setState("state", String(str));
-        shown_filename = String((char *)(filename + find_basename(filename)));
+        setState(plugin_state_key(browsing_slot), String(str));
+        shown_filename[browsing_slot] = String((char *)(filename + find_basename(filename)));
 
         // Clean up
         free(str);
@@ -203,6 +251,11 @@ protected:
         r.setY(0);
 
         if ((r.contains(ev.pos)) && (ev.press == true)) {
+            // The clicked column selects the slot to load into
+            browsing_slot = ev.pos.getX() * PLUGIN_STATE_NUM_SLOTS / getWidth();
+            if (browsing_slot >= PLUGIN_STATE_NUM_SLOTS) {
+                browsing_slot = PLUGIN_STATE_NUM_SLOTS - 1;
+            }
             repaint();
 
             Window& w = getParentWindow();
@@ -221,8 +274,10 @@ protected:
 private:
     FontId fFont;
     String error_message;
-    String shown_filename;
+    String shown_filename[PLUGIN_STATE_NUM_SLOTS];
     String filebrowser_start_dir;
+    uint32_t browsing_slot;
+    float parameters[NUM_PARAMETERS];
 
    /**
       Set our UI class as non-copyable and add a leak detector just in case.
@@ -0,0 +1,102 @@
+#include "arena.hpp"
+#include "DistrhoDefines.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef DISTRHO_OS_WINDOWS
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+static void* allocateAligned(size_t alignment, size_t bytes)
+{
+#ifdef DISTRHO_OS_WINDOWS
+    return _aligned_malloc(bytes, alignment);
+#else
+    void* data = nullptr;
+    return (posix_memalign(&data, alignment, bytes) == 0) ? data : nullptr;
+#endif
+}
+
+static void freeAligned(void* data)
+{
+#ifdef DISTRHO_OS_WINDOWS
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
+
+Arena::Arena() :
+    _data(nullptr),
+    _size(0),
+    _used(0)
+{
+}
+
+Arena::~Arena()
+{
+    reset();
+}
+
+size_t Arena::size(size_t bytes)
+{
+    return (bytes + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+}
+
+bool Arena::init(size_t bytes, bool hugePages)
+{
+    reset();
+    if (bytes == 0) {
+        return true;
+    }
+
+    size_t alignment = ARENA_ALIGNMENT;
+    bytes = size(bytes);
+    if (hugePages && bytes >= ARENA_HUGE_PAGE_SIZE) {
+        alignment = ARENA_HUGE_PAGE_SIZE;
+        bytes = (bytes + ARENA_HUGE_PAGE_SIZE - 1) / ARENA_HUGE_PAGE_SIZE * ARENA_HUGE_PAGE_SIZE;
+    }
+
+    _data = static_cast<unsigned char*>(allocateAligned(alignment, bytes));
+    if (_data == nullptr) {
+        return false;
+    }
+#if defined(MADV_HUGEPAGE) && !defined(DISTRHO_OS_WINDOWS)
+    // Before the pages are touched, so that they are faulted in as huge pages
+    if (alignment == ARENA_HUGE_PAGE_SIZE) {
+        madvise(_data, bytes, MADV_HUGEPAGE);
+    }
+#endif
+    memset(_data, 0, bytes);
+    _size = bytes;
+    return true;
+}
+
+void Arena::reset()
+{
+    if (_data != nullptr) {
+        freeAligned(_data);
+    }
+    _data = nullptr;
+    _size = 0;
+    _used = 0;
+}
+
+void* Arena::take(size_t bytes)
+{
+    bytes = size(bytes);
+    if (_data == nullptr || bytes > _size - _used) {
+        return nullptr;
+    }
+    void* buffer = _data + _used;
+    _used += bytes;
+    return buffer;
+}
+
+size_t Arena::getBytes() const
+{
+    return _size;
+}
@@ -0,0 +1,60 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Alignment of the arena and of every buffer taken from it: one cache line,
+// which is also enough for the widest SIMD loads.
+#define ARENA_ALIGNMENT 64
+
+// Arenas of at least this size can be backed by huge pages, see init().
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+// One block of memory that the buffers of an object are carved from, so
+// that they are allocated with a single call and lie next to each other in
+// the order they are taken.
+//
+// The owner adds up the sizes of its buffers with size(), allocates them
+// with init() and takes them with take() in the order they should be laid
+// out. Every buffer starts on a cache line, so buffers written by different
+// threads never share one. The memory starts out zeroed and is only freed as
+// a whole, by reset().
+class Arena
+{
+public:
+    Arena();
+    virtual ~Arena();
+
+    // Bytes that a buffer takes in the arena, rounded up to the alignment.
+    static size_t size(size_t bytes);
+
+    // Allocates bytes and zeroes them. With hugePages, an arena of at least
+    // ARENA_HUGE_PAGE_SIZE is aligned and rounded up to huge pages and the
+    // kernel is asked to back it with them, which saves TLB misses when it is
+    // walked (Linux only, ignored elsewhere). Returns false when out of
+    // memory. Not for the audio thread.
+    bool init(size_t bytes, bool hugePages);
+    void reset();
+
+    // The next buffer of bytes, or nullptr when the arena is used up.
+    void* take(size_t bytes);
+
+    template <typename T>
+    T* take(size_t count)
+    {
+        return static_cast<T*>(take(count * sizeof(T)));
+    }
+
+    // Bytes allocated, including the rounding to huge pages.
+    size_t getBytes() const;
+
+private:
+    unsigned char* _data;
+    size_t _size;
+    size_t _used;
+
+    Arena(const Arena&);
+    Arena& operator=(const Arena&);
+};
+
+#endif
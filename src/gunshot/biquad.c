@@ -2,7 +2,7 @@
 #include <math.h>
 #include "log.h"
 
-static void _clear_delay_line(biquad_t *s)
+void biquad_clear(biquad_state_t *s)
 {
     s->x[0] = 0.0;
     s->x[1] = 0.0;
@@ -13,7 +13,7 @@ static void _clear_delay_line(biquad_t *s)
     s->y[2] = 0.0;
 }
 
-static biquad_t _biquad_calculate_generic(float cutoff_Hz, float sample_rate_Hz, bool clear_delay_line, bool is_low_pass)
+static biquad_coefficients_t _biquad_calculate_generic(float cutoff_Hz, float sample_rate_Hz, bool is_low_pass)
 {
     // Apogee Filter Design Equations
     float Q = 0.707;
@@ -21,7 +21,7 @@ static biquad_t _biquad_calculate_generic(float cutoff_Hz, float sample_rate_Hz,
     float wS = sin(wc);
     float wC = cos(wc);
     float alpha = wS/(2.0*Q);
-    biquad_t s;
+    biquad_coefficients_t s;
 
     s.a[0] = 1.0+alpha;
     s.a[1] = -2.0*wC;
@@ -38,27 +38,23 @@ static biquad_t _biquad_calculate_generic(float cutoff_Hz, float sample_rate_Hz,
         s.b[2] = s.b[0];
     }
 
-    if (clear_delay_line) {
-        _clear_delay_line(&s);
-    }
-
     return s;
 }
 
-biquad_t biquad_calculate_highpass(float cutoff_Hz, float sample_rate_Hz, bool clear_delay_line)
+biquad_coefficients_t biquad_calculate_highpass(float cutoff_Hz, float sample_rate_Hz)
 {
-    return _biquad_calculate_generic(cutoff_Hz, sample_rate_Hz, clear_delay_line, false);
+    return _biquad_calculate_generic(cutoff_Hz, sample_rate_Hz, false);
 }
 
-biquad_t biquad_calculate_lowpass(float cutoff_Hz, float sample_rate_Hz, bool clear_delay_line)
+biquad_coefficients_t biquad_calculate_lowpass(float cutoff_Hz, float sample_rate_Hz)
 {
-    return _biquad_calculate_generic(cutoff_Hz, sample_rate_Hz, clear_delay_line, true);
+    return _biquad_calculate_generic(cutoff_Hz, sample_rate_Hz, true);
 }
 
-biquad_t biquad_calculate_nofilter(bool clear_delay_line)
+biquad_coefficients_t biquad_calculate_nofilter(void)
 {
-    log_write("Call: biquad_calculate_nofilter()");
-    biquad_t s;
+    log_write_level(LOG_LEVEL_DEBUG, "Call: biquad_calculate_nofilter()");
+    biquad_coefficients_t s;
     s.a[0] = 1.0;
     s.a[1] = 0.0;
     s.a[2] = 0.0;
@@ -66,18 +62,15 @@ biquad_t biquad_calculate_nofilter(bool clear_delay_line)
     s.b[1] = 0.0;
     s.b[2] = 0.0;
 
-    if (clear_delay_line) {
-        _clear_delay_line(&s);
-    }
     return s;
 }
 
-float biquad_process_sample(biquad_t *s,  float input)
+float biquad_process_sample(const biquad_coefficients_t *c, biquad_state_t *s, float input)
 {
     // Apply difference equation
     s->x[0] = input;
-    s->y[0] = s->b[0]*s->x[0] + s->b[1]*s->x[1] + s->b[2]*s->x[2] - s->a[1]*s->y[1] - s->a[2]*s->y[2];
-    s->y[0] /= s->a[0];
+    s->y[0] = c->b[0]*s->x[0] + c->b[1]*s->x[1] + c->b[2]*s->x[2] - c->a[1]*s->y[1] - c->a[2]*s->y[2];
+    s->y[0] /= c->a[0];
     
     // Update delay lines
     s->x[2] = s->x[1];
@@ -88,3 +81,18 @@ float biquad_process_sample(biquad_t *s,  float input)
 
     return s->y[0];
 }
+
+// The delay lines of a filter with silent input decay towards zero through
+// the denormal range. Call this once per block so that they reach zero even
+// where flush-to-zero is not available.
+void biquad_flush_denormals(biquad_state_t *s)
+{
+    for (uint32_t n = 1; n < 3; n++) {
+        if (fabsf(s->x[n]) < BIQUAD_FLUSH_THRESHOLD) {
+            s->x[n] = 0.0;
+        }
+        if (fabsf(s->y[n]) < BIQUAD_FLUSH_THRESHOLD) {
+            s->y[n] = 0.0;
+        }
+    }
+}
@@ -11,17 +11,28 @@ extern "C" {
 #define BIQUAD_MAX_Hz 20000.0
 #define BIQUAD_MIN_Hz 20.0
 
+// Delay line values below this are set to zero by biquad_flush_denormals()
+#define BIQUAD_FLUSH_THRESHOLD 1e-15f
+
+// The coefficients and the delay lines are kept apart so that new
+// coefficients can be calculated on another thread and swapped in while the
+// delay lines carry on.
 typedef struct {
     float b[3]; // Input coefficients
     float a[3]; // Output coefficients
+} biquad_coefficients_t;
+
+typedef struct {
     float x[3]; // Input delay line
     float y[3]; // Output delay line
-} biquad_t;
+} biquad_state_t;
 
-biquad_t biquad_calculate_highpass(float cutoff_Hz, float sample_rate_Hz, bool clear_delay_line);
-biquad_t biquad_calculate_lowpass(float cutoff_Hz, float sample_rate_Hz, bool clear_delay_line);
-biquad_t biquad_calculate_nofilter(bool clear_delay_line);
-float biquad_process_sample(biquad_t *s,  float input);
+biquad_coefficients_t biquad_calculate_highpass(float cutoff_Hz, float sample_rate_Hz);
+biquad_coefficients_t biquad_calculate_lowpass(float cutoff_Hz, float sample_rate_Hz);
+biquad_coefficients_t biquad_calculate_nofilter(void);
+void biquad_clear(biquad_state_t *s);
+float biquad_process_sample(const biquad_coefficients_t *c, biquad_state_t *s, float input);
+void biquad_flush_denormals(biquad_state_t *s);
 
 #ifdef __cplusplus
 }
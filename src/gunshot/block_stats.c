@@ -0,0 +1,53 @@
+#include "block_stats.h"
+
+static void _clear_window(block_stats_t *stats)
+{
+    stats->window_frames = 0;
+    stats->num_blocks = 0;
+    stats->run_sum_us = 0.0;
+    stats->wait_sum_us = 0.0;
+    stats->run_peak_us = 0.0;
+    stats->wait_peak_us = 0.0;
+}
+
+void block_stats_init(block_stats_t *stats)
+{
+    _clear_window(stats);
+
+    stats->run_avg_us = 0.0;
+    stats->run_max_us = 0.0;
+    stats->wait_avg_us = 0.0;
+    stats->wait_max_us = 0.0;
+    stats->overruns = 0;
+    stats->tail_misses = 0;
+}
+
+void block_stats_add(block_stats_t *stats, uint32_t frames, float sample_rate_Hz, float run_us, float wait_us, uint32_t tail_misses)
+{
+    float deadline_us = 1e6 * frames / sample_rate_Hz;
+
+    if (run_us > deadline_us) {
+        stats->overruns++;
+    }
+    stats->tail_misses += tail_misses;
+
+    stats->window_frames += frames;
+    stats->num_blocks++;
+    stats->run_sum_us += run_us;
+    stats->wait_sum_us += wait_us;
+    if (run_us > stats->run_peak_us) {
+        stats->run_peak_us = run_us;
+    }
+    if (wait_us > stats->wait_peak_us) {
+        stats->wait_peak_us = wait_us;
+    }
+
+    // Publish once per second of audio
+    if (stats->window_frames >= sample_rate_Hz) {
+        stats->run_avg_us = stats->run_sum_us / stats->num_blocks;
+        stats->run_max_us = stats->run_peak_us;
+        stats->wait_avg_us = stats->wait_sum_us / stats->num_blocks;
+        stats->wait_max_us = stats->wait_peak_us;
+        _clear_window(stats);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef BLOCK_STATS_H
+#define BLOCK_STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Per-block timing statistics of the audio thread.
+//
+// Blocks are accumulated over a window of about one second. At the end of
+// each window the average and maximum run and wait times are published and
+// the accumulators are cleared. The overrun counter counts blocks where
+// run() took longer than the duration of the block and is never cleared.
+// Likewise, the tail miss counter counts tail blocks that the background
+// thread did not finish in time (see Convolver::setTailWaitBudget()).
+
+typedef struct {
+    // Current window
+    uint32_t window_frames;
+    uint32_t num_blocks;
+    double run_sum_us;
+    double wait_sum_us;
+    float run_peak_us;
+    float wait_peak_us;
+
+    // Published values
+    float run_avg_us;
+    float run_max_us;
+    float wait_avg_us;
+    float wait_max_us;
+    uint32_t overruns;
+    uint32_t tail_misses;
+} block_stats_t;
+
+void block_stats_init(block_stats_t *stats);
+void block_stats_add(block_stats_t *stats, uint32_t frames, float sample_rate_Hz, float run_us, float wait_us, uint32_t tail_misses);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
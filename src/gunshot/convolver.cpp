@@ -1,4 +1,15 @@
 #include "convolver.hpp"
+#include "trace.hpp"
+#include "denormal.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace fftconvolver;
 
 class ConvolverBackgroundThread : public MyThread
 {
@@ -13,12 +24,14 @@ public:
     virtual ~ConvolverBackgroundThread()
     {
         signalThreadShouldExit();
-        _convolver._backgroundProcessingStartedEvent.signal();
+        _convolver._backgroundProcessingStartedEvent.post();
         stopThread(1000);
     }
 
     virtual void run()
     {
+        TRACE_THREAD_NAME("convolver tail");
+        ScopedNoDenormals noDenormals;
         while (!shouldThreadExit())
         {
             _convolver._backgroundProcessingStartedEvent.wait();
@@ -27,7 +40,6 @@ public:
                 return;
             }
             _convolver.doBackgroundProcessing();
-            _convolver._backgroundProcessingFinishedEvent.signal();
         }
     }
 
@@ -38,27 +50,842 @@ private:
     ConvolverBackgroundThread& operator=(const ConvolverBackgroundThread&);
 };
 
+// Transforms the tail partitions after init() has returned. The thread runs
+// once per impulse response and exits when everything is published.
+class ConvolverLoaderThread : public MyThread
+{
+public:
+    explicit ConvolverLoaderThread(Convolver& convolver) :
+        MyThread("ConvolverLoaderThread"),
+        _convolver(convolver)
+    {
+    }
+
+    virtual void run()
+    {
+        TRACE_THREAD_NAME("convolver loader");
+        _convolver.doLoading();
+    }
+
+private:
+    Convolver& _convolver;
+
+    ConvolverLoaderThread(const ConvolverLoaderThread&);
+    ConvolverLoaderThread& operator=(const ConvolverLoaderThread&);
+};
+
 Convolver::Convolver() :
-    fftconvolver::TwoStageFFTConvolver(),
+    _headBlockSize(0),
+    _tailBlockSize(0),
+    _headConvolver(),
+    _tailConvolver0(),
+    _tailOutput0(),
+    _tailPrecalculated0(),
+    _tailConvolver(),
+    _tailPrecalculated(),
+    _tailInput(),
+    _tailInputFill(0),
+    _precalculatedPos(0),
+    _tailJobsSubmitted(0),
+    _tailJobsDone(0),
+    _tailJobsSkipped(0),
+    _tailSilence(),
+    _tailWaitBudget(CONVOLVER_DEFAULT_TAIL_WAIT_BUDGET_ns),
+    _synchronousTail(false),
+    _tailMisses(0),
+    _tailDecimation(1),
+    _lateDecimation(1),
+    _lateConvolver(),
+    _lateDecimator(),
+    _lateInput(),
+    _lateOutput(),
+    _ir(),
+    _irLen(0),
+    _pathIrLen(0),
+    _slotCount(0),
+    _pathCount(1),
+    _irLate(),
+    _irLateLen(0),
+    _irLateOffset(0),
+    _lateStart(0),
+    _loaded(true),
+    _loadedPartitions(0),
+    _backgroundLoading(true),
+    _envelopeLength(SIZE_MAX),
+    _envelopeDecay(0.0f),
+    _delay(0),
+    _maxDelay(0),
+    _waitTime(0),
     _thread(),
-    _backgroundProcessingFinishedEvent()
+    _loader(),
+    _backgroundWaiting(false)
 {
+    for (size_t j = 0; j < CONVOLVER_TAIL_JOBS; ++j) {
+        _tailJobs[j].skippedBefore = 0;
+    }
+    for (size_t s = 0; s < PARTITIONED_CONVOLVER_MAX_SLOTS; ++s) {
+        _slotIrLens[s] = 0;
+        _slotIrOffsets[s] = 0;
+    }
+    _loader.reset(new ConvolverLoaderThread(*this));
     _thread.reset(new ConvolverBackgroundThread(*this));
-    _backgroundProcessingFinishedEvent.signal();
 }
 
 Convolver::~Convolver()
 {
+    stopLoading();
+    _loader = nullptr;
     _thread = nullptr;
 }
 
+void Convolver::stopLoading()
+{
+    _loader->signalThreadShouldExit();
+    _loader->stopThread(-1);
+}
+
+void Convolver::reset()
+{
+    stopLoading();
+
+    // Make sure the background thread is not using the tail while it is
+    // being torn down.
+    waitForBackgroundProcessing();
+
+    _headBlockSize = 0;
+    _tailBlockSize = 0;
+    _headConvolver.reset();
+    _tailConvolver0.reset();
+    _tailConvolver.reset();
+    _tailOutput0.clear();
+    _tailPrecalculated0.clear();
+    _tailPrecalculated.clear();
+    _tailInput.clear();
+    _tailInputFill = 0;
+    _precalculatedPos = 0;
+    for (size_t j = 0; j < CONVOLVER_TAIL_JOBS; ++j) {
+        _tailJobs[j].input.clear();
+        _tailJobs[j].output.clear();
+        _tailJobs[j].skippedBefore = 0;
+    }
+    _tailJobsSubmitted.store(0);
+    _tailJobsDone.store(0);
+    _tailJobsSkipped = 0;
+    _tailSilence.clear();
+    _lateDecimation = 1;
+    _lateConvolver.reset();
+    _lateInput.clear();
+    _lateOutput.clear();
+    _ir.clear();
+    _irLen = 0;
+    for (size_t s = 0; s < PARTITIONED_CONVOLVER_MAX_SLOTS; ++s) {
+        _slotIrLens[s] = 0;
+        _slotIrOffsets[s] = 0;
+    }
+    _pathIrLen = 0;
+    _slotCount = 0;
+    _pathCount = 1;
+    _irLate.clear();
+    _irLateLen = 0;
+    _irLateOffset = 0;
+    _lateStart = 0;
+    _loaded.store(true);
+}
+
+bool Convolver::init(size_t headBlockSize, size_t tailBlockSize, const Sample* ir, size_t irLen)
+{
+    return init(headBlockSize, tailBlockSize, &ir, &irLen, 1);
+}
+
+bool Convolver::init(size_t headBlockSize, size_t tailBlockSize, const Sample* const* irs, const size_t* irLens,
+                     size_t slotCount, size_t pathCount)
+{
+    reset();
+
+    if (headBlockSize == 0 || tailBlockSize == 0) {
+        return false;
+    }
+    if (slotCount == 0 || slotCount > PARTITIONED_CONVOLVER_MAX_SLOTS) {
+        return false;
+    }
+    if (pathCount == 0 || pathCount > PARTITIONED_CONVOLVER_MAX_PATHS) {
+        return false;
+    }
+    if (headBlockSize > tailBlockSize) {
+        std::swap(headBlockSize, tailBlockSize);
+    }
+
+    // Ignore zeros at the end of the impulse responses because they only
+    // waste computation time
+    const size_t irCount = pathCount * slotCount;
+    size_t irLen = 0;
+    size_t slotIrLens[PARTITIONED_CONVOLVER_MAX_SLOTS] = {0};
+    for (size_t k = 0; k < irCount; ++k) {
+        size_t len = irLens[k];
+        while (len > 0 && fabs(irs[k][len - 1]) < 0.000001) {
+            --len;
+        }
+        slotIrLens[k % slotCount] = std::max(slotIrLens[k % slotCount], len);
+        irLen = std::max(irLen, len);
+    }
+    _pathCount = pathCount;
+    if (irLen == 0) {
+        // Silent, but all paths still get their output cleared
+        _headConvolver.init(headBlockSize, 0, slotCount, pathCount);
+        return true;
+    }
+
+    _headBlockSize = NextPowerOf2(headBlockSize);
+    _tailBlockSize = NextPowerOf2(tailBlockSize);
+
+    _irLen = irLen;
+    _slotCount = slotCount;
+    for (size_t s = 0; s < _slotCount; ++s) {
+        _slotIrLens[s] = slotIrLens[s];
+        _slotIrOffsets[s] = _pathIrLen;
+        _pathIrLen += _slotIrLens[s];
+    }
+    _ir.resize(_pathCount * _pathIrLen);
+    for (size_t k = 0; k < irCount; ++k) {
+        const size_t p = k / _slotCount;
+        const size_t s = k % _slotCount;
+        memcpy(_ir.data() + p * _pathIrLen + _slotIrOffsets[s], irs[k], std::min(irLens[k], _slotIrLens[s]) * sizeof(Sample));
+    }
+
+    if (irLen > 2 * _tailBlockSize && _tailDecimation > 1) {
+        // The late tail takes the place of the background stage, so its
+        // output must line up with sample 2 * _tailBlockSize of the impulse
+        // response. The convolution at the reduced rate is delayed by the
+        // decimation and interpolation filters, which is made up for by
+        // starting its impulse response earlier. Its first samples must
+        // still be after the onset of the filtered late part, so the late
+        // part starts a little later and the first tail stage is extended up
+        // to it.
+        const size_t factor = _tailDecimation;
+        const size_t lateBlockSize = _tailBlockSize / factor;
+        _lateDecimator.init(factor, _tailBlockSize);
+        for (size_t p = 0; p < _pathCount; ++p) {
+            _lateInterpolators[p].init(factor, lateBlockSize);
+        }
+        const size_t filterDelay = _lateDecimator.getDelay() + _lateInterpolators[0].getDelay();
+        _irLateOffset = 2 * _tailBlockSize + filterDelay - (factor - 1);
+        _lateStart = _irLateOffset + _lateDecimator.getDelay();
+        if (irLen > _lateStart && _lateStart <= 3 * _tailBlockSize) {
+            _lateDecimation = factor;
+            _irLateLen = (irLen + _lateDecimator.getDelay() - _irLateOffset + factor - 1) / factor;
+            _irLate.resize(irCount * _irLateLen);
+            size_t lateLens[PARTITIONED_CONVOLVER_MAX_SLOTS];
+            for (size_t s = 0; s < _slotCount; ++s) {
+                // A slot that ends before the late tail has no late part
+                const size_t slotIrLen = _slotIrLens[s];
+                lateLens[s] = (slotIrLen > _lateStart) ?
+                    (slotIrLen + _lateDecimator.getDelay() - _irLateOffset + factor - 1) / factor : 0;
+            }
+            _lateConvolver.init(lateBlockSize, _irLateLen, _slotCount, _pathCount, _maxDelay / factor, lateLens);
+            _lateInput.resize(lateBlockSize);
+            _lateOutput.resize(_pathCount * lateBlockSize);
+        }
+    }
+
+    initHead();
+
+    if (irLen > 2 * _tailBlockSize) {
+        if (_lateDecimation == 1) {
+            const size_t tailIrLen = irLen - (2 * _tailBlockSize);
+            size_t tailLens[PARTITIONED_CONVOLVER_MAX_SLOTS];
+            getStageLengths(2 * _tailBlockSize, tailIrLen, tailLens);
+            _tailConvolver.init(_tailBlockSize, tailIrLen, _slotCount, _pathCount, _maxDelay, tailLens);
+        }
+        _tailPrecalculated.resize(_pathCount * _tailBlockSize);
+        for (size_t j = 0; j < CONVOLVER_TAIL_JOBS; ++j) {
+            _tailJobs[j].input.resize(_tailBlockSize);
+            _tailJobs[j].output.resize(_pathCount * _tailBlockSize);
+        }
+        _tailSilence.resize(_tailBlockSize);
+    }
+
+    updateEnvelope();
+    updateDelay();
+
+    if (_tailPrecalculated0.size() > 0 || _tailPrecalculated.size() > 0) {
+        _tailInput.resize(_tailBlockSize);
+
+        // The tail partitions are transformed in the loader thread.
+        _loaded.store(false);
+        if (_backgroundLoading) {
+            _loader->startThread();
+        }
+        else {
+            doLoading();
+        }
+    }
+    _tailInputFill = 0;
+    _precalculatedPos = 0;
+
+    return true;
+}
+
+// Sets up the stages that run at the head block size: the head itself,
+// which is transformed right away so that there is output as soon as init()
+// returns, and the first tail block, which is transformed by doLoading().
+void Convolver::initHead()
+{
+    const size_t headIrLen = std::min(_irLen, _tailBlockSize);
+    size_t headLens[PARTITIONED_CONVOLVER_MAX_SLOTS];
+    getStageLengths(0, headIrLen, headLens);
+    _headConvolver.init(_headBlockSize, headIrLen, _slotCount, _pathCount, _maxDelay, headLens);
+    for (size_t i = 0; i < _headConvolver.getPartitionCount(); ++i) {
+        for (size_t p = 0; p < _pathCount; ++p) {
+            for (size_t s = 0; s < _slotCount; ++s) {
+                _headConvolver.loadPartition(p, s, getImpulseResponse(p, s), headLens[s], i);
+            }
+        }
+    }
+    _headConvolver.publishPartitions(_headConvolver.getPartitionCount());
+
+    if (_irLen > _tailBlockSize) {
+        const size_t conv1IrLen = std::min(_irLen, getTail0End()) - _tailBlockSize;
+        size_t conv1Lens[PARTITIONED_CONVOLVER_MAX_SLOTS];
+        getStageLengths(_tailBlockSize, conv1IrLen, conv1Lens);
+        _tailConvolver0.init(_headBlockSize, conv1IrLen, _slotCount, _pathCount, _maxDelay, conv1Lens);
+        _tailOutput0.resize(_pathCount * _tailBlockSize);
+        _tailPrecalculated0.resize(_pathCount * _tailBlockSize);
+    }
+}
+
+// End of the first tail stage in the impulse response. It reaches up to the
+// late tail when that is on, see init().
+size_t Convolver::getTail0End() const
+{
+    return (_lateDecimation > 1) ? _lateStart : 2 * _tailBlockSize;
+}
+
+// Length of each slot within the stage that starts at offset and is at most
+// limit samples long.
+void Convolver::getStageLengths(size_t offset, size_t limit, size_t* lengths) const
+{
+    for (size_t s = 0; s < _slotCount; ++s) {
+        lengths[s] = (_slotIrLens[s] > offset) ? std::min(_slotIrLens[s] - offset, limit) : 0;
+    }
+}
+
+const Sample* Convolver::getImpulseResponse(size_t path, size_t slot) const
+{
+    return _ir.data() + path * _pathIrLen + _slotIrOffsets[slot];
+}
+
+void Convolver::clear()
+{
+    waitForBackgroundProcessing();
+
+    _headConvolver.clear();
+    _tailConvolver0.clear();
+    _tailConvolver.clear();
+    _lateConvolver.clear();
+    _lateDecimator.reset();
+    for (size_t p = 0; p < _pathCount; ++p) {
+        _lateInterpolators[p].reset();
+    }
+    _tailOutput0.setZero();
+    _tailPrecalculated0.setZero();
+    _tailPrecalculated.setZero();
+    for (size_t j = 0; j < CONVOLVER_TAIL_JOBS; ++j) {
+        _tailJobs[j].output.setZero();
+    }
+    _tailInput.setZero();
+    _tailInputFill = 0;
+    _precalculatedPos = 0;
+    _tailJobsSubmitted.store(0);
+    _tailJobsDone.store(0);
+    _tailJobsSkipped = 0;
+}
+
+bool Convolver::setHeadBlockSize(size_t headBlockSize)
+{
+    headBlockSize = NextPowerOf2(headBlockSize);
+    if (_irLen == 0 || headBlockSize == _headBlockSize) {
+        return true;
+    }
+    if (headBlockSize == 0 || headBlockSize > _tailBlockSize) {
+        return false;
+    }
+
+    TRACE_ZONE("Convolver::setHeadBlockSize");
+    stopLoading();
+    waitForBackgroundProcessing();
+
+    _headBlockSize = headBlockSize;
+    initHead();
+    updateEnvelope();
+
+    // The background stages keep their partitions and start from silence,
+    // like the new head.
+    clear();
+
+    // Only the first tail block is transformed again, and the partitions of
+    // an interrupted load that are left.
+    if (_tailPrecalculated0.size() > 0 || _tailPrecalculated.size() > 0) {
+        _loaded.store(false);
+        if (_backgroundLoading) {
+            _loader->startThread();
+        }
+        else {
+            doLoading();
+        }
+    }
+    return true;
+}
+
+void Convolver::doLoading()
+{
+    TRACE_ZONE("Convolver::doLoading");
+    PartitionedConvolver* stages[2] = { &_tailConvolver0, &_tailConvolver };
+    const size_t offsets[2] = { _tailBlockSize, 2 * _tailBlockSize };
+    const size_t ends[2] = { getTail0End(), _irLen };
+
+    // Partitions are published one at a time, in time order, so the tail
+    // grows from its start while the convolver is running. Partitions that
+    // are already published, e.g. before setHeadBlockSize(), are kept.
+    for (int n = 0; n < 2; n++) {
+        PartitionedConvolver* stage = stages[n];
+        if (_irLen <= offsets[n]) {
+            break;
+        }
+
+        for (size_t i = stage->getPublishedPartitionCount(); i < stage->getPartitionCount(); ++i) {
+            if (_backgroundLoading && _loader->shouldThreadExit()) {
+                return;
+            }
+            for (size_t p = 0; p < _pathCount; ++p) {
+                for (size_t s = 0; s < _slotCount; ++s) {
+                    const size_t offset = std::min(offsets[n], _slotIrLens[s]);
+                    const size_t end = std::min(ends[n], _slotIrLens[s]);
+                    stage->loadPartition(p, s, getImpulseResponse(p, s) + offset, end - offset, i);
+                }
+            }
+            stage->publishPartitions(i + 1);
+            _loadedPartitions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Late tail at the reduced rate
+    if (_lateDecimation > 1) {
+        if (_lateConvolver.getPublishedPartitionCount() == 0) {
+            decimateLateImpulseResponse();
+        }
+        for (size_t i = _lateConvolver.getPublishedPartitionCount(); i < _lateConvolver.getPartitionCount(); ++i) {
+            if (_backgroundLoading && _loader->shouldThreadExit()) {
+                return;
+            }
+            for (size_t p = 0; p < _pathCount; ++p) {
+                for (size_t s = 0; s < _slotCount; ++s) {
+                    _lateConvolver.loadPartition(p, s, _irLate.data() + (p * _slotCount + s) * _irLateLen, _irLateLen, i);
+                }
+            }
+            _lateConvolver.publishPartitions(i + 1);
+            _loadedPartitions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    _loaded.store(true);
+}
+
+// Lowpass filters the impulse responses from _lateStart on and keeps every
+// factor-th sample, starting at _irLateOffset. The samples are
+// scaled by the factor, which together with the unity gain decimation and
+// interpolation filters gives the gain of the full rate convolution.
+void Convolver::decimateLateImpulseResponse()
+{
+    TRACE_ZONE("Convolver::decimateLateImpulseResponse");
+    std::vector<float> taps;
+    PolyphaseLowpass(_lateDecimation, taps);
+    const size_t delay = (taps.size() - 1) / 2;
+    const size_t lateStart = _lateStart;
+
+    for (size_t k = 0; k < _pathCount * _slotCount; ++k) {
+        const Sample* ir = getImpulseResponse(k / _slotCount, k % _slotCount);
+        const size_t irLen = _slotIrLens[k % _slotCount];
+        Sample* irLate = _irLate.data() + k * _irLateLen;
+        for (size_t m = 0; m < _irLateLen; ++m) {
+            // Tap i of the filter output at sample n - delay uses ir[n - i],
+            // which is zero before lateStart and from irLen on.
+            const size_t n = _irLateOffset + m * _lateDecimation + delay;
+            float sum = 0.0f;
+            if (n >= lateStart) {
+                const size_t first = (n >= irLen) ? n - irLen + 1 : 0;
+                const size_t last = std::min(n - lateStart, taps.size() - 1);
+                for (size_t i = first; i <= last; ++i) {
+                    sum += taps[i] * ir[n - i];
+                }
+            }
+            irLate[m] = _lateDecimation * sum;
+        }
+    }
+}
+
+void Convolver::setSlotGain(size_t slot, float gain)
+{
+    _headConvolver.setSlotGain(slot, gain);
+    _tailConvolver0.setSlotGain(slot, gain);
+    _tailConvolver.setSlotGain(slot, gain);
+    _lateConvolver.setSlotGain(slot, gain);
+}
+
+void Convolver::setEnvelope(size_t length, float decay)
+{
+    if (length == _envelopeLength && decay == _envelopeDecay) {
+        return;
+    }
+    _envelopeLength = length;
+    _envelopeDecay = decay;
+    updateEnvelope();
+}
+
+// Hands the envelope to each stage, relative to where the stage starts in
+// the impulse response. The late tail runs at 1/_lateDecimation of the rate,
+// and its first sample is at _irLateOffset.
+void Convolver::updateEnvelope()
+{
+    const size_t length = _envelopeLength;
+    const double decay = _envelopeDecay;
+    PartitionedConvolver* stages[3] = { &_headConvolver, &_tailConvolver0, &_tailConvolver };
+    const size_t offsets[3] = { 0, _tailBlockSize, 2 * _tailBlockSize };
+
+    for (int n = 0; n < 3; n++) {
+        const size_t stageLength = (length > offsets[n]) ? length - offsets[n] : 0;
+        stages[n]->setEnvelope(stageLength, (float)exp(-decay * offsets[n]), (float)decay);
+    }
+    if (_lateDecimation > 1) {
+        const size_t lateLength = (length > _irLateOffset) ? (length - _irLateOffset + _lateDecimation - 1) / _lateDecimation : 0;
+        _lateConvolver.setEnvelope(lateLength, (float)exp(-decay * _irLateOffset), (float)(decay * _lateDecimation));
+    }
+}
+
+void Convolver::setDelay(size_t delay)
+{
+    if (delay == _delay) {
+        return;
+    }
+    _delay = delay;
+    updateDelay();
+}
+
+void Convolver::setMaxDelay(size_t maxDelay)
+{
+    _maxDelay = maxDelay;
+}
+
+// The late tail can only be delayed by whole samples at its reduced rate, so
+// the other stages are delayed by the same rounded amount.
+void Convolver::updateDelay()
+{
+    const size_t delay = std::min(_delay, _maxDelay) / _lateDecimation * _lateDecimation;
+    _headConvolver.setDelay(delay);
+    _tailConvolver0.setDelay(delay);
+    _tailConvolver.setDelay(delay);
+    _lateConvolver.setDelay(delay / _lateDecimation);
+}
+
+void Convolver::setTailDecimation(size_t factor)
+{
+    _tailDecimation = (factor >= 1 && factor <= POLYPHASE_MAX_FACTOR) ? factor : 1;
+}
+
+void Convolver::setTailWorkerCount(size_t count)
+{
+    _tailConvolver.setWorkerCount(count);
+    _lateConvolver.setWorkerCount(count);
+}
+
+void Convolver::setHugePages(bool enabled)
+{
+    _headConvolver.setHugePages(enabled);
+    _tailConvolver0.setHugePages(enabled);
+    _tailConvolver.setHugePages(enabled);
+    _lateConvolver.setHugePages(enabled);
+}
+
+size_t Convolver::getPathCount() const
+{
+    return _pathCount;
+}
+
+void Convolver::setBackgroundLoading(bool enabled)
+{
+    _backgroundLoading = enabled;
+}
+
+bool Convolver::isLoaded() const
+{
+    return _loaded.load();
+}
+
+size_t Convolver::takeLoadedPartitions()
+{
+    return _loadedPartitions.exchange(0, std::memory_order_relaxed);
+}
+
+void Convolver::setTailWaitBudget(uint64_t budget)
+{
+    _tailWaitBudget = budget;
+}
+
+void Convolver::setSynchronousTail(bool enabled)
+{
+    _synchronousTail = enabled;
+}
+
+uint64_t Convolver::takeWaitTime()
+{
+    const uint64_t waitTime = _waitTime;
+    _waitTime = 0;
+    return waitTime;
+}
+
+uint64_t Convolver::takeTailMisses()
+{
+    const uint64_t misses = _tailMisses;
+    _tailMisses = 0;
+    return misses;
+}
+
+size_t Convolver::getImpulseResponseBytes() const
+{
+    return (_ir.size() + _irLate.size()) * sizeof(Sample);
+}
+
+size_t Convolver::getSpectrumBytes() const
+{
+    return _headConvolver.getSpectrumBytes() + _tailConvolver0.getSpectrumBytes() + _tailConvolver.getSpectrumBytes() +
+        _lateConvolver.getSpectrumBytes();
+}
+
+size_t Convolver::getBufferBytes() const
+{
+    size_t tailBuffers = _tailOutput0.size() + _tailPrecalculated0.size() + _tailPrecalculated.size() +
+        _tailInput.size() + _tailSilence.size();
+    for (size_t j = 0; j < CONVOLVER_TAIL_JOBS; ++j) {
+        tailBuffers += _tailJobs[j].input.size() + _tailJobs[j].output.size();
+    }
+    size_t lateBytes = 0;
+    if (_lateDecimation > 1) {
+        tailBuffers += _lateInput.size() + _lateOutput.size();
+        lateBytes = _lateConvolver.getBufferBytes() + _lateDecimator.getBufferBytes();
+        for (size_t p = 0; p < _pathCount; ++p) {
+            lateBytes += _lateInterpolators[p].getBufferBytes();
+        }
+    }
+    return _headConvolver.getBufferBytes() + _tailConvolver0.getBufferBytes() + _tailConvolver.getBufferBytes() +
+        lateBytes + tailBuffers * sizeof(Sample);
+}
+
+void Convolver::process(const Sample* input, Sample* output, size_t len)
+{
+    Sample* outputs[1] = {output};
+    process(input, outputs, len);
+}
+
+void Convolver::process(const Sample* input, Sample* const* outputs, size_t len)
+{
+    TRACE_ZONE("Convolver::process");
+    // Head
+    _headConvolver.process(input, outputs, len);
+
+    // Tail
+    if (_tailInput.size() > 0) {
+        size_t processed = 0;
+        while (processed < len) {
+            const size_t remaining = len - processed;
+            const size_t processing = std::min(remaining, _headBlockSize - (_tailInputFill % _headBlockSize));
+
+            // Sum head and tail
+            const size_t sumBegin = processed;
+            const size_t sumEnd = processed + processing;
+
+            for (size_t p = 0; p < _pathCount; ++p) {
+                Sample* output = outputs[p];
+
+                // Sum: 1st tail block
+                if (_tailPrecalculated0.size() > 0) {
+                    size_t precalculatedPos = p * _tailBlockSize + _precalculatedPos;
+                    for (size_t i = sumBegin; i < sumEnd; ++i) {
+                        output[i] += _tailPrecalculated0[precalculatedPos];
+                        ++precalculatedPos;
+                    }
+                }
+
+                // Sum: 2nd-Nth tail block
+                if (_tailPrecalculated.size() > 0) {
+                    size_t precalculatedPos = p * _tailBlockSize + _precalculatedPos;
+                    for (size_t i = sumBegin; i < sumEnd; ++i) {
+                        output[i] += _tailPrecalculated[precalculatedPos];
+                        ++precalculatedPos;
+                    }
+                }
+            }
+
+            _precalculatedPos += processing;
+
+            // Fill input buffer for tail convolution
+            memcpy(_tailInput.data() + _tailInputFill, input + processed, processing * sizeof(Sample));
+            _tailInputFill += processing;
+
+            // Convolution: 1st tail block
+            if (_tailPrecalculated0.size() > 0 && _tailInputFill % _headBlockSize == 0) {
+                const size_t blockOffset = _tailInputFill - _headBlockSize;
+                Sample* tailOutputs[PARTITIONED_CONVOLVER_MAX_PATHS];
+                for (size_t p = 0; p < _pathCount; ++p) {
+                    tailOutputs[p] = _tailOutput0.data() + p * _tailBlockSize + blockOffset;
+                }
+                _tailConvolver0.process(_tailInput.data() + blockOffset, tailOutputs, _headBlockSize);
+                if (_tailInputFill == _tailBlockSize) {
+                    _tailPrecalculated0.swap(_tailOutput0);
+                }
+            }
+
+            // Convolution: 2nd-Nth tail block (done in the background thread unless
+            // the tail is synchronous)
+            if (_tailPrecalculated.size() > 0 && _tailInputFill == _tailBlockSize) {
+                // The output of the previous job is played during the next
+                // block. If it is late even after the wait budget, that block
+                // gets a silent tail instead. Before the first job, the slot
+                // of the "previous" job holds silence.
+                const uint64_t submitted = _tailJobsSubmitted.load(std::memory_order_relaxed);
+                TailJob& previous = _tailJobs[(submitted + CONVOLVER_TAIL_JOBS - 1) % CONVOLVER_TAIL_JOBS];
+                if (waitForTailJobs(submitted, _synchronousTail ? UINT64_MAX : _tailWaitBudget)) {
+                    _tailPrecalculated.swap(previous.output);
+                }
+                else {
+                    _tailPrecalculated.setZero();
+                    ++_tailMisses;
+                }
+
+                // Queue this block. When the queue is full the block is
+                // counted and later fed to the tail as silence, which keeps
+                // the older blocks at their position in the tail. A
+                // synchronous tail convolves the block right away instead,
+                // into the slot of the previous job where the next block
+                // picks it up as above. It leaves the job counters alone, so
+                // the background thread never sees these blocks.
+                if (_synchronousTail) {
+                    Sample* outputs[PARTITIONED_CONVOLVER_MAX_PATHS];
+                    for (size_t p = 0; p < _pathCount; ++p) {
+                        outputs[p] = previous.output.data() + p * _tailBlockSize;
+                    }
+                    for (; _tailJobsSkipped > 0; --_tailJobsSkipped) {
+                        processTailBlock(_tailSilence.data(), outputs);
+                    }
+                    processTailBlock(_tailInput.data(), outputs);
+                }
+                else if (submitted - _tailJobsDone.load(std::memory_order_acquire) < CONVOLVER_TAIL_JOBS) {
+                    TailJob& job = _tailJobs[submitted % CONVOLVER_TAIL_JOBS];
+                    job.input.copyFrom(_tailInput);
+                    job.skippedBefore = _tailJobsSkipped;
+                    _tailJobsSkipped = 0;
+                    _tailJobsSubmitted.store(submitted + 1, std::memory_order_release);
+                    startBackgroundProcessing();
+                }
+                else {
+                    ++_tailJobsSkipped;
+                }
+            }
+
+            if (_tailInputFill == _tailBlockSize) {
+                _tailInputFill = 0;
+                _precalculatedPos = 0;
+            }
+
+            processed += processing;
+        }
+    }
+}
+
+void Convolver::doBackgroundProcessing()
+{
+    TRACE_ZONE("Convolver::doBackgroundProcessing");
+    uint64_t done = _tailJobsDone.load(std::memory_order_relaxed);
+    while (done < _tailJobsSubmitted.load(std::memory_order_acquire)) {
+        TailJob& job = _tailJobs[done % CONVOLVER_TAIL_JOBS];
+        Sample* outputs[PARTITIONED_CONVOLVER_MAX_PATHS];
+        for (size_t p = 0; p < _pathCount; ++p) {
+            outputs[p] = job.output.data() + p * _tailBlockSize;
+        }
+        for (size_t i = 0; i < job.skippedBefore; ++i) {
+            processTailBlock(_tailSilence.data(), outputs);
+        }
+        processTailBlock(job.input.data(), outputs);
+        ++done;
+        _tailJobsDone.store(done);
+    }
+
+    // Sequentially consistent with the store above, see
+    // waitForBackgroundProcessing().
+    if (_backgroundWaiting.load()) {
+        _backgroundProcessingIdleEvent.post();
+    }
+}
+
+// Background stage at the full rate, or the late tail at the reduced rate
+// when that is on.
+void Convolver::processTailBlock(const Sample* input, Sample* const* outputs)
+{
+    if (_lateDecimation == 1) {
+        _tailConvolver.process(input, outputs, _tailBlockSize);
+        return;
+    }
+
+    const size_t lateBlockSize = _tailBlockSize / _lateDecimation;
+    Sample* lateOutputs[PARTITIONED_CONVOLVER_MAX_PATHS];
+    for (size_t p = 0; p < _pathCount; ++p) {
+        lateOutputs[p] = _lateOutput.data() + p * lateBlockSize;
+    }
+
+    _lateDecimator.process(input, _lateInput.data(), _tailBlockSize);
+    _lateConvolver.process(_lateInput.data(), lateOutputs, lateBlockSize);
+    for (size_t p = 0; p < _pathCount; ++p) {
+        _lateInterpolators[p].process(lateOutputs[p], outputs[p], lateBlockSize);
+    }
+}
+
 void Convolver::startBackgroundProcessing()
 {
-    _backgroundProcessingStartedEvent.signal();
+    _backgroundProcessingStartedEvent.post();
 }
 
+// Sleeps until the background thread has done all submitted jobs. Either
+// this sees the last job done, or the background thread sees the flag after
+// storing it and posts the idle event. Posts left over from an earlier call
+// only cause another check.
 void Convolver::waitForBackgroundProcessing()
 {
-    _backgroundProcessingFinishedEvent.wait();
+    const uint64_t submitted = _tailJobsSubmitted.load(std::memory_order_relaxed);
+    _backgroundWaiting.store(true);
+    while (_tailJobsDone.load() != submitted) {
+        _backgroundProcessingIdleEvent.wait();
+    }
+    _backgroundWaiting.store(false);
 }
 
+// Waits until the first `jobs` tail jobs are done or the budget has run out.
+// Returns true when they are done.
+bool Convolver::waitForTailJobs(uint64_t jobs, uint64_t budget)
+{
+    if (_tailJobsDone.load(std::memory_order_acquire) == jobs) {
+        return true;
+    }
+    if (budget == 0) {
+        return false;
+    }
+
+    TRACE_ZONE("Convolver::waitForTailJobs");
+    bool done = false;
+    const auto start = std::chrono::steady_clock::now();
+    uint64_t elapsed = 0;
+    while (!done && elapsed < budget) {
+        std::this_thread::yield();
+        done = _tailJobsDone.load(std::memory_order_acquire) == jobs;
+        elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    _waitTime += elapsed;
+    return done;
+}
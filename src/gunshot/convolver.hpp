@@ -3,10 +3,19 @@
 
 #include <stdint.h>
 #include <atomic>
+#include <memory>
 
 #include "extra/Thread.hpp"
-#include "extra/Mutex.hpp"
-#include "fftconvolver/TwoStageFFTConvolver.h"
+#include "fftconvolver/Utilities.h"
+#include "partitioned_convolver.hpp"
+#include "polyphase_filter.hpp"
+#include "wake_semaphore.hpp"
+
+// Number of tail blocks that can be queued for the background thread.
+#define CONVOLVER_TAIL_JOBS 4
+
+// Default time that process() waits for a late tail block.
+#define CONVOLVER_DEFAULT_TAIL_WAIT_BUDGET_ns 100000
 
 // Subclass of Thread to get rid of some annoying descrutor error caused by unique_ptr.
 class MyThread : public Thread
@@ -17,22 +26,245 @@ public:
 
 // Convolver based on KlangFalter's Convolver class, converted from Juce to
 // DPF.
-class Convolver : public fftconvolver::TwoStageFFTConvolver
+//
+// The two-stage structure is the same as fftconvolver::TwoStageFFTConvolver,
+// but the stages are PartitionedConvolvers so that the impulse response can be
+// loaded progressively: init() only transforms the head and returns, while
+// the tail partitions are transformed in time order by a loader thread and
+// published as they become ready.
+//
+// Several impulse responses can be loaded into separate slots that share the
+// input spectra of each stage, and each slot can feed several outputs
+// ("paths"), see PartitionedConvolver.
+//
+// The last stage runs in a background thread. The audio thread hands blocks
+// to it through a queue of tail jobs and never blocks on it: a block whose
+// tail is not ready in time gets a silent tail, see setTailWaitBudget().
+// Offline, the last stage can instead run in the calling thread, see
+// setSynchronousTail().
+// Optionally, that stage runs at a reduced sample rate, see
+// setTailDecimation(), and its partitions are split across worker threads,
+// see setTailWorkerCount().
+class Convolver
 {
 public:
     Convolver();
     virtual ~Convolver();
 
+    bool init(size_t headBlockSize, size_t tailBlockSize, const fftconvolver::Sample* ir, size_t irLen);
+    // The impulse responses are given path-major: irs[path * slotCount + slot].
+    bool init(size_t headBlockSize, size_t tailBlockSize, const fftconvolver::Sample* const* irs, const size_t* irLens,
+              size_t slotCount, size_t pathCount = 1);
+    void process(const fftconvolver::Sample* input, fftconvolver::Sample* output, size_t len);
+    void process(const fftconvolver::Sample* input, fftconvolver::Sample* const* outputs, size_t len);
+    void reset();
+
+    // Silences the input and output history of all stages, as if the input
+    // had been silent for the length of the impulse response, but keeps the
+    // impulse response and any loading in progress. Waits for the background
+    // thread to finish its queued blocks.
+    void clear();
+
+    void setSlotGain(size_t slot, float gain);
+
+    // Cuts the impulse responses after length samples and fades them out by
+    // exp(-decay * n), without a new init(). Each stage skips the partitions
+    // after the cut, so the load of the tail falls with the length, see
+    // PartitionedConvolver::setEnvelope(). The settings are kept across
+    // init(). Called from the audio thread; each stage applies them from its
+    // next block.
+    void setEnvelope(size_t length, float decay);
+
+    // Delays the output of all stages by delay samples, e.g. as a pre-delay
+    // of a reverb, see PartitionedConvolver::setDelay(). The delay is limited
+    // to setMaxDelay() and, while the late tail runs at a reduced rate,
+    // rounded down to a multiple of the decimation factor. Called from the
+    // audio thread; each stage applies it from its next block.
+    void setDelay(size_t delay);
+
+    // The longest delay that setDelay() accepts, in samples. The delay lines
+    // of input spectra of each stage get one more entry per block of it.
+    // Takes effect from the next init().
+    void setMaxDelay(size_t maxDelay);
+
+    size_t getPathCount() const;
+
+    // Changes the head block size without a full init(), e.g. after the
+    // host buffer size changed. Only the head and the first tail block are
+    // transformed again; the later tail keeps its partitions. The convolver
+    // continues from silence. Returns false when a full init() is needed
+    // because the head would exceed the tail block.
+    bool setHeadBlockSize(size_t headBlockSize);
+
+    // Convolves the impulse response from shortly after the second tail
+    // block on at 1/factor of the sample rate (2 or 4; 1 disables it), in
+    // place of the background stage. The late part is lowpass filtered just
+    // below the Nyquist frequency of the reduced rate, which cuts the
+    // spectrum memory and the work of the background stage by about the
+    // factor, at the cost of the rate conversion filters. The first tail
+    // stage is extended by about 100 * factor samples to cover their delay.
+    // Takes effect from the next init().
+    void setTailDecimation(size_t factor);
+
+    // Splits the partitions of the background stage and of the late tail
+    // across up to count worker threads each, so that one long impulse
+    // response is not limited to the time of a single core. The threads are
+    // shared by all convolvers of the process, see
+    // PartitionedConvolver::setWorkerCount(). Short stages use fewer
+    // workers or none. Takes effect from the next init().
+    void setTailWorkerCount(size_t count);
+
+    // Backs the spectra of each stage with huge pages where the system
+    // supports it, see PartitionedConvolver::setHugePages(). Only stages of
+    // at least ARENA_HUGE_PAGE_SIZE use them. Takes effect from the next
+    // init().
+    void setHugePages(bool enabled);
+
+    // When disabled, init() transforms the whole impulse response before
+    // returning. Offline rendering uses this so that the output does not
+    // depend on how fast the loader thread runs.
+    void setBackgroundLoading(bool enabled);
+
+    // True when all partitions of the impulse response have been published.
+    bool isLoaded() const;
+
+    // Number of tail partitions that were transformed since the last call,
+    // counted once for all paths and slots, e.g. to see that
+    // setHeadBlockSize() only transforms the first tail stage again.
+    size_t takeLoadedPartitions();
+
+    // How long process() may wait for a late tail block from the background
+    // thread, in nanoseconds. When the time is up the tail is silent for one
+    // block and a miss is counted. UINT64_MAX waits until the block is ready,
+    // so that offline renders do not depend on thread scheduling.
+    void setTailWaitBudget(uint64_t budget);
+
+    // When enabled, process() convolves the background stage itself, one
+    // whole tail block at a time, instead of handing it to the background
+    // thread. This saves the thread wake-ups and waits when rendering faster
+    // than real time. Only for callers without a deadline, such as offline
+    // renders, since the call that completes a tail block convolves all of
+    // it. The output is the same as from the background thread
+    // when no tail block is missed, and the mode can change between calls:
+    // tail blocks that are still queued are waited for first. Must be called
+    // from the audio thread.
+    void setSynchronousTail(bool enabled);
+
+    // Time spent in process() waiting for the background thread since the
+    // last call, in nanoseconds. Must be called from the audio thread.
+    uint64_t takeWaitTime();
+
+    // Number of tail blocks that were not ready in time since the last call.
+    // Must be called from the audio thread.
+    uint64_t takeTailMisses();
+
+    // Memory used by the copy of the impulse responses, by the spectra of all
+    // stages, and by the remaining work buffers, in bytes.
+    size_t getImpulseResponseBytes() const;
+    size_t getSpectrumBytes() const;
+    size_t getBufferBytes() const;
+
 protected:
     virtual void startBackgroundProcessing();
     virtual void waitForBackgroundProcessing();
+    void doBackgroundProcessing();
+    void doLoading();
 
 private:
     friend class ConvolverBackgroundThread;
+    friend class ConvolverLoaderThread;
+
+    void initHead();
+    size_t getTail0End() const;
+    void getStageLengths(size_t offset, size_t limit, size_t* lengths) const;
+    const fftconvolver::Sample* getImpulseResponse(size_t path, size_t slot) const;
+    void stopLoading();
+    bool waitForTailJobs(uint64_t jobs, uint64_t budget);
+    void processTailBlock(const fftconvolver::Sample* input, fftconvolver::Sample* const* outputs);
+    void decimateLateImpulseResponse();
+    void updateEnvelope();
+    void updateDelay();
+
+    size_t _headBlockSize;
+    size_t _tailBlockSize;
+    PartitionedConvolver _headConvolver;
+    PartitionedConvolver _tailConvolver0;
+
+    // The tail outputs hold one block per path after each other.
+    fftconvolver::SampleBuffer _tailOutput0;
+    fftconvolver::SampleBuffer _tailPrecalculated0;
+    PartitionedConvolver _tailConvolver;
+    fftconvolver::SampleBuffer _tailPrecalculated;
+    fftconvolver::SampleBuffer _tailInput;
+    size_t _tailInputFill;
+    size_t _precalculatedPos;
+
+    // Queue of blocks for the background thread. Job n uses slot
+    // n % CONVOLVER_TAIL_JOBS. Only the audio thread writes _tailJobsSubmitted
+    // and only the background thread writes _tailJobsDone.
+    struct TailJob
+    {
+        fftconvolver::SampleBuffer input;
+        fftconvolver::SampleBuffer output;
+        size_t skippedBefore; // Blocks to process as silence before the input
+    };
+    TailJob _tailJobs[CONVOLVER_TAIL_JOBS];
+    std::atomic<uint64_t> _tailJobsSubmitted;
+    std::atomic<uint64_t> _tailJobsDone;
+    size_t _tailJobsSkipped;
+    fftconvolver::SampleBuffer _tailSilence;
+    uint64_t _tailWaitBudget;
+    bool _synchronousTail;
+    uint64_t _tailMisses;
+
+    // Late tail at the reduced rate, used by the background thread. The
+    // output of the late convolver holds one block per path after each
+    // other. _lateDecimation is 1 when the late tail is off.
+    size_t _tailDecimation;
+    size_t _lateDecimation;
+    PartitionedConvolver _lateConvolver;
+    PolyphaseDecimator _lateDecimator;
+    PolyphaseInterpolator _lateInterpolators[PARTITIONED_CONVOLVER_MAX_PATHS];
+    fftconvolver::SampleBuffer _lateInput;
+    fftconvolver::SampleBuffer _lateOutput;
+
+    // Copy of the impulse responses used by the loader thread. The paths and
+    // slots are stored after each other in the order they are given to
+    // init(). Each slot is as long as its longest path, and the stages only
+    // get partitions for the length of each slot, so a short slot next to a
+    // long one costs no spectra of the long one's length.
+    fftconvolver::SampleBuffer _ir;
+    size_t _irLen; // Of the longest slot
+    size_t _slotIrLens[PARTITIONED_CONVOLVER_MAX_SLOTS];
+    size_t _slotIrOffsets[PARTITIONED_CONVOLVER_MAX_SLOTS]; // Within the slots of a path
+    size_t _pathIrLen; // Sum of the slot lengths
+    size_t _slotCount;
+    size_t _pathCount;
+
+    // Decimated late impulse responses, in the same order as _ir but
+    // zero-padded to the same length. Sample m is the lowpass filtered
+    // impulse response at _irLateOffset + m * factor.
+    fftconvolver::SampleBuffer _irLate;
+    size_t _irLateLen;
+    size_t _irLateOffset;
+    size_t _lateStart; // In the impulse response, where the first tail stage ends
+    std::atomic<bool> _loaded;
+    std::atomic<size_t> _loadedPartitions;
+    bool _backgroundLoading;
+    size_t _envelopeLength;
+    float _envelopeDecay;
+    size_t _delay;
+    size_t _maxDelay;
+    uint64_t _waitTime;
 
+    // The audio thread wakes the background thread with a semaphore, which
+    // never blocks the caller. Callers of waitForBackgroundProcessing() set
+    // _backgroundWaiting and are woken when the queue has run empty.
     std::unique_ptr<MyThread> _thread;
-    Signal _backgroundProcessingFinishedEvent;
-    Signal _backgroundProcessingStartedEvent;
+    std::unique_ptr<MyThread> _loader;
+    WakeSemaphore _backgroundProcessingStartedEvent;
+    WakeSemaphore _backgroundProcessingIdleEvent;
+    std::atomic<bool> _backgroundWaiting;
 };
 
 #endif
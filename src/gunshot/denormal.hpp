@@ -0,0 +1,54 @@
+#ifndef DENORMAL_H
+#define DENORMAL_H
+
+#include <stdint.h>
+
+#if defined(__SSE__) || defined(__x86_64__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+// Enables flush-to-zero and denormals-are-zero on the calling thread for the
+// lifetime of the object and restores the previous floating point mode when
+// it goes out of scope.
+//
+// Decaying reverb tails and filter states end up in the denormal range, where
+// every operation is many times slower on most CPUs. Each thread that
+// processes audio must create one, because the mode is per thread. On
+// platforms without such a mode this does nothing.
+class ScopedNoDenormals
+{
+public:
+    ScopedNoDenormals()
+    {
+#if defined(__SSE__) || defined(__x86_64__) || defined(_M_X64)
+        _previous = _mm_getcsr();
+        _mm_setcsr(_previous | 0x8040); // FTZ (bit 15) and DAZ (bit 6)
+#elif defined(__aarch64__)
+        uint64_t fpcr;
+        __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+        _previous = fpcr;
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1ull << 24))); // FZ
+#endif
+    }
+
+    ~ScopedNoDenormals()
+    {
+#if defined(__SSE__) || defined(__x86_64__) || defined(_M_X64)
+        _mm_setcsr(_previous);
+#elif defined(__aarch64__)
+        __asm__ __volatile__("msr fpcr, %0" : : "r"(_previous));
+#endif
+    }
+
+private:
+#if defined(__SSE__) || defined(__x86_64__) || defined(_M_X64)
+    unsigned int _previous;
+#elif defined(__aarch64__)
+    uint64_t _previous;
+#endif
+
+    ScopedNoDenormals(const ScopedNoDenormals&);
+    ScopedNoDenormals& operator=(const ScopedNoDenormals&);
+};
+
+#endif
@@ -0,0 +1,534 @@
+#include "ir_file.hpp"
+#include "log.h"
+#include "DistrhoDefines.h"
+
+#include <string.h>
+#include <math.h>
+
+#ifdef DISTRHO_OS_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// Byte order helpers //////////////////////////////////////////////////////////
+
+static inline uint16_t rd16le(const uint8_t *p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static inline uint16_t rd16be(const uint8_t *p) { return (uint16_t)(p[1] | (p[0] << 8)); }
+static inline uint32_t rd32le(const uint8_t *p) { return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline uint32_t rd32be(const uint8_t *p) { return (uint32_t)p[3] | ((uint32_t)p[2] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[0] << 24); }
+static inline uint64_t rd64le(const uint8_t *p) { return (uint64_t)rd32le(p) | ((uint64_t)rd32le(p + 4) << 32); }
+static inline uint64_t rd64be(const uint8_t *p) { return (uint64_t)rd32be(p + 4) | ((uint64_t)rd32be(p) << 32); }
+
+// 80 bit IEEE 754 extended precision, used for the AIFF sample rate.
+static double rd_extended(const uint8_t *p)
+{
+    int exponent = rd16be(p) & 0x7fff;
+    uint64_t mantissa = rd64be(p + 2);
+    double value = ldexp((double)mantissa, exponent - 16383 - 63);
+    return (p[0] & 0x80) ? -value : value;
+}
+
+// Sample decoders /////////////////////////////////////////////////////////////
+
+static inline float decode_pcm8u(const uint8_t *p) { return ((int)p[0] - 128) * (1.0f / 128.0f); }
+static inline float decode_pcm8s(const uint8_t *p) { return (int8_t)p[0] * (1.0f / 128.0f); }
+static inline float decode_pcm16le(const uint8_t *p) { return (int16_t)rd16le(p) * (1.0f / 32768.0f); }
+static inline float decode_pcm16be(const uint8_t *p) { return (int16_t)rd16be(p) * (1.0f / 32768.0f); }
+static inline float decode_pcm24le(const uint8_t *p) { return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) * (1.0f / 2147483648.0f); }
+static inline float decode_pcm24be(const uint8_t *p) { return (int32_t)(((uint32_t)p[2] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[0] << 24)) * (1.0f / 2147483648.0f); }
+static inline float decode_pcm32le(const uint8_t *p) { return (int32_t)rd32le(p) * (1.0f / 2147483648.0f); }
+static inline float decode_pcm32be(const uint8_t *p) { return (int32_t)rd32be(p) * (1.0f / 2147483648.0f); }
+
+static inline float decode_f32le(const uint8_t *p)
+{
+    uint32_t u = rd32le(p);
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline float decode_f32be(const uint8_t *p)
+{
+    uint32_t u = rd32be(p);
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline float decode_f64le(const uint8_t *p)
+{
+    uint64_t u = rd64le(p);
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return (float)d;
+}
+
+static inline float decode_f64be(const uint8_t *p)
+{
+    uint64_t u = rd64be(p);
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return (float)d;
+}
+
+// Converts all frames in one pass over the mapped data. Channels beyond the
+// number of channels in the file are copies of the first channel.
+template <float (*decode)(const uint8_t *)>
+static void convert(const ir_file_t *file, float **channels, uint32_t num_channels, double *energy)
+{
+    uint32_t offset[IR_FILE_MAX_CHANNELS];
+    double sum_sq[IR_FILE_MAX_CHANNELS];
+    uint32_t c;
+    uint64_t n;
+
+    for (c = 0; c < num_channels; c++) {
+        offset[c] = (c < file->num_channels ? c : 0) * file->bytes_per_sample;
+        sum_sq[c] = 0.0;
+    }
+
+    const uint8_t *frame = file->data;
+    for (n = 0; n < file->num_samples_per_channel; n++) {
+        for (c = 0; c < num_channels; c++) {
+            float x = decode(frame + offset[c]);
+            channels[c][n] = x;
+            sum_sq[c] += (double)x * x;
+        }
+        frame += file->bytes_per_frame;
+    }
+
+    for (c = 0; c < num_channels; c++) {
+        energy[c] = sum_sq[c];
+    }
+}
+
+// Container parsers ///////////////////////////////////////////////////////////
+
+static const uint8_t W64_GUID_RIFF[16] = {'r', 'i', 'f', 'f', 0x2e, 0x91, 0xcf, 0x11, 0xa5, 0xd6, 0x28, 0xdb, 0x04, 0xc1, 0x00, 0x00};
+static const uint8_t W64_GUID_WAVE[16] = {'w', 'a', 'v', 'e', 0xf3, 0xac, 0xd3, 0x11, 0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a};
+static const uint8_t W64_GUID_FMT[16]  = {'f', 'm', 't', ' ', 0xf3, 0xac, 0xd3, 0x11, 0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a};
+static const uint8_t W64_GUID_DATA[16] = {'d', 'a', 't', 'a', 0xf3, 0xac, 0xd3, 0x11, 0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a};
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+// Parses the body of a WAV/RF64/W64 "fmt " chunk.
+static int parse_wave_fmt(ir_file_t *file, const uint8_t *body, uint64_t size)
+{
+    if (size < 16) {
+        return 1;
+    }
+
+    uint16_t tag = rd16le(body);
+    file->num_channels = rd16le(body + 2);
+    file->sample_rate_Hz = rd32le(body + 4);
+    file->bit_depth = rd16le(body + 14);
+
+    if (tag == WAVE_FORMAT_EXTENSIBLE) {
+        if (size < 40) {
+            return 1;
+        }
+        // The first two bytes of the sub-format GUID is the format tag.
+        tag = rd16le(body + 24);
+    }
+
+    if (tag == WAVE_FORMAT_PCM) {
+        file->encoding = IR_FILE_ENCODING_PCM;
+    }
+    else if (tag == WAVE_FORMAT_IEEE_FLOAT) {
+        file->encoding = IR_FILE_ENCODING_FLOAT;
+    }
+    else {
+        log_write_level(LOG_LEVEL_ERROR, "Unsupported WAV format tag");
+        return 1;
+    }
+
+    file->big_endian = false;
+    return 0;
+}
+
+// The chunk walkers below only read chunk bodies up to the end of the map.
+// A chunk that claims more than what is left is the last one: the data
+// chunk of a truncated file is clipped by ir_file_open(), any other chunk
+// is parsed from what is there.
+
+static int parse_riff(ir_file_t *file, const uint8_t *p, uint64_t size, bool rf64)
+{
+    const uint8_t *data = NULL;
+    uint64_t data_size = 0;
+    uint64_t ds64_data_size = 0;
+    bool have_fmt = false;
+    uint64_t n = 12;
+
+    while (n + 8 <= size) {
+        const uint8_t *id = p + n;
+        uint64_t chunk_size = rd32le(p + n + 4);
+        const uint8_t *body = p + n + 8;
+        uint64_t left = size - n - 8;
+        uint64_t body_size = chunk_size < left ? chunk_size : left;
+
+        if (memcmp(id, "ds64", 4) == 0 && body_size >= 16) {
+            ds64_data_size = rd64le(body + 8);
+        }
+        else if (memcmp(id, "fmt ", 4) == 0) {
+            if (parse_wave_fmt(file, body, body_size)) {
+                return 1;
+            }
+            have_fmt = true;
+        }
+        else if (memcmp(id, "data", 4) == 0) {
+            // In RF64 files, the real size of the data chunk is in "ds64".
+            if (rf64 && chunk_size == 0xffffffff) {
+                chunk_size = ds64_data_size;
+            }
+            data = body;
+            data_size = chunk_size;
+        }
+
+        if (chunk_size >= left) {
+            break;
+        }
+        n += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    if (!have_fmt || data == NULL) {
+        return 1;
+    }
+
+    file->data = data;
+    file->num_samples_per_channel = data_size;
+    return 0;
+}
+
+static int parse_w64(ir_file_t *file, const uint8_t *p, uint64_t size)
+{
+    const uint8_t *data = NULL;
+    uint64_t data_size = 0;
+    bool have_fmt = false;
+    uint64_t n = 40;
+
+    while (n + 24 <= size) {
+        const uint8_t *guid = p + n;
+        uint64_t chunk_size = rd64le(p + n + 16); // Including the 24 byte header
+        const uint8_t *body = p + n + 24;
+        uint64_t left = size - n - 24;
+
+        if (chunk_size < 24) {
+            return 1;
+        }
+        uint64_t body_size = chunk_size - 24 < left ? chunk_size - 24 : left;
+
+        if (memcmp(guid, W64_GUID_FMT, 16) == 0) {
+            if (parse_wave_fmt(file, body, body_size)) {
+                return 1;
+            }
+            have_fmt = true;
+        }
+        else if (memcmp(guid, W64_GUID_DATA, 16) == 0) {
+            data = body;
+            data_size = chunk_size - 24;
+        }
+
+        // Chunks are aligned to 8 bytes. The size is checked against what is
+        // left first, so the alignment cannot wrap around.
+        if (chunk_size - 24 >= left) {
+            break;
+        }
+        n += (chunk_size + 7) & ~(uint64_t)7;
+    }
+
+    if (!have_fmt || data == NULL) {
+        return 1;
+    }
+
+    file->data = data;
+    file->num_samples_per_channel = data_size;
+    return 0;
+}
+
+static int parse_aiff(ir_file_t *file, const uint8_t *p, uint64_t size, bool aifc)
+{
+    const uint8_t *data = NULL;
+    uint64_t data_size = 0;
+    bool have_comm = false;
+    uint64_t n = 12;
+
+    while (n + 8 <= size) {
+        const uint8_t *id = p + n;
+        uint64_t chunk_size = rd32be(p + n + 4);
+        const uint8_t *body = p + n + 8;
+        uint64_t left = size - n - 8;
+        uint64_t body_size = chunk_size < left ? chunk_size : left;
+
+        if (memcmp(id, "COMM", 4) == 0 && body_size >= 18) {
+            file->num_channels = rd16be(body);
+            file->bit_depth = rd16be(body + 6);
+            file->sample_rate_Hz = (uint32_t)(rd_extended(body + 8) + 0.5);
+            file->encoding = IR_FILE_ENCODING_PCM;
+            file->big_endian = true;
+
+            if (aifc && body_size >= 22) {
+                const uint8_t *compression = body + 18;
+                if (memcmp(compression, "sowt", 4) == 0) {
+                    file->big_endian = false;
+                }
+                else if (memcmp(compression, "fl32", 4) == 0 || memcmp(compression, "FL32", 4) == 0) {
+                    file->encoding = IR_FILE_ENCODING_FLOAT;
+                    file->bit_depth = 32;
+                }
+                else if (memcmp(compression, "fl64", 4) == 0 || memcmp(compression, "FL64", 4) == 0) {
+                    file->encoding = IR_FILE_ENCODING_FLOAT;
+                    file->bit_depth = 64;
+                }
+                else if (memcmp(compression, "NONE", 4) != 0) {
+                    log_write_level(LOG_LEVEL_ERROR, "Unsupported AIFF-C compression type");
+                    return 1;
+                }
+            }
+            have_comm = true;
+        }
+        else if (memcmp(id, "SSND", 4) == 0 && body_size >= 8) {
+            uint32_t offset = rd32be(body);
+            if (offset > body_size - 8) {
+                return 1;
+            }
+            data = body + 8 + offset;
+            data_size = chunk_size - 8 - offset;
+        }
+
+        if (chunk_size >= left) {
+            break;
+        }
+        n += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    if (!have_comm || data == NULL) {
+        return 1;
+    }
+
+    file->data = data;
+    file->num_samples_per_channel = data_size;
+    return 0;
+}
+
+// Memory mapping //////////////////////////////////////////////////////////////
+
+static int map_file(ir_file_t *file, const char *filename)
+{
+#ifdef DISTRHO_OS_WINDOWS
+    HANDLE f = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (f == INVALID_HANDLE_VALUE) {
+        return 1;
+    }
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(f, &size) || size.QuadPart == 0) {
+        CloseHandle(f);
+        return 1;
+    }
+
+    HANDLE m = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m == NULL) {
+        CloseHandle(f);
+        return 1;
+    }
+
+    void *map = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+    if (map == NULL) {
+        CloseHandle(m);
+        CloseHandle(f);
+        return 1;
+    }
+
+    file->file_handle = (void *)f;
+    file->map_handle = (void *)m;
+    file->map = (const uint8_t *)map;
+    file->map_size = (uint64_t)size.QuadPart;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 1;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    file->file_handle = NULL;
+    file->map_handle = NULL;
+    file->map = (const uint8_t *)map;
+    file->map_size = (uint64_t)st.st_size;
+#endif
+    return 0;
+}
+
+static void unmap_file(ir_file_t *file)
+{
+    if (file->map == NULL) {
+        return;
+    }
+#ifdef DISTRHO_OS_WINDOWS
+    UnmapViewOfFile((LPCVOID)file->map);
+    CloseHandle((HANDLE)file->map_handle);
+    CloseHandle((HANDLE)file->file_handle);
+#else
+    munmap((void *)file->map, file->map_size);
+#endif
+    file->map = NULL;
+    file->map_size = 0;
+}
+
+// Public interface ////////////////////////////////////////////////////////////
+
+int ir_file_open(ir_file_t *file, const char *filename)
+{
+    int err;
+
+    memset(file, 0, sizeof(ir_file_t));
+
+    err = map_file(file, filename);
+    if (err) {
+        log_write_level(LOG_LEVEL_ERROR, "Error mapping impulse response file");
+        return 1;
+    }
+
+    const uint8_t *p = file->map;
+    uint64_t size = file->map_size;
+
+    if (size >= 12 && memcmp(p, "RIFF", 4) == 0 && memcmp(p + 8, "WAVE", 4) == 0) {
+        err = parse_riff(file, p, size, false);
+    }
+    else if (size >= 12 && memcmp(p, "RF64", 4) == 0 && memcmp(p + 8, "WAVE", 4) == 0) {
+        err = parse_riff(file, p, size, true);
+    }
+    else if (size >= 40 && memcmp(p, W64_GUID_RIFF, 16) == 0 && memcmp(p + 24, W64_GUID_WAVE, 16) == 0) {
+        err = parse_w64(file, p, size);
+    }
+    else if (size >= 12 && memcmp(p, "FORM", 4) == 0 && memcmp(p + 8, "AIFF", 4) == 0) {
+        err = parse_aiff(file, p, size, false);
+    }
+    else if (size >= 12 && memcmp(p, "FORM", 4) == 0 && memcmp(p + 8, "AIFC", 4) == 0) {
+        err = parse_aiff(file, p, size, true);
+    }
+    else {
+        log_write_level(LOG_LEVEL_ERROR, "Unknown impulse response file format");
+        err = 1;
+    }
+
+    if (!err) {
+        if (file->num_channels < 1 || file->num_channels > IR_FILE_MAX_CHANNELS) {
+            err = 1;
+        }
+        else if (file->encoding == IR_FILE_ENCODING_PCM && (file->bit_depth < 8 || file->bit_depth > 32 || file->bit_depth % 8 != 0)) {
+            err = 1;
+        }
+        else if (file->encoding == IR_FILE_ENCODING_FLOAT && file->bit_depth != 32 && file->bit_depth != 64) {
+            err = 1;
+        }
+    }
+
+    if (err) {
+        unmap_file(file);
+        return 1;
+    }
+
+    file->bytes_per_sample = file->bit_depth / 8;
+    file->bytes_per_frame = file->bytes_per_sample * file->num_channels;
+
+    // The parsers store the size of the data in bytes. Convert it to frames
+    // and clip it to the end of the file in case it is truncated.
+    uint64_t available = file->map_size - (uint64_t)(file->data - file->map);
+    uint64_t data_size = file->num_samples_per_channel < available ? file->num_samples_per_channel : available;
+    file->num_samples_per_channel = data_size / file->bytes_per_frame;
+
+    return 0;
+}
+
+int ir_file_read(ir_file_t *file, float **channels, uint32_t num_channels, double *energy)
+{
+    if (file->map == NULL || num_channels < 1 || num_channels > IR_FILE_MAX_CHANNELS) {
+        return 1;
+    }
+
+    // 8 bit WAV is unsigned while 8 bit AIFF is signed.
+    if (file->encoding == IR_FILE_ENCODING_PCM) {
+        switch (file->bit_depth) {
+        case 8:
+            if (file->big_endian) {
+                convert<decode_pcm8s>(file, channels, num_channels, energy);
+            }
+            else {
+                convert<decode_pcm8u>(file, channels, num_channels, energy);
+            }
+            break;
+        case 16:
+            if (file->big_endian) {
+                convert<decode_pcm16be>(file, channels, num_channels, energy);
+            }
+            else {
+                convert<decode_pcm16le>(file, channels, num_channels, energy);
+            }
+            break;
+        case 24:
+            if (file->big_endian) {
+                convert<decode_pcm24be>(file, channels, num_channels, energy);
+            }
+            else {
+                convert<decode_pcm24le>(file, channels, num_channels, energy);
+            }
+            break;
+        case 32:
+            if (file->big_endian) {
+                convert<decode_pcm32be>(file, channels, num_channels, energy);
+            }
+            else {
+                convert<decode_pcm32le>(file, channels, num_channels, energy);
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+    else {
+        switch (file->bit_depth) {
+        case 32:
+            if (file->big_endian) {
+                convert<decode_f32be>(file, channels, num_channels, energy);
+            }
+            else {
+                convert<decode_f32le>(file, channels, num_channels, energy);
+            }
+            break;
+        case 64:
+            if (file->big_endian) {
+                convert<decode_f64be>(file, channels, num_channels, energy);
+            }
+            else {
+                convert<decode_f64le>(file, channels, num_channels, energy);
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void ir_file_close(ir_file_t *file)
+{
+    unmap_file(file);
+}
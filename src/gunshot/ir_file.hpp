@@ -0,0 +1,44 @@
+#ifndef IR_FILE_H
+#define IR_FILE_H
+
+#include <stdint.h>
+
+// Impulse response file reader //////////////////////////////////////////////
+
+// Memory maps an uncompressed audio file and converts it to float in a single
+// pass directly into the caller's buffers. The normalisation energy of each
+// channel is accumulated in the same pass.
+//
+// Supported containers: WAV, RF64, Wave64 (W64), AIFF and AIFF-C.
+// Supported encodings: 8/16/24/32 bit PCM and 32/64 bit float.
+
+#define IR_FILE_MAX_CHANNELS 64
+
+typedef enum {
+    IR_FILE_ENCODING_PCM,
+    IR_FILE_ENCODING_FLOAT,
+} ir_file_encoding_t;
+
+typedef struct {
+    uint32_t sample_rate_Hz;
+    uint32_t num_channels;
+    uint64_t num_samples_per_channel;
+    uint32_t bit_depth;
+
+    // Internal
+    ir_file_encoding_t encoding;
+    bool big_endian;
+    uint32_t bytes_per_sample;
+    uint32_t bytes_per_frame;
+    const uint8_t *data;
+    const uint8_t *map;
+    uint64_t map_size;
+    void *file_handle;
+    void *map_handle;
+} ir_file_t;
+
+int ir_file_open(ir_file_t *file, const char *filename);
+int ir_file_read(ir_file_t *file, float **channels, uint32_t num_channels, double *energy);
+void ir_file_close(ir_file_t *file);
+
+#endif
@@ -0,0 +1,240 @@
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+// Only the C++ standard library is used for threads, atomics and time, so
+// the logger builds the same with MSVC, MinGW and on POSIX systems.
+
+#define LOG_RING_SIZE 512 // Must be a power of two
+#define LOG_MESSAGE_LENGTH 200
+#define LOG_FLUSH_INTERVAL_us 50000
+
+typedef struct {
+    std::atomic<uint64_t> sequence;
+    uint8_t level;
+    uint8_t num_values;
+    double time_s;
+    double values[2];
+    char message[LOG_MESSAGE_LENGTH];
+} log_record_t;
+
+static log_record_t ring[LOG_RING_SIZE];
+static std::atomic<uint64_t> write_pos;
+static uint64_t read_pos;
+static std::atomic<uint64_t> num_dropped;
+static std::atomic<int> level(LOG_LEVEL_OFF);
+
+// The flush thread is allocated, so that a log that is never closed does
+// not terminate the process when the static objects are destroyed.
+static std::mutex init_mutex;
+static std::thread *flush_thread = NULL;
+static std::atomic<bool> flush_thread_should_exit;
+static uint32_t num_users = 0;
+static FILE *log_file = NULL;
+
+static const char *level_names[] = {"", "ERROR", "WARNING", "INFO", "DEBUG"};
+
+static double _now_s(void)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Writes all pending records to the log file. Only called from the flush
+// thread, or from log_close() after the flush thread has stopped.
+static void _flush(void)
+{
+    uint64_t dropped = num_dropped.exchange(0);
+    if (dropped > 0) {
+        fprintf(log_file, "%s: %llu log messages dropped\n", level_names[LOG_LEVEL_WARNING], (unsigned long long)dropped);
+    }
+
+    for (;;) {
+        log_record_t *r = &ring[read_pos & (LOG_RING_SIZE - 1)];
+        if (r->sequence.load(std::memory_order_acquire) != read_pos + 1) {
+            break;
+        }
+
+        fprintf(log_file, "[%12.6f] %s: %s", r->time_s, level_names[r->level], r->message);
+        for (uint32_t n = 0; n < r->num_values; n++) {
+            fprintf(log_file, " %g", r->values[n]);
+        }
+        fprintf(log_file, "\n");
+
+        // Hand the slot back to the producers
+        r->sequence.store(read_pos + LOG_RING_SIZE, std::memory_order_release);
+        read_pos++;
+    }
+
+    fflush(log_file);
+}
+
+static void _flush_thread_main(void)
+{
+    while (!flush_thread_should_exit.load()) {
+        _flush();
+        std::this_thread::sleep_for(std::chrono::microseconds(LOG_FLUSH_INTERVAL_us));
+    }
+}
+
+static bool _equal_ignoring_case(const char *a, const char *b)
+{
+    for (; *a != '\0' && *b != '\0'; a++, b++) {
+        if (tolower((unsigned char)*a) != tolower((unsigned char)*b)) {
+            return false;
+        }
+    }
+    return *a == *b;
+}
+
+static log_level_t _level_from_string(const char *s)
+{
+    for (int n = LOG_LEVEL_ERROR; n <= LOG_LEVEL_DEBUG; n++) {
+        if (_equal_ignoring_case(s, level_names[n])) {
+            return (log_level_t)n;
+        }
+    }
+    return LOG_LEVEL_INFO;
+}
+
+int log_init(void)
+{
+    std::lock_guard<std::mutex> lock(init_mutex);
+    if (num_users++ > 0) {
+        return 0;
+    }
+
+    const char *filename = getenv("GUNSHOT_LOG_FILE");
+#ifdef GUNSHOT_LOG_FILE
+    if (filename == NULL) {
+        filename = GUNSHOT_LOG_FILE;
+    }
+#endif
+    if (filename == NULL) {
+        return 0;
+    }
+
+    log_file = fopen(filename, "w");
+    if (log_file == NULL) {
+        return 1;
+    }
+
+    for (uint32_t n = 0; n < LOG_RING_SIZE; n++) {
+        ring[n].sequence.store(n);
+    }
+    write_pos.store(0);
+    read_pos = 0;
+    num_dropped.store(0);
+
+    flush_thread_should_exit.store(false);
+    try {
+        flush_thread = new std::thread(_flush_thread_main);
+    }
+    catch (...) {
+        fclose(log_file);
+        log_file = NULL;
+        return 1;
+    }
+
+    const char *level_name = getenv("GUNSHOT_LOG_LEVEL");
+    level.store(level_name != NULL ? _level_from_string(level_name) : LOG_LEVEL_INFO);
+    return 0;
+}
+
+void log_close(void)
+{
+    std::lock_guard<std::mutex> lock(init_mutex);
+    if (num_users == 0 || --num_users > 0) {
+        return;
+    }
+
+    level.store(LOG_LEVEL_OFF);
+    if (log_file != NULL) {
+        flush_thread_should_exit.store(true);
+        flush_thread->join();
+        delete flush_thread;
+        flush_thread = NULL;
+        _flush();
+        fclose(log_file);
+        log_file = NULL;
+    }
+}
+
+void log_set_level(log_level_t new_level)
+{
+    // Logging stays off when there is no log file.
+    std::lock_guard<std::mutex> lock(init_mutex);
+    if (log_file != NULL) {
+        level.store(new_level);
+    }
+}
+
+log_level_t log_get_level(void)
+{
+    return (log_level_t)level.load(std::memory_order_relaxed);
+}
+
+static int _write(log_level_t record_level, const char *s, uint32_t num_values, double value1, double value2)
+{
+    if (record_level == LOG_LEVEL_OFF || record_level > log_get_level()) {
+        return 0;
+    }
+
+    // Claim a slot. The slot is free when its sequence number equals the
+    // write position; otherwise the ring buffer is full.
+    log_record_t *r;
+    uint64_t pos = write_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        r = &ring[pos & (LOG_RING_SIZE - 1)];
+        uint64_t sequence = r->sequence.load(std::memory_order_acquire);
+        if (sequence == pos) {
+            if (write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (sequence < pos) {
+            num_dropped.fetch_add(1, std::memory_order_relaxed);
+            return 1;
+        }
+        else {
+            pos = write_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    r->level = record_level;
+    r->num_values = num_values;
+    r->time_s = _now_s();
+    r->values[0] = value1;
+    r->values[1] = value2;
+    strncpy(r->message, s, LOG_MESSAGE_LENGTH - 1);
+    r->message[LOG_MESSAGE_LENGTH - 1] = '\0';
+
+    // Publish the record to the flush thread
+    r->sequence.store(pos + 1, std::memory_order_release);
+    return 0;
+}
+
+int log_write(const char *s)
+{
+    return _write(LOG_LEVEL_INFO, s, 0, 0.0, 0.0);
+}
+
+int log_write_level(log_level_t record_level, const char *s)
+{
+    return _write(record_level, s, 0, 0.0, 0.0);
+}
+
+int log_write_value(log_level_t record_level, const char *s, double value)
+{
+    return _write(record_level, s, 1, value, 0.0);
+}
+
+int log_write_values(log_level_t record_level, const char *s, double value1, double value2)
+{
+    return _write(record_level, s, 2, value1, value2);
+}
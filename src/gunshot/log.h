@@ -7,12 +7,45 @@ extern "C" {
 
 #include <stdint.h>
 
+// Realtime-safe logger.
+//
+// log_write*() copy the message into a lock-free ring buffer and return. No
+// formatting, allocation, locking or file access takes place in the caller,
+// so the functions may be called from the audio thread. Numbers are stored
+// in the record and formatted by the flush thread. A background thread
+// writes the records to the log file. When the ring buffer is full, records
+// are dropped and the number of dropped records is written to the log.
+//
+// The log file is GUNSHOT_LOG_FILE from the environment, or the
+// GUNSHOT_LOG_FILE define below when the variable is not set. Without a log
+// file, logging is off and log_write*() return after one atomic load. The
+// level is read from the GUNSHOT_LOG_LEVEL environment variable ("error",
+// "warning", "info" or "debug") and can be changed with log_set_level().
+
 /* #define GUNSHOT_LOG_FILE "gunshot.log" */
 /* #define GUNSHOT_LOG_FILE "/home/soren/Desktop/gunshot.log" */
 /* #define GUNSHOT_LOG_FILE "C:/Users/Christine/Desktop/gunshot.log" */
 
+typedef enum {
+    LOG_LEVEL_OFF,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+} log_level_t;
+
+// Each plugin and UI instance calls log_init() once and log_close() when it
+// is destroyed. The flush thread runs while at least one instance is open.
 int log_init(void);
-int log_write(const char *s);
+void log_close(void);
+
+void log_set_level(log_level_t level);
+log_level_t log_get_level(void);
+
+int log_write(const char *s); // Level: info
+int log_write_level(log_level_t level, const char *s);
+int log_write_value(log_level_t level, const char *s, double value);
+int log_write_values(log_level_t level, const char *s, double value1, double value2);
 
 #ifdef __cplusplus
 }
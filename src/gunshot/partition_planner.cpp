@@ -0,0 +1,419 @@
+#include "partition_planner.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#ifdef _WIN32
+#include <direct.h>
+#endif
+
+#include "log.h"
+#include "trace.hpp"
+#include "denormal.hpp"
+
+using namespace fftconvolver;
+
+#define PLANNER_DEFAULT_TAIL_BLOCK_SIZE 8192
+#define PLANNER_MIN_HEAD_BLOCK_SIZE 64
+#define PLANNER_MAX_TAIL_BLOCK_SIZE 32768
+
+// Each candidate is timed over this many frames after a warm-up of two tail
+// blocks, and the fastest of a few rounds counts, which filters out
+// interruptions by other threads.
+#define PLANNER_TIMING_FRAMES 131072
+#define PLANNER_TIMING_ROUNDS 3
+
+#define PLANNER_CPU_NAME_LENGTH 128
+
+namespace
+{
+
+struct CacheEntry
+{
+    size_t bufferSize;
+    size_t irLen;
+    PartitionPlan plan;
+    double nsPerSample;
+    std::string cpu;
+};
+
+// The cache is shared by all instances in the process. It is read from the
+// file on first use and written back whenever a plan has been tuned.
+std::mutex cacheMutex;
+std::vector<CacheEntry> cacheEntries;
+bool cacheLoaded = false;
+
+// (buffer size, impulse response length) being tuned by some instance
+std::vector<std::pair<size_t, size_t>> tuningKeys;
+
+void readCache(const std::string& path, std::vector<CacheEntry>& entries)
+{
+    FILE* f = fopen(path.c_str(), "r");
+    if (f == NULL) {
+        return;
+    }
+
+    char line[512];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (line[0] == '#') {
+            continue;
+        }
+        unsigned long bufferSize, irLen, head, tail;
+        double nsPerSample;
+        char cpu[PLANNER_CPU_NAME_LENGTH];
+        if (sscanf(line, "%lu %lu %lu %lu %lf %127[^\r\n]", &bufferSize, &irLen, &head, &tail, &nsPerSample, cpu) != 6) {
+            continue;
+        }
+        if (head == 0 || tail < head) {
+            continue;
+        }
+        CacheEntry entry;
+        entry.bufferSize = bufferSize;
+        entry.irLen = irLen;
+        entry.plan.headBlockSize = head;
+        entry.plan.tailBlockSize = tail;
+        entry.nsPerSample = nsPerSample;
+        entry.cpu = cpu;
+        entries.push_back(entry);
+    }
+    fclose(f);
+}
+
+void makeParentDirectories(const std::string& path)
+{
+    for (size_t n = 1; n < path.size(); ++n) {
+        if (path[n] != '/' && path[n] != '\\') {
+            continue;
+        }
+        const std::string directory = path.substr(0, n);
+#ifdef _WIN32
+        _mkdir(directory.c_str());
+#else
+        mkdir(directory.c_str(), 0755);
+#endif
+    }
+}
+
+// Writes to a temporary file that then replaces the cache, so that other
+// processes never read a half written file.
+int writeCache(const std::string& path, const std::vector<CacheEntry>& entries)
+{
+    makeParentDirectories(path);
+    const std::string temporary = path + ".tmp";
+    FILE* f = fopen(temporary.c_str(), "w");
+    if (f == NULL) {
+        return 1;
+    }
+
+    fprintf(f, "# gunshot partition plans: buffer size, IR length, head, tail, ns/sample, CPU\n");
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const CacheEntry& e = entries[i];
+        fprintf(f, "%lu %lu %lu %lu %.3f %s\n", (unsigned long)e.bufferSize, (unsigned long)e.irLen,
+                (unsigned long)e.plan.headBlockSize, (unsigned long)e.plan.tailBlockSize, e.nsPerSample, e.cpu.c_str());
+    }
+    if (fclose(f) != 0) {
+        remove(temporary.c_str());
+        return 1;
+    }
+#ifdef _WIN32
+    remove(path.c_str());
+#endif
+    return rename(temporary.c_str(), path.c_str()) != 0;
+}
+
+// Adds or replaces the entry with the same key.
+void storeEntry(std::vector<CacheEntry>& entries, const CacheEntry& entry)
+{
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].bufferSize == entry.bufferSize && entries[i].irLen == entry.irLen && entries[i].cpu == entry.cpu) {
+            entries[i] = entry;
+            return;
+        }
+    }
+    entries.push_back(entry);
+}
+
+// Deterministic white noise in [-1, 1).
+float noise(uint32_t* seed)
+{
+    *seed = *seed * 1664525u + 1013904223u;
+    return (float)(*seed >> 8) / (1 << 23) - 1.0f;
+}
+
+} // namespace
+
+class PartitionPlannerThread : public MyThread
+{
+public:
+    explicit PartitionPlannerThread(PartitionPlanner& planner) :
+        MyThread("PartitionPlannerThread"),
+        _planner(planner)
+    {
+    }
+
+    virtual void run()
+    {
+        TRACE_THREAD_NAME("partition planner");
+        ScopedNoDenormals noDenormals;
+        _planner.tune();
+    }
+
+private:
+    PartitionPlanner& _planner;
+
+    PartitionPlannerThread(const PartitionPlannerThread&);
+    PartitionPlannerThread& operator=(const PartitionPlannerThread&);
+};
+
+PartitionPlanner::PartitionPlanner() :
+    _autoTuning(true),
+    _tuneBufferSize(0),
+    _tuneIrLen(0),
+    _thread()
+{
+}
+
+PartitionPlanner::~PartitionPlanner()
+{
+    if (_thread) {
+        _thread->signalThreadShouldExit();
+        _thread->stopThread(-1);
+    }
+}
+
+void PartitionPlanner::setAutoTuning(bool enabled)
+{
+    _autoTuning = enabled;
+}
+
+PartitionPlan PartitionPlanner::getDefaultPlan(size_t bufferSize)
+{
+    PartitionPlan plan;
+    plan.headBlockSize = NextPowerOf2(std::max(bufferSize, (size_t)1));
+    plan.tailBlockSize = std::max(plan.headBlockSize, (size_t)PLANNER_DEFAULT_TAIL_BLOCK_SIZE);
+    return plan;
+}
+
+PartitionPlan PartitionPlanner::getPlan(size_t bufferSize, size_t irLen)
+{
+    const PartitionPlan defaultPlan = getDefaultPlan(bufferSize);
+    if (!_autoTuning || bufferSize == 0 || irLen == 0) {
+        return defaultPlan;
+    }
+
+    // Impulse responses of similar length share a plan.
+    irLen = NextPowerOf2(irLen);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (!cacheLoaded) {
+        readCache(getCachePath(), cacheEntries);
+        cacheLoaded = true;
+    }
+    const std::string cpu = getCpuName();
+    for (size_t i = 0; i < cacheEntries.size(); ++i) {
+        const CacheEntry& e = cacheEntries[i];
+        if (e.bufferSize == bufferSize && e.irLen == irLen && e.cpu == cpu) {
+            return e.plan;
+        }
+    }
+
+    // One combination is tuned at a time per instance, and each combination
+    // by one instance only.
+    const std::pair<size_t, size_t> key(bufferSize, irLen);
+    const bool busy = _thread && _thread->isThreadRunning();
+    if (!busy && std::find(tuningKeys.begin(), tuningKeys.end(), key) == tuningKeys.end()) {
+        tuningKeys.push_back(key);
+        _tuneBufferSize = bufferSize;
+        _tuneIrLen = irLen;
+        _thread.reset(new PartitionPlannerThread(*this));
+        _thread->startThread();
+    }
+    return defaultPlan;
+}
+
+void PartitionPlanner::tune()
+{
+    TRACE_ZONE("PartitionPlanner::tune");
+    const size_t bufferSize = _tuneBufferSize;
+    const size_t irLen = _tuneIrLen;
+
+    // Exponentially decaying noise (-60 dB at the end)
+    std::vector<Sample> ir(irLen);
+    uint32_t seed = 1;
+    for (size_t n = 0; n < irLen; ++n) {
+        ir[n] = expf(-6.9f * n / irLen) * noise(&seed);
+    }
+
+    // The default plan is always a candidate, so the tuned plan is never
+    // slower than it.
+    const PartitionPlan defaultPlan = getDefaultPlan(bufferSize);
+    std::vector<PartitionPlan> candidates(1, defaultPlan);
+    for (size_t head = defaultPlan.headBlockSize / 2; head <= 2 * defaultPlan.headBlockSize; head *= 2) {
+        if (head < PLANNER_MIN_HEAD_BLOCK_SIZE) {
+            continue;
+        }
+        for (size_t tail = 4096; tail <= PLANNER_MAX_TAIL_BLOCK_SIZE; tail *= 2) {
+            if (tail < head || (head == defaultPlan.headBlockSize && tail == defaultPlan.tailBlockSize)) {
+                continue;
+            }
+            PartitionPlan plan;
+            plan.headBlockSize = head;
+            plan.tailBlockSize = tail;
+            candidates.push_back(plan);
+        }
+    }
+
+    size_t best = 0;
+    double bestNsPerSample = HUGE_VAL;
+    for (size_t c = 0; c < candidates.size(); ++c) {
+        const double nsPerSample = timePlan(candidates[c], ir.data(), irLen);
+        if (_thread->shouldThreadExit()) {
+            break;
+        }
+        if (nsPerSample < bestNsPerSample) {
+            bestNsPerSample = nsPerSample;
+            best = c;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    tuningKeys.erase(std::remove(tuningKeys.begin(), tuningKeys.end(), std::make_pair(bufferSize, irLen)),
+                     tuningKeys.end());
+    if (_thread->shouldThreadExit()) {
+        return;
+    }
+
+    CacheEntry entry;
+    entry.bufferSize = bufferSize;
+    entry.irLen = irLen;
+    entry.plan = candidates[best];
+    entry.nsPerSample = bestNsPerSample;
+    entry.cpu = getCpuName();
+    storeEntry(cacheEntries, entry);
+    log_write_values(LOG_LEVEL_INFO, "Tuned partition plan, head and tail block size:", entry.plan.headBlockSize,
+                     entry.plan.tailBlockSize);
+
+    // Plans tuned by other processes since the cache was read are kept.
+    const std::string path = getCachePath();
+    if (!path.empty()) {
+        std::vector<CacheEntry> entries;
+        readCache(path, entries);
+        storeEntry(entries, entry);
+        if (writeCache(path, entries)) {
+            log_write_level(LOG_LEVEL_WARNING, "Could not write the partition plan cache");
+        }
+    }
+}
+
+// Time per sample spent in Convolver::process() as seen by the audio thread,
+// including waits for the background thread. Returns HUGE_VAL when the plan
+// can not be used or the thread is asked to exit.
+double PartitionPlanner::timePlan(const PartitionPlan& plan, const Sample* ir, size_t irLen)
+{
+    Convolver convolver;
+    convolver.setBackgroundLoading(false);
+    convolver.setTailWaitBudget(UINT64_MAX);
+    if (!convolver.init(plan.headBlockSize, plan.tailBlockSize, ir, irLen)) {
+        return HUGE_VAL;
+    }
+
+    const size_t bufferSize = _tuneBufferSize;
+    std::vector<Sample> input(bufferSize);
+    std::vector<Sample> output(bufferSize);
+    uint32_t seed = 2;
+    for (size_t n = 0; n < bufferSize; ++n) {
+        input[n] = noise(&seed);
+    }
+
+    for (size_t frames = 0; frames < 2 * plan.tailBlockSize; frames += bufferSize) {
+        convolver.process(input.data(), output.data(), bufferSize);
+    }
+
+    double best = HUGE_VAL;
+    for (size_t round = 0; round < PLANNER_TIMING_ROUNDS; ++round) {
+        if (_thread->shouldThreadExit()) {
+            return HUGE_VAL;
+        }
+        size_t frames = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (; frames < PLANNER_TIMING_FRAMES; frames += bufferSize) {
+            convolver.process(input.data(), output.data(), bufferSize);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        const double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        best = std::min(best, ns / frames);
+    }
+    return best;
+}
+
+std::string PartitionPlanner::getCachePath()
+{
+    const char* path = getenv("GUNSHOT_PLAN_CACHE");
+    if (path != NULL) {
+        return path;
+    }
+
+#if defined(_WIN32)
+    const char* base = getenv("LOCALAPPDATA");
+    return base != NULL ? std::string(base) + "\\gunshot\\plans.txt" : std::string();
+#elif defined(__APPLE__)
+    const char* home = getenv("HOME");
+    return home != NULL ? std::string(home) + "/Library/Caches/gunshot/plans.txt" : std::string();
+#else
+    const char* base = getenv("XDG_CACHE_HOME");
+    if (base != NULL && base[0] != '\0') {
+        return std::string(base) + "/gunshot/plans.txt";
+    }
+    const char* home = getenv("HOME");
+    return home != NULL ? std::string(home) + "/.cache/gunshot/plans.txt" : std::string();
+#endif
+}
+
+// The processor brand string where available, so that a cache file shared
+// between machines (e.g. in a synced home directory) keeps a plan per CPU.
+std::string PartitionPlanner::getCpuName()
+{
+    char name[PLANNER_CPU_NAME_LENGTH] = "";
+
+#if defined(__x86_64__) || defined(__i386__)
+    if (__get_cpuid_max(0x80000000, NULL) >= 0x80000004) {
+        unsigned int regs[12];
+        for (unsigned int i = 0; i < 3; ++i) {
+            __get_cpuid(0x80000002 + i, &regs[4 * i], &regs[4 * i + 1], &regs[4 * i + 2], &regs[4 * i + 3]);
+        }
+        memcpy(name, regs, sizeof(regs));
+        name[sizeof(regs)] = '\0';
+    }
+#elif defined(__linux__)
+    FILE* f = fopen("/proc/cpuinfo", "r");
+    if (f != NULL) {
+        char line[256];
+        while (fgets(line, sizeof(line), f) != NULL) {
+            const char* colon = strchr(line, ':');
+            if (colon != NULL && (strncmp(line, "model name", 10) == 0 || strncmp(line, "CPU part", 8) == 0)) {
+                snprintf(name, sizeof(name), "%s", colon + 1);
+                break;
+            }
+        }
+        fclose(f);
+    }
+#endif
+
+    // Trim, as the brand string is padded with spaces.
+    std::string cpu(name);
+    const size_t first = cpu.find_first_not_of(" \t\r\n");
+    const size_t last = cpu.find_last_not_of(" \t\r\n");
+    cpu = (first == std::string::npos) ? std::string("unknown") : cpu.substr(first, last - first + 1);
+    return cpu;
+}
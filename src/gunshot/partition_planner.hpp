@@ -0,0 +1,71 @@
+#ifndef PARTITION_PLANNER_H
+#define PARTITION_PLANNER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+
+#include "convolver.hpp"
+
+// Block sizes of the head and of the tail stages of a Convolver.
+struct PartitionPlan
+{
+    size_t headBlockSize;
+    size_t tailBlockSize;
+};
+
+// Chooses the partition sizes of the Convolver for a host buffer size and an
+// impulse response length.
+//
+// The fastest split between head and tail depends on the CPU, so the first
+// time a (buffer size, impulse response length, CPU) combination is seen, the
+// default plan is returned and a background thread times a few candidate
+// plans on a synthetic impulse response of that length. The fastest one is
+// stored in a per-user cache file ("wisdom"), which later calls and later
+// instances, also in other processes, use right away.
+//
+// The cache file is GUNSHOT_PLAN_CACHE from the environment or, when the
+// variable is not set, plans.txt in the per-user cache directory
+// ($XDG_CACHE_HOME/gunshot, ~/.cache/gunshot, ~/Library/Caches/gunshot or
+// %LOCALAPPDATA%\gunshot). Each line holds one plan:
+//
+//     <buffer size> <impulse response length> <head> <tail> <ns/sample> <CPU name>
+class PartitionPlanner
+{
+public:
+    PartitionPlanner();
+    virtual ~PartitionPlanner();
+
+    // Returns the tuned plan when there is one, and the default plan
+    // otherwise. Never blocks on the tuning.
+    PartitionPlan getPlan(size_t bufferSize, size_t irLen);
+
+    // When disabled, getPlan() always returns the default plan and nothing is
+    // tuned or read from the cache. Offline rendering uses this so that the
+    // output does not depend on the machine.
+    void setAutoTuning(bool enabled);
+
+    // The fixed plan: the head is the buffer size rounded up to a power of
+    // two, and the tail is 8192 or the head if that is longer.
+    static PartitionPlan getDefaultPlan(size_t bufferSize);
+
+    static std::string getCachePath();
+    static std::string getCpuName();
+
+private:
+    friend class PartitionPlannerThread;
+
+    void tune();
+    double timePlan(const PartitionPlan& plan, const fftconvolver::Sample* ir, size_t irLen);
+
+    bool _autoTuning;
+    size_t _tuneBufferSize;
+    size_t _tuneIrLen;
+    std::unique_ptr<MyThread> _thread;
+
+    PartitionPlanner(const PartitionPlanner&);
+    PartitionPlanner& operator=(const PartitionPlanner&);
+};
+
+#endif
@@ -0,0 +1,855 @@
+#include "partitioned_convolver.hpp"
+#include "trace.hpp"
+#include "denormal.hpp"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+#include "extra/Thread.hpp"
+#include "wake_semaphore.hpp"
+
+using namespace fftconvolver;
+
+// Worker threads shared by all convolvers of the process, see
+// PartitionedConvolver::setWorkerCount(). Each worker has a mailbox that
+// holds at most one group. A convolver hands a group to the first empty
+// mailbox with a compare-and-swap and wakes the worker with a semaphore
+// post; the worker takes the group out with an exchange. The convolver
+// takes back a group that is still in its mailbox the same way, so once a
+// block is done no mailbox refers to its groups. The pool is created by the
+// first convolver with groups and goes away with the last one.
+class PartitionedConvolverPool
+{
+public:
+    static PartitionedConvolverPool* acquire(size_t workerCount);
+    static void release();
+
+    bool hand(PartitionedConvolver::Group* group, size_t first);
+    bool takeBack(PartitionedConvolver::Group* group);
+    PartitionedConvolver::Group* take(size_t worker);
+
+private:
+    PartitionedConvolverPool();
+    ~PartitionedConvolverPool();
+
+    static std::mutex _instanceMutex;
+    static PartitionedConvolverPool* _instance;
+    static size_t _users;
+
+    struct Mailbox
+    {
+        std::atomic<PartitionedConvolver::Group*> group;
+        WakeSemaphore wake;
+    };
+    Mailbox _mailboxes[PARTITIONED_CONVOLVER_MAX_WORKERS];
+    PartitionedConvolverWorker* _workers[PARTITIONED_CONVOLVER_MAX_WORKERS];
+    std::atomic<size_t> _workerCount; // Only grows while the pool exists
+    std::atomic<bool> _exit;
+
+    PartitionedConvolverPool(const PartitionedConvolverPool&);
+    PartitionedConvolverPool& operator=(const PartitionedConvolverPool&);
+};
+
+// Multiplies the groups that it takes from its mailbox until the pool goes
+// away.
+class PartitionedConvolverWorker : public Thread
+{
+public:
+    PartitionedConvolverWorker(PartitionedConvolverPool& pool, size_t index) :
+        Thread("PartitionedConvolverWorker"),
+        _pool(pool),
+        _index(index)
+    {
+        startThread();
+    }
+
+    virtual ~PartitionedConvolverWorker()
+    {
+        stopThread(1000);
+    }
+
+    virtual void run()
+    {
+        TRACE_THREAD_NAME("convolver worker");
+        ScopedNoDenormals noDenormals;
+        while (PartitionedConvolver::Group* group = _pool.take(_index))
+        {
+            group->owner->processGroup(group);
+        }
+    }
+
+private:
+    PartitionedConvolverPool& _pool;
+    size_t _index;
+
+    PartitionedConvolverWorker(const PartitionedConvolverWorker&);
+    PartitionedConvolverWorker& operator=(const PartitionedConvolverWorker&);
+};
+
+std::mutex PartitionedConvolverPool::_instanceMutex;
+PartitionedConvolverPool* PartitionedConvolverPool::_instance = nullptr;
+size_t PartitionedConvolverPool::_users = 0;
+
+PartitionedConvolverPool::PartitionedConvolverPool() :
+    _workerCount(0),
+    _exit(false)
+{
+    for (size_t w = 0; w < PARTITIONED_CONVOLVER_MAX_WORKERS; ++w) {
+        _mailboxes[w].group.store(nullptr);
+        _workers[w] = nullptr;
+    }
+}
+
+PartitionedConvolverPool::~PartitionedConvolverPool()
+{
+    _exit.store(true);
+    const size_t workerCount = _workerCount.load();
+    for (size_t w = 0; w < workerCount; ++w) {
+        _mailboxes[w].wake.post();
+    }
+    for (size_t w = 0; w < workerCount; ++w) {
+        delete _workers[w];
+    }
+}
+
+// The pool for a convolver that hands groups to workerCount threads. The
+// pool grows to the largest count and keeps its threads until release() has
+// been called once for each acquire(). It never has more threads than the
+// cores besides the one of the calling thread, so on smaller machines the
+// calling thread multiplies the groups that find no worker.
+PartitionedConvolverPool* PartitionedConvolverPool::acquire(size_t workerCount)
+{
+    std::lock_guard<std::mutex> lock(_instanceMutex);
+    if (_instance == nullptr) {
+        _instance = new PartitionedConvolverPool();
+    }
+    const size_t cores = std::thread::hardware_concurrency();
+    workerCount = std::min(workerCount, (size_t)PARTITIONED_CONVOLVER_MAX_WORKERS);
+    workerCount = std::min(workerCount, (cores > 1) ? cores - 1 : (size_t)0);
+    for (size_t w = _instance->_workerCount.load(); w < workerCount; ++w) {
+        _instance->_workers[w] = new PartitionedConvolverWorker(*_instance, w);
+        _instance->_workerCount.store(w + 1, std::memory_order_release);
+    }
+    ++_users;
+    return _instance;
+}
+
+void PartitionedConvolverPool::release()
+{
+    std::lock_guard<std::mutex> lock(_instanceMutex);
+    if (_users > 0 && --_users == 0) {
+        delete _instance;
+        _instance = nullptr;
+    }
+}
+
+// Puts the group in the first empty mailbox from the one of worker `first`
+// on and wakes that worker. Returns false when every mailbox is full.
+bool PartitionedConvolverPool::hand(PartitionedConvolver::Group* group, size_t first)
+{
+    const size_t workerCount = _workerCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < workerCount; ++i) {
+        const size_t w = (first + i) % workerCount;
+        PartitionedConvolver::Group* empty = nullptr;
+        if (_mailboxes[w].group.compare_exchange_strong(empty, group, std::memory_order_release,
+                                                         std::memory_order_relaxed)) {
+            group->worker = w;
+            _mailboxes[w].wake.post();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Takes the group back if its worker has not taken it yet.
+bool PartitionedConvolverPool::takeBack(PartitionedConvolver::Group* group)
+{
+    PartitionedConvolver::Group* expected = group;
+    return _mailboxes[group->worker].group.compare_exchange_strong(expected, nullptr, std::memory_order_relaxed);
+}
+
+// The next group handed to the worker, or nullptr once the pool goes away.
+// Called by the workers.
+PartitionedConvolver::Group* PartitionedConvolverPool::take(size_t worker)
+{
+    Mailbox& mailbox = _mailboxes[worker];
+    for (;;) {
+        mailbox.wake.wait();
+        if (_exit.load()) {
+            return nullptr;
+        }
+        // Groups that were taken back leave posts without a group behind
+        PartitionedConvolver::Group* group = mailbox.group.exchange(nullptr, std::memory_order_acquire);
+        if (group != nullptr) {
+            return group;
+        }
+    }
+}
+
+// result = 0
+static void setZero(const SpectrumView& result, size_t len)
+{
+    memset(result.re, 0, len * sizeof(Sample));
+    memset(result.im, 0, len * sizeof(Sample));
+}
+
+// result += gain * a
+static void addScaled(const SpectrumView& result, const SpectrumView& a, float gain, size_t len)
+{
+    Sample* re = result.re;
+    Sample* im = result.im;
+    const Sample* reA = a.re;
+    const Sample* imA = a.im;
+    for (size_t i = 0; i < len; ++i) {
+        re[i] += gain * reA[i];
+        im[i] += gain * imA[i];
+    }
+}
+
+// result += a * b
+static void complexMultiplyAccumulate(const SpectrumView& result, const SpectrumView& a, const SpectrumView& b, size_t len)
+{
+    ComplexMultiplyAccumulate(result.re, result.im, a.re, a.im, b.re, b.im, len);
+}
+
+// result += gain * a * b
+static void complexMultiplyAccumulateScaled(const SpectrumView& result, const SpectrumView& a, const SpectrumView& b,
+                                            float gain, size_t len)
+{
+    Sample* re = result.re;
+    Sample* im = result.im;
+    const Sample* reA = a.re;
+    const Sample* imA = a.im;
+    const Sample* reB = b.re;
+    const Sample* imB = b.im;
+    for (size_t i = 0; i < len; ++i) {
+        const Sample gainReA = gain * reA[i];
+        const Sample gainImA = gain * imA[i];
+        re[i] += gainReA * reB[i] - gainImA * imB[i];
+        im[i] += gainReA * imB[i] + gainImA * reB[i];
+    }
+}
+
+// data *= factors
+static void multiply(Sample* data, const Sample* factors, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) {
+        data[i] *= factors[i];
+    }
+}
+
+PartitionedConvolver::PartitionedConvolver() :
+    _blockSize(0),
+    _segSize(0),
+    _segCount(0),
+    _fftComplexSize(0),
+    _slotCount(0),
+    _pathCount(1),
+    _arena(),
+    _hugePages(false),
+    _segments(),
+    _segmentsIR(),
+    _pathSegCount(0),
+    _paths(),
+    _fftBuffer(),
+    _fft(),
+    _slotMultiplied(),
+    _conv(),
+    _current(0),
+    _inputBuffer(),
+    _inputBufferFill(0),
+    _activeCount(0),
+    _publishedCount(0),
+    _unitySlot(0),
+    _envelope(Envelope()),
+    _activeEnvelope(),
+    _partitionLimit(0),
+    _shaped(false),
+    _modulated(false),
+    _partitionGains(),
+    _inputModulation(),
+    _outputModulation(),
+    _delay(0),
+    _maxDelay(0),
+    _delayBlocks(0),
+    _delayRemainder(0),
+    _workerCount(0),
+    _groups(),
+    _pool(nullptr),
+    _activeGroups(1),
+    _groupsDone(0),
+    _irFftBuffer(),
+    _irFft()
+{
+    for (size_t s = 0; s < PARTITIONED_CONVOLVER_MAX_SLOTS; ++s) {
+        _activeGains[s] = 1.0f;
+        _slotGains[s].store(1.0f);
+        _slotSegCounts[s] = 0;
+        _slotSegOffsets[s] = 0;
+    }
+}
+
+PartitionedConvolver::~PartitionedConvolver()
+{
+    reset();
+}
+
+void PartitionedConvolver::reset()
+{
+    // Groups are only handed to workers while a block is processed, so the
+    // pool refers to none of them here
+    if (_pool != nullptr) {
+        PartitionedConvolverPool::release();
+        _pool = nullptr;
+    }
+    for (size_t g = 0; g < _groups.size(); ++g) {
+        delete _groups[g];
+    }
+    for (size_t i = 0; i < _paths.size(); ++i) {
+        delete _paths[i];
+    }
+
+    _blockSize = 0;
+    _segSize = 0;
+    _segCount = 0;
+    _fftComplexSize = 0;
+    _slotCount = 0;
+    _pathCount = 1;
+    _segments.clear();
+    _segmentsIR.clear();
+    _pathSegCount = 0;
+    _paths.clear();
+    _arena.reset();
+    _fftBuffer.clear();
+    _slotMultiplied = SpectrumView();
+    _conv = SpectrumView();
+    _current = 0;
+    _inputBuffer.clear();
+    _inputBufferFill = 0;
+    _activeCount = 0;
+    _publishedCount.store(0);
+    _unitySlot = 0;
+    _partitionLimit = 0;
+    _shaped = false;
+    _modulated = false;
+    _partitionGains.clear();
+    _inputModulation.clear();
+    _outputModulation.clear();
+    _maxDelay = 0;
+    _delayBlocks = 0;
+    _delayRemainder = 0;
+    _groups.clear();
+    _activeGroups = 1;
+    _irFftBuffer.clear();
+}
+
+void PartitionedConvolver::clear()
+{
+    for (size_t i = 0; i < _segments.size(); ++i) {
+        setZero(_segments[i], _fftComplexSize);
+    }
+    for (size_t p = 0; p < _paths.size(); ++p) {
+        setZero(_paths[p]->preMultiplied, _fftComplexSize);
+        memset(_paths[p]->overlap, 0, _blockSize * sizeof(Sample));
+    }
+    _inputBuffer.setZero();
+    _inputBufferFill = 0;
+    _current = 0;
+}
+
+bool PartitionedConvolver::init(size_t blockSize, size_t irLen, size_t slotCount, size_t pathCount, size_t maxDelay,
+                                const size_t* slotIrLens)
+{
+    reset();
+
+    if (blockSize == 0 || slotCount == 0 || slotCount > PARTITIONED_CONVOLVER_MAX_SLOTS) {
+        return false;
+    }
+    if (pathCount == 0 || pathCount > PARTITIONED_CONVOLVER_MAX_PATHS) {
+        return false;
+    }
+    _pathCount = pathCount;
+    if (irLen == 0) {
+        return true;
+    }
+
+    _blockSize = NextPowerOf2(blockSize);
+    _segSize = 2 * _blockSize;
+    _segCount = (irLen + _blockSize - 1) / _blockSize;
+    _fftComplexSize = audiofft::AudioFFT::ComplexSize(_segSize);
+    _slotCount = slotCount;
+    for (size_t s = 0; s < _slotCount; ++s) {
+        const size_t slotIrLen = slotIrLens ? std::min(slotIrLens[s], irLen) : irLen;
+        _slotSegCounts[s] = (slotIrLen + _blockSize - 1) / _blockSize;
+        _slotSegOffsets[s] = _pathSegCount;
+        _pathSegCount += _slotSegCounts[s];
+    }
+
+    // FFT
+    _fft.init(_segSize);
+    _fftBuffer.resize(_segSize);
+    _irFft.init(_segSize);
+    _irFftBuffer.resize(_segSize);
+
+    // All spectra and work buffers come from the arena, in the order they
+    // are taken below. There is one group for each worker beyond the first
+    // group that the partitions fill.
+    _maxDelay = maxDelay;
+    const size_t segmentCount = _segCount + _maxDelay / _blockSize;
+    const size_t irSegmentCount = _pathCount * _pathSegCount;
+    const size_t groupCount = std::max(_segCount / PARTITIONED_CONVOLVER_MIN_GROUP_PARTITIONS, (size_t)1);
+    const size_t workerCount = std::min(std::min(_workerCount, groupCount - 1), (size_t)PARTITIONED_CONVOLVER_MAX_WORKERS);
+    const size_t spectrumCount = irSegmentCount + segmentCount + 2 * _pathCount + 2 + workerCount * (_pathCount + 1);
+    const size_t spectrumBytes = 2 * Arena::size(_fftComplexSize * sizeof(Sample));
+    if (!_arena.init(spectrumCount * spectrumBytes + _pathCount * Arena::size(_blockSize * sizeof(Sample)), _hugePages)) {
+        reset();
+        return false;
+    }
+
+    // (Still empty) impulse response partitions, then the input spectra,
+    // including the older ones read by a delay
+    for (size_t i = 0; i < irSegmentCount; ++i) {
+        _segmentsIR.push_back(takeSpectrum());
+    }
+    for (size_t i = 0; i < segmentCount; ++i) {
+        _segments.push_back(takeSpectrum());
+    }
+
+    // Prepare convolution buffers
+    for (size_t p = 0; p < _pathCount; ++p) {
+        Path* path = new Path();
+        path->preMultiplied = takeSpectrum();
+        path->mixedIR0 = takeSpectrum();
+        path->ir0 = nullptr;
+        path->overlap = _arena.take<Sample>(_blockSize);
+        _paths.push_back(path);
+    }
+    _slotMultiplied = takeSpectrum();
+    _conv = takeSpectrum();
+
+    for (size_t g = 0; g < workerCount; ++g) {
+        Group* group = new Group();
+        group->owner = this;
+        group->begin = 0;
+        group->end = 0;
+        for (size_t p = 0; p < _pathCount; ++p) {
+            group->multiplied.push_back(takeSpectrum());
+        }
+        group->slotMultiplied = takeSpectrum();
+        group->worker = SIZE_MAX;
+        _groups.push_back(group);
+    }
+    if (workerCount > 0) {
+        _pool = PartitionedConvolverPool::acquire(workerCount);
+    }
+
+    // Prepare input buffer
+    _inputBuffer.resize(2 * _blockSize);
+    _inputBufferFill = 0;
+
+    // Envelope, with the settings from before init()
+    _partitionGains.resize(_segCount);
+    _inputModulation.resize(_blockSize);
+    _outputModulation.resize(_segSize);
+    applyEnvelope(_activeEnvelope);
+
+    _current = 0;
+    return true;
+}
+
+SpectrumView PartitionedConvolver::takeSpectrum()
+{
+    SpectrumView spectrum;
+    spectrum.re = _arena.take<Sample>(_fftComplexSize);
+    spectrum.im = _arena.take<Sample>(_fftComplexSize);
+    return spectrum;
+}
+
+SpectrumView& PartitionedConvolver::getSegmentIR(size_t path, size_t slot, size_t index)
+{
+    return _segmentsIR[path * _pathSegCount + _slotSegOffsets[slot] + index];
+}
+
+void PartitionedConvolver::loadPartition(size_t path, size_t slot, const Sample* ir, size_t irLen, size_t index)
+{
+    if (path >= _pathCount || slot >= _slotCount || index >= _slotSegCounts[slot]) {
+        return;
+    }
+
+    const size_t offset = index * _blockSize;
+    const size_t remaining = (irLen > offset) ? (irLen - offset) : 0;
+    const size_t sizeCopy = std::min(remaining, _blockSize);
+
+    CopyAndPad(_irFftBuffer, ir + offset, sizeCopy);
+    SpectrumView& segment = getSegmentIR(path, slot, index);
+    _irFft.fft(_irFftBuffer.data(), segment.re, segment.im);
+}
+
+void PartitionedConvolver::publishPartitions(size_t count)
+{
+    _publishedCount.store(std::min(count, _segCount), std::memory_order_release);
+}
+
+void PartitionedConvolver::setSlotGain(size_t slot, float gain)
+{
+    if (slot < PARTITIONED_CONVOLVER_MAX_SLOTS) {
+        _slotGains[slot].store(gain, std::memory_order_relaxed);
+    }
+}
+
+void PartitionedConvolver::setEnvelope(size_t length, float gain, float decay)
+{
+    Envelope envelope;
+    envelope.length = length;
+    envelope.gain = gain;
+    envelope.decay = decay;
+    _envelope.write(envelope);
+}
+
+void PartitionedConvolver::setDelay(size_t delay)
+{
+    _delay.store(delay, std::memory_order_relaxed);
+}
+
+void PartitionedConvolver::setWorkerCount(size_t count)
+{
+    _workerCount = count;
+}
+
+void PartitionedConvolver::setHugePages(bool enabled)
+{
+    _hugePages = enabled;
+}
+
+// Called on block boundaries by process(), and by init().
+void PartitionedConvolver::applyEnvelope(const Envelope& envelope)
+{
+    _activeEnvelope = envelope;
+    if (_segCount == 0) {
+        return;
+    }
+
+    const size_t length = std::min(envelope.length, _segCount * _blockSize);
+    _partitionLimit = (length + _blockSize - 1) / _blockSize;
+    _modulated = (envelope.decay != 0.0f);
+    _shaped = _modulated || envelope.gain != 1.0f || length % _blockSize != 0;
+    if (!_shaped) {
+        return;
+    }
+
+    // The gains and modulation are calculated with a running product in
+    // double precision, which is exact enough and avoids an exp() per sample.
+    const double step = exp(-(double)envelope.decay * _blockSize);
+    double gain = envelope.gain;
+    for (size_t i = 0; i < _partitionLimit; ++i) {
+        _partitionGains[i] = (float)gain;
+        gain *= step;
+    }
+    if (length % _blockSize != 0) {
+        _partitionGains[_partitionLimit - 1] *= (float)(length % _blockSize) / _blockSize;
+    }
+
+    if (_modulated) {
+        const double up = exp((double)envelope.decay);
+        const double down = 1.0 / up;
+        double in = 1.0;
+        double out = 1.0;
+        for (size_t n = 0; n < _segSize; ++n) {
+            if (n < _blockSize) {
+                _inputModulation[n] = (Sample)in;
+            }
+            _outputModulation[n] = (Sample)out;
+            in *= up;
+            out *= down;
+        }
+    }
+}
+
+size_t PartitionedConvolver::getSlotCount() const
+{
+    return _slotCount;
+}
+
+size_t PartitionedConvolver::getPathCount() const
+{
+    return _pathCount;
+}
+
+size_t PartitionedConvolver::getBlockSize() const
+{
+    return _blockSize;
+}
+
+size_t PartitionedConvolver::getPartitionCount() const
+{
+    return _segCount;
+}
+
+size_t PartitionedConvolver::getPublishedPartitionCount() const
+{
+    return _publishedCount.load(std::memory_order_acquire);
+}
+
+size_t PartitionedConvolver::getSpectrumBytes() const
+{
+    return (_segments.size() + _segmentsIR.size()) * 2 * Arena::size(_fftComplexSize * sizeof(Sample));
+}
+
+size_t PartitionedConvolver::getBufferBytes() const
+{
+    // The rest of the arena, including the rounding to huge pages
+    const size_t realBuffers = _fftBuffer.size() + _irFftBuffer.size() + _inputBuffer.size();
+    return _arena.getBytes() - getSpectrumBytes() + realBuffers * sizeof(Sample);
+}
+
+// Complex multiplication of partitions [begin, end) of all slots for one
+// path, with the slot gains and the partition gains of the envelope.
+void PartitionedConvolver::multiplyPartitions(size_t p, size_t begin, size_t end, const SpectrumView& result,
+                                              const SpectrumView& slotMultiplied)
+{
+    setZero(result, _fftComplexSize);
+    if (_unitySlot < _slotCount) {
+        const size_t slotEnd = std::min(end, _slotSegCounts[_unitySlot]);
+        for (size_t i = begin; i < slotEnd; ++i) {
+            const size_t indexAudio = (_current + _delayBlocks + i) % _segments.size();
+            complexMultiplyAccumulate(result, getSegmentIR(p, _unitySlot, i), _segments[indexAudio], _fftComplexSize);
+        }
+        return;
+    }
+
+    // Each slot is accumulated separately and added with its gain
+    for (size_t s = 0; s < _slotCount; ++s) {
+        const float gain = _activeGains[s];
+        const size_t slotEnd = std::min(end, _slotSegCounts[s]);
+        if (gain == 0.0f || begin >= slotEnd) {
+            continue;
+        }
+        setZero(slotMultiplied, _fftComplexSize);
+        for (size_t i = begin; i < slotEnd; ++i) {
+            const size_t indexAudio = (_current + _delayBlocks + i) % _segments.size();
+            if (_shaped) {
+                complexMultiplyAccumulateScaled(slotMultiplied, getSegmentIR(p, s, i), _segments[indexAudio], _partitionGains[i],
+                                                _fftComplexSize);
+            }
+            else {
+                complexMultiplyAccumulate(slotMultiplied, getSegmentIR(p, s, i), _segments[indexAudio], _fftComplexSize);
+            }
+        }
+        addScaled(result, slotMultiplied, gain, _fftComplexSize);
+    }
+}
+
+// Complex multiplication of all partitions but the first for one path. This
+// only depends on previous blocks, so it is done once per block. When the
+// output is delayed by a block or more, the first partition also only reads
+// previous blocks and is included here. Partitions of the worker groups are
+// left to finishGroups().
+void PartitionedConvolver::preMultiply(size_t p)
+{
+    Path* path = _paths[p];
+    const size_t first = (_delayBlocks > 0) ? 0 : 1;
+    const size_t end = (_activeGroups > 1) ? _groups[0]->begin : _activeCount;
+    multiplyPartitions(p, first, end, path->preMultiplied, _slotMultiplied);
+    if (_unitySlot < _slotCount) {
+        path->ir0 = &getSegmentIR(p, _unitySlot, 0);
+    }
+    else {
+        // The gains are folded into a mixed first partition so that the
+        // per-call work is the same as for a single slot.
+        setZero(path->mixedIR0, _fftComplexSize);
+        for (size_t s = 0; s < _slotCount && first > 0; ++s) {
+            const float gain = _activeGains[s];
+            if (gain != 0.0f && _slotSegCounts[s] > 0) {
+                addScaled(path->mixedIR0, getSegmentIR(p, s, 0), _shaped ? gain * _partitionGains[0] : gain, _fftComplexSize);
+            }
+        }
+        path->ir0 = &path->mixedIR0;
+    }
+}
+
+// Splits the partitions of the block into groups of about the same size and
+// hands all but the first to the workers. A group that finds every mailbox
+// full is left to finishGroups(). Called on block boundaries, after the
+// settings of the block are latched.
+void PartitionedConvolver::startGroups()
+{
+    const size_t first = (_delayBlocks > 0) ? 0 : 1;
+    const size_t count = (_activeCount > first) ? _activeCount - first : 0;
+    _activeGroups = std::min(std::max(count / PARTITIONED_CONVOLVER_MIN_GROUP_PARTITIONS, (size_t)1), _groups.size() + 1);
+    _groupsDone.store(0, std::memory_order_relaxed);
+    for (size_t g = 1; g < _activeGroups; ++g) {
+        Group* group = _groups[g - 1];
+        group->begin = first + count * g / _activeGroups;
+        group->end = first + count * (g + 1) / _activeGroups;
+        if (!_pool->hand(group, g - 1)) {
+            group->worker = SIZE_MAX;
+        }
+    }
+}
+
+// Multiplies the groups that no worker has taken, waits for the others and
+// adds their partial spectra. Only groups that a worker is multiplying are
+// waited for, so the wait is at most the time of one group, unless the
+// worker is preempted.
+void PartitionedConvolver::finishGroups()
+{
+    if (_activeGroups <= 1) {
+        return;
+    }
+
+    TRACE_ZONE("PartitionedConvolver::finishGroups");
+    for (size_t g = 0; g + 1 < _activeGroups; ++g) {
+        Group* group = _groups[g];
+        if (group->worker == SIZE_MAX || _pool->takeBack(group)) {
+            processGroup(group);
+        }
+    }
+    while (_groupsDone.load(std::memory_order_acquire) < _activeGroups - 1) {
+        std::this_thread::yield();
+    }
+    for (size_t g = 0; g + 1 < _activeGroups; ++g) {
+        for (size_t p = 0; p < _pathCount; ++p) {
+            const SpectrumView& preMultiplied = _paths[p]->preMultiplied;
+            const SpectrumView& multiplied = _groups[g]->multiplied[p];
+            Sum(preMultiplied.re, preMultiplied.re, multiplied.re, _fftComplexSize);
+            Sum(preMultiplied.im, preMultiplied.im, multiplied.im, _fftComplexSize);
+        }
+    }
+}
+
+// Called by the worker that took the group, or by finishGroups(). The
+// partitions it reads are not written during the block: the forward FFT only
+// writes the current input spectrum, which is never read through the groups.
+void PartitionedConvolver::processGroup(Group* group)
+{
+    for (size_t p = 0; p < _pathCount; ++p) {
+        multiplyPartitions(p, group->begin, group->end, group->multiplied[p], group->slotMultiplied);
+    }
+    _groupsDone.fetch_add(1, std::memory_order_release);
+}
+
+void PartitionedConvolver::process(const Sample* input, Sample* output, size_t len)
+{
+    Sample* outputs[1] = {output};
+    process(input, outputs, len);
+}
+
+void PartitionedConvolver::process(const Sample* input, Sample* const* outputs, size_t len)
+{
+    if (_segCount == 0) {
+        for (size_t p = 0; p < _pathCount; ++p) {
+            memset(outputs[p], 0, len * sizeof(Sample));
+        }
+        return;
+    }
+
+    size_t processed = 0;
+    while (processed < len) {
+        const bool inputBufferWasEmpty = (_inputBufferFill == 0);
+        const size_t processing = std::min(len - processed, _blockSize - _inputBufferFill);
+        const size_t inputBufferPos = _inputBufferFill;
+
+        if (inputBufferWasEmpty) {
+            const size_t delay = std::min(_delay.load(std::memory_order_relaxed), _maxDelay);
+            _delayBlocks = delay / _blockSize;
+            _delayRemainder = delay % _blockSize;
+            const Envelope& envelope = _envelope.read();
+            if (envelope.length != _activeEnvelope.length || envelope.gain != _activeEnvelope.gain ||
+                envelope.decay != _activeEnvelope.decay) {
+                applyEnvelope(envelope);
+            }
+            _activeCount = std::min(_publishedCount.load(std::memory_order_acquire), _partitionLimit);
+            size_t audibleSlots = 0;
+            for (size_t s = 0; s < _slotCount; ++s) {
+                _activeGains[s] = _slotGains[s].load(std::memory_order_relaxed);
+                if (_activeGains[s] != 0.0f && _slotSegCounts[s] > 0) {
+                    _unitySlot = s;
+                    ++audibleSlots;
+                }
+            }
+            if (audibleSlots != 1 || _activeGains[_unitySlot] != 1.0f || _shaped) {
+                _unitySlot = _slotCount;
+            }
+            if (_activeCount > 0) {
+                startGroups();
+            }
+        }
+        const bool inputBufferFull = (_inputBufferFill + processing == _blockSize);
+
+        // The input is written ahead by the remainder of the delay, possibly
+        // into the second block of the buffer.
+        memcpy(_inputBuffer.data() + _delayRemainder + inputBufferPos, input + processed, processing * sizeof(Sample));
+
+        if ((_activeCount > 0 && _delayBlocks == 0) || inputBufferFull) {
+            // Forward FFT. While nothing is published, or the output is
+            // delayed by a block or more, the input spectrum is only needed
+            // once the block is complete.
+            CopyAndPad(_fftBuffer, _inputBuffer.data(), _blockSize);
+            if (_modulated) {
+                multiply(_fftBuffer.data(), _inputModulation.data(), inputBufferPos + processing);
+            }
+            _fft.fft(_fftBuffer.data(), _segments[_current].re, _segments[_current].im);
+        }
+
+        if (inputBufferWasEmpty && _activeCount > 0) {
+            for (size_t p = 0; p < _pathCount; ++p) {
+                preMultiply(p);
+            }
+            finishGroups();
+        }
+
+        for (size_t p = 0; p < _pathCount; ++p) {
+            Path* path = _paths[p];
+            if (_activeCount > 0) {
+                memcpy(_conv.re, path->preMultiplied.re, _fftComplexSize * sizeof(Sample));
+                memcpy(_conv.im, path->preMultiplied.im, _fftComplexSize * sizeof(Sample));
+                if (_delayBlocks == 0) {
+                    complexMultiplyAccumulate(_conv, _segments[_current], *path->ir0, _fftComplexSize);
+                }
+
+                // Backward FFT
+                _fft.ifft(_fftBuffer.data(), _conv.re, _conv.im);
+                if (_modulated) {
+                    multiply(_fftBuffer.data() + inputBufferPos, _outputModulation.data() + inputBufferPos, processing);
+                    if (inputBufferFull) {
+                        multiply(_fftBuffer.data() + _blockSize, _outputModulation.data() + _blockSize, _blockSize);
+                    }
+                }
+
+                // Add overlap
+                Sum(outputs[p] + processed, _fftBuffer.data() + inputBufferPos, path->overlap + inputBufferPos, processing);
+            }
+            else {
+                memset(outputs[p] + processed, 0, processing * sizeof(Sample));
+            }
+
+            // Save the overlap before the next path reuses the FFT buffer
+            if (inputBufferFull) {
+                if (_activeCount > 0) {
+                    memcpy(path->overlap, _fftBuffer.data() + _blockSize, _blockSize * sizeof(Sample));
+                }
+                else {
+                    memset(path->overlap, 0, _blockSize * sizeof(Sample));
+                }
+            }
+        }
+
+        // Input buffer full => Next block
+        _inputBufferFill += processing;
+        if (inputBufferFull) {
+            // Keep the input that was written ahead into the next block
+            memcpy(_inputBuffer.data(), _inputBuffer.data() + _blockSize, _delayRemainder * sizeof(Sample));
+            memset(_inputBuffer.data() + _delayRemainder, 0, _blockSize * sizeof(Sample));
+            _inputBufferFill = 0;
+
+            // Update current segment
+            _current = (_current > 0) ? (_current - 1) : (_segments.size() - 1);
+        }
+
+        processed += processing;
+    }
+}
@@ -0,0 +1,262 @@
+#ifndef PARTITIONED_CONVOLVER_H
+#define PARTITIONED_CONVOLVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+#include "fftconvolver/AudioFFT.h"
+#include "fftconvolver/Utilities.h"
+#include "arena.hpp"
+#include "snapshot_channel.hpp"
+
+#define PARTITIONED_CONVOLVER_MAX_SLOTS 8
+#define PARTITIONED_CONVOLVER_MAX_PATHS 16
+
+// Fewest partitions that are worth handing to a worker thread, see
+// PartitionedConvolver::setWorkerCount().
+#define PARTITIONED_CONVOLVER_MIN_GROUP_PARTITIONS 8
+
+// Most worker threads of the process, see
+// PartitionedConvolver::setWorkerCount().
+#define PARTITIONED_CONVOLVER_MAX_WORKERS 8
+
+class PartitionedConvolverPool;
+class PartitionedConvolverWorker;
+
+// Complex spectrum with its real and imaginary parts in an Arena
+struct SpectrumView
+{
+    fftconvolver::Sample* re;
+    fftconvolver::Sample* im;
+};
+
+// Uniformly partitioned FFT convolver based on fftconvolver::FFTConvolver.
+//
+// Unlike FFTConvolver, the impulse response partitions are not transformed in
+// init(). They are added one at a time with loadPartition() (possibly from
+// another thread) and become audible once published with
+// publishPartitions(). The input spectra are kept for the full length of the
+// impulse response from the start, so a partition published while the
+// convolver is running is exact from the following block and onwards.
+//
+// The convolver can hold several impulse responses ("slots"). Each slot only
+// gets partitions for its own length, see init(). The input spectra are computed once and shared by all slots, and the
+// slots are mixed with individual gains in the frequency domain, so each extra
+// slot costs one extra complex multiply-accumulate pass and no extra FFTs.
+//
+// Each slot can also hold one impulse response per output ("path"), e.g. one
+// per output channel that an input is routed to. The paths share the input
+// spectra too, so the cost grows with the number of paths (one
+// multiply-accumulate pass per slot and one inverse FFT each) rather than
+// with the number of inputs times outputs.
+//
+// The impulse response can be shortened and faded out at runtime without
+// transforming it again, see setEnvelope(), and delayed, see setDelay().
+//
+// The partitions of a long impulse response can be split across the worker
+// threads of the process, see setWorkerCount().
+//
+// The spectra and the other work buffers of the multiply-accumulates are
+// allocated at once from one arena, see setHugePages(). The impulse response
+// partitions lie after each other in the order the multiply-accumulate
+// walks them (path, then slot, then time), followed by the delay line of
+// input spectra.
+class PartitionedConvolver
+{
+public:
+    PartitionedConvolver();
+    virtual ~PartitionedConvolver();
+
+    // The delay line of input spectra is made long enough for setDelay() up
+    // to maxDelay samples. slotIrLens holds the length of each slot, at most
+    // irLen; without it every slot is irLen long. The partitions after the
+    // end of a slot are neither stored, loaded nor multiplied.
+    bool init(size_t blockSize, size_t irLen, size_t slotCount = 1, size_t pathCount = 1, size_t maxDelay = 0,
+              const size_t* slotIrLens = nullptr);
+    void loadPartition(size_t path, size_t slot, const fftconvolver::Sample* ir, size_t irLen, size_t index);
+    void publishPartitions(size_t count);
+    void process(const fftconvolver::Sample* input, fftconvolver::Sample* output, size_t len);
+    void process(const fftconvolver::Sample* input, fftconvolver::Sample* const* outputs, size_t len);
+    void reset();
+
+    // Silences the input and output history but keeps the impulse response
+    // partitions, as if the input had been silent for the whole length.
+    void clear();
+
+    // Gains are applied from the next block. A slot with zero gain is skipped.
+    void setSlotGain(size_t slot, float gain);
+
+    // Shapes the impulse response by gain * exp(-decay * n) and cuts it after
+    // length samples, from the next block. The partitions after the cut are
+    // skipped, so the work falls with the length, and the partition at the
+    // cut is scaled by the part of it that is kept. The envelope is applied
+    // as a gain per partition, and made exact within the partitions by
+    // modulating the input of each block by exp(decay * m) and its output by
+    // exp(-decay * n). Input that is already in the delay line keeps the
+    // modulation it was transformed with, so a change of the decay settles
+    // over the length of the impulse response. Called from one thread at a
+    // time; process() may run concurrently.
+    void setEnvelope(size_t length, float gain, float decay);
+
+    // Delays the output by delay samples (at most the maxDelay given to
+    // init()), from the next block. Whole blocks of the delay are taken by
+    // reading the partitions from older input spectra, and the remainder by
+    // writing the input ahead into the input buffer, so the delay costs no
+    // extra multiply-accumulates or copies. A delay of a block or more also
+    // saves the forward FFT of incomplete blocks. A change jumps like a delay
+    // line without interpolation. Called from any thread.
+    void setDelay(size_t delay);
+
+    // Splits the partitions of each block into up to count + 1 contiguous
+    // groups of at least PARTITIONED_CONVOLVER_MIN_GROUP_PARTITIONS and
+    // queues all groups but the first for a pool of worker threads that all
+    // convolvers of the process share. The pool has as many threads as the
+    // largest count of the convolvers that use it, so the number of threads
+    // does not grow with the number of convolvers, but no more than one per
+    // core besides the calling thread. The partitions after the
+    // first only read older input spectra, so the workers start as soon as a
+    // block begins, while the calling thread does the forward FFT and the
+    // first group. Their partial spectra are due at the inverse FFT of the
+    // block; groups that no worker has taken by then are multiplied by the
+    // calling thread, so a block never waits for workers that are busy with
+    // other convolvers, only for the groups that a worker is already
+    // multiplying. Handing a group over and taking it back are single atomic
+    // operations, so the calling thread never takes a lock. The partial
+    // spectra are summed in group order, so the output depends on the number
+    // of groups but not on which thread multiplied them, or on how many
+    // threads the machine has. At most
+    // PARTITIONED_CONVOLVER_MAX_WORKERS threads are used. Takes effect from
+    // the next init().
+    void setWorkerCount(size_t count);
+
+    // Backs the arena with huge pages where the system supports it, see
+    // Arena::init(). Takes effect from the next init().
+    void setHugePages(bool enabled);
+
+    size_t getBlockSize() const;
+    size_t getPartitionCount() const;
+    size_t getPublishedPartitionCount() const;
+    size_t getSlotCount() const;
+    size_t getPathCount() const;
+
+    // Memory used by the input and impulse response spectra, and by the
+    // remaining work buffers, in bytes.
+    size_t getSpectrumBytes() const;
+    size_t getBufferBytes() const;
+
+private:
+    friend class PartitionedConvolverPool;
+    friend class PartitionedConvolverWorker;
+
+    struct Envelope
+    {
+        size_t length;
+        float gain;
+        float decay;
+
+        Envelope() : length(SIZE_MAX), gain(1.0f), decay(0.0f) {}
+    };
+
+    // Output state of one path
+    struct Path
+    {
+        SpectrumView preMultiplied;
+        SpectrumView mixedIR0;
+        const SpectrumView* ir0;
+        fftconvolver::Sample* overlap;
+    };
+
+    // Partition group for the worker threads, with one partial spectrum per
+    // path
+    struct Group
+    {
+        PartitionedConvolver* owner;
+        size_t begin;
+        size_t end;
+        std::vector<SpectrumView> multiplied;
+        SpectrumView slotMultiplied;
+        size_t worker; // Mailbox it was handed to this block, or SIZE_MAX
+    };
+
+    SpectrumView takeSpectrum();
+    SpectrumView& getSegmentIR(size_t path, size_t slot, size_t index);
+    void multiplyPartitions(size_t path, size_t begin, size_t end, const SpectrumView& result,
+                            const SpectrumView& slotMultiplied);
+    void preMultiply(size_t path);
+    void startGroups();
+    void finishGroups();
+    void processGroup(Group* group);
+    void applyEnvelope(const Envelope& envelope);
+
+    size_t _blockSize;
+    size_t _segSize;
+    size_t _segCount;
+    size_t _fftComplexSize;
+    size_t _slotCount;
+    size_t _pathCount;
+    Arena _arena;
+    bool _hugePages;
+    std::vector<SpectrumView> _segments; // _segCount + _maxDelay / _blockSize
+    std::vector<SpectrumView> _segmentsIR; // Path-major, then slot-major
+    size_t _slotSegCounts[PARTITIONED_CONVOLVER_MAX_SLOTS];
+    size_t _slotSegOffsets[PARTITIONED_CONVOLVER_MAX_SLOTS]; // Within the partitions of a path
+    size_t _pathSegCount; // Partitions of all slots of a path
+    std::vector<Path*> _paths;
+    fftconvolver::SampleBuffer _fftBuffer;
+    audiofft::AudioFFT _fft;
+    SpectrumView _slotMultiplied;
+    SpectrumView _conv;
+    size_t _current;
+    fftconvolver::SampleBuffer _inputBuffer; // Two blocks, the second one for the delay remainder
+    size_t _inputBufferFill;
+
+    // Number of partitions used in the current block. Only updated on block
+    // boundaries so that a block is never convolved with a partial set.
+    size_t _activeCount;
+    std::atomic<size_t> _publishedCount;
+    float _activeGains[PARTITIONED_CONVOLVER_MAX_SLOTS];
+    std::atomic<float> _slotGains[PARTITIONED_CONVOLVER_MAX_SLOTS];
+
+    // The only slot that is heard in the current block, when it is at unity
+    // gain and unshaped, so that its partitions are used as they are.
+    // _slotCount otherwise.
+    size_t _unitySlot;
+
+    // Envelope, also latched on block boundaries. While it is neutral the
+    // gains and modulation are skipped entirely.
+    SnapshotChannel<Envelope> _envelope;
+    Envelope _activeEnvelope;
+    size_t _partitionLimit;
+    bool _shaped;    // Some partition gain is not 1
+    bool _modulated; // The decay is not 0
+    std::vector<float> _partitionGains;
+    fftconvolver::SampleBuffer _inputModulation;
+    fftconvolver::SampleBuffer _outputModulation;
+
+    // Delay, latched on block boundaries like the envelope
+    std::atomic<size_t> _delay;
+    size_t _maxDelay;
+    size_t _delayBlocks;
+    size_t _delayRemainder;
+
+    // Worker groups, the first one after the partitions of the calling
+    // thread. _activeGroups counts the calling thread too and is set on
+    // block boundaries. _pool is set while there are groups.
+    size_t _workerCount;
+    std::vector<Group*> _groups;
+    PartitionedConvolverPool* _pool;
+    size_t _activeGroups;
+    std::atomic<size_t> _groupsDone;
+
+    // Separate FFT instance for loadPartition() as it may run concurrently
+    // with process().
+    fftconvolver::SampleBuffer _irFftBuffer;
+    audiofft::AudioFFT _irFft;
+
+    PartitionedConvolver(const PartitionedConvolver&);
+    PartitionedConvolver& operator=(const PartitionedConvolver&);
+};
+
+#endif
@@ -3,27 +3,48 @@
 #include "utils.h"
 #include "DistrhoDefines.h"
 #include "cp1252.hpp"
+#include "ir_file.hpp"
+#include "trace.hpp"
 
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <string>
 
-#include "audiofile/AudioFile.h"
 extern "C" {
 #include "base64/base64.h"
 }
 
 #define FFT_BLOCK_SIZE 1024
 
-#ifdef GUNSHOT_LOG_FILE
-static char line[1024];
-#endif
+static const char *state_keys[PLUGIN_STATE_NUM_SLOTS] = {"state", "state_b"};
+
+// Allocates num_channels channels and clears the remaining pointers. The
+// previous pointers are not freed, as the state may be uninitialised. On
+// failure, nothing is left allocated.
+static int allocate_channels(plugin_state_t *state, uint32_t num_channels, uint32_t num_samples)
+{
+    uint32_t c;
+
+    for (c = 0; c < PLUGIN_STATE_MAX_CHANNELS; c++) {
+        state->ir[c] = NULL;
+    }
+    for (c = 0; c < num_channels; c++) {
+        state->ir[c] = (float *)malloc(sizeof(float)*num_samples);
+        if (state->ir[c] == NULL) {
+            plugin_state_free(state);
+            return 1;
+        }
+    }
+    return 0;
+}
 
 int plugin_state_init(plugin_state_t *state, const char *filename)
 {
-    bool ok;
-    int n;
-    AudioFile<float> ir;
+    int err;
+    uint32_t c;
+    uint32_t n;
+    ir_file_t ir;
 
 #ifdef DISTRHO_OS_WINDOWS
     // Convert file encoding from UTF-8 to CP-1252 on Windows.
@@ -32,69 +53,68 @@ int plugin_state_init(plugin_state_t *state, const char *filename)
     std::string filename_enc = std::string(filename);
 #endif
 
-    ok = ir.load(filename_enc);
-    if (!ok) {
-        log_write("Error loading impulse response from file");
+    err = ir_file_open(&ir, filename_enc.c_str());
+    if (err) {
+        log_write_level(LOG_LEVEL_ERROR, "Error loading impulse response from file");
         return 1;
     }
 
-#ifdef GUNSHOT_LOG_FILE
-    sprintf(line, "Filename: %s", filename);
-    log_write(line);
-    sprintf(line, "Num channels: %d", ir.getNumChannels());
-    log_write(line);
-    sprintf(line, "Num samples per channel: %d", ir.getNumSamplesPerChannel());
-    log_write(line);
-    sprintf(line, "Sample rate: %d", ir.getSampleRate());
-    log_write(line);
-    sprintf(line, "Bit depth: %d", ir.getBitDepth());
-    log_write(line);
-    sprintf(line, "Length in seconds: %f", ir.getLengthInSeconds());
-    log_write(line);
-#endif
+    if (log_get_level() >= LOG_LEVEL_INFO) {
+        log_write((std::string("Filename: ") + filename).c_str());
+    }
+    log_write_value(LOG_LEVEL_INFO, "Num channels:", ir.num_channels);
+    log_write_value(LOG_LEVEL_INFO, "Num samples per channel:", ir.num_samples_per_channel);
+    log_write_value(LOG_LEVEL_INFO, "Sample rate:", ir.sample_rate_Hz);
+    log_write_value(LOG_LEVEL_INFO, "Bit depth:", ir.bit_depth);
 
-    if ((ir.getNumChannels() < 1) || (2 < ir.getNumChannels())) {
+    if (ir.num_samples_per_channel < 1 || ir.num_samples_per_channel > UINT32_MAX) {
+        ir_file_close(&ir);
         return 1;
     }
+    uint32_t num_samples = (uint32_t)ir.num_samples_per_channel;
 
-    state->ir_left = NULL;
-    state->ir_left = (float *)malloc(sizeof(float)*ir.getNumSamplesPerChannel());
-    if (state->ir_left == NULL) {
+#ifdef GUNSHOT_NUM_INPUTS
+    uint32_t num_channels = ir.num_channels < PLUGIN_STATE_MAX_CHANNELS ? ir.num_channels : PLUGIN_STATE_MAX_CHANNELS;
+#else
+    uint32_t num_channels = 2;
+#endif
+
+    err = allocate_channels(state, num_channels, num_samples);
+    if (err) {
+        ir_file_close(&ir);
         return 1;
     }
 
-    state->ir_right = NULL;
-    state->ir_right = (float *)malloc(sizeof(float)*ir.getNumSamplesPerChannel());
-    if (state->ir_right == NULL) {
+    // Convert the file directly into the state
+    double sum_sq[PLUGIN_STATE_MAX_CHANNELS];
+    err = ir_file_read(&ir, state->ir, num_channels, sum_sq);
+    ir_file_close(&ir);
+    if (err) {
+        plugin_state_free(state);
         return 1;
     }
 
-    // Calculate scale factor
-    float sum_sq_left = 0.0;
-    float sum_sq_right = 0.0;
-    for (n = 0; n < ir.getNumSamplesPerChannel(); n++) {
-        float L = ir.samples[0][n];
-        float R = (ir.getNumChannels() > 1) ? ir.samples[1][n] : L;
-
-        sum_sq_left += L*L;
-        sum_sq_right += R*R;
+    // Normalise by the channel with the most energy
+    double sum_sq_max = 0.0;
+    for (c = 0; c < num_channels; c++) {
+        sum_sq_max = sum_sq[c] > sum_sq_max ? sum_sq[c] : sum_sq_max;
     }
-    float sum_sq_max = sum_sq_left > sum_sq_right ? sum_sq_left : sum_sq_right;
-    float scale = 1.0/sqrt(sum_sq_max);
+    float scale = sum_sq_max > 0.0 ? (float)(1.0/sqrt(sum_sq_max)) : 1.0f;
 
-    for (n = 0; n < ir.getNumSamplesPerChannel(); n++) {
-        state->ir_left[n] = scale * ir.samples[0][n];
-        state->ir_right[n] =  (ir.getNumChannels() > 1) ? (scale * ir.samples[1][n]) : (scale * ir.samples[0][n]);
+    for (c = 0; c < num_channels; c++) {
+        for (n = 0; n < num_samples; n++) {
+            state->ir[c][n] *= scale;
+        }
     }
 
     memset(state->filename, '\0', PLUGIN_STATE_FILENAME_LENGTH);
     strncpy(state->filename, (char *)(filename + find_basename(filename)), PLUGIN_STATE_FILENAME_LENGTH);
 
     state->version = PLUGIN_STATE_VERSION;
-    state->ir_num_samples_per_channel = ir.getNumSamplesPerChannel();
-    state->ir_num_channels = ir.getNumChannels();
-    state->ir_sample_rate_Hz = ir.getSampleRate();
-    state->ir_bit_depth = ir.getBitDepth();
+    state->ir_num_samples_per_channel = num_samples;
+    state->ir_num_channels = num_channels;
+    state->ir_sample_rate_Hz = ir.sample_rate_Hz;
+    state->ir_bit_depth = ir.bit_depth;
     state->fft_block_size = FFT_BLOCK_SIZE;
 
     return 0;
@@ -102,19 +122,12 @@ int plugin_state_init(plugin_state_t *state, const char *filename)
 
 int plugin_state_init_dirac(plugin_state_t *state, uint32_t sample_rate_Hz)
 {
-    state->ir_left = NULL;
-    state->ir_right = NULL;
-
-    state->ir_left = (float *)malloc(1 * sizeof(float));
-    if (state->ir_left == NULL) {
-        return 1;
-    }
-    state->ir_right = (float *)malloc(1 * sizeof(float));
-    if (state->ir_right == NULL) {
+    int err = allocate_channels(state, 2, 1);
+    if (err) {
         return 1;
     }
-    state->ir_left[0] = 1.0;
-    state->ir_right[0] = 1.0;
+    state->ir[0][0] = 1.0;
+    state->ir[1][0] = 1.0;
 
     memset(state->filename, '\0', PLUGIN_STATE_FILENAME_LENGTH);
     strncpy(state->filename, "No file loaded", PLUGIN_STATE_FILENAME_LENGTH);
@@ -131,8 +144,11 @@ int plugin_state_init_dirac(plugin_state_t *state, uint32_t sample_rate_Hz)
 
 int plugin_state_free(plugin_state_t *state)
 {
-    free(state->ir_left);
-    free(state->ir_right);
+    for (uint32_t c = 0; c < PLUGIN_STATE_MAX_CHANNELS; c++) {
+        free(state->ir[c]);
+        state->ir[c] = NULL;
+    }
+    return 0;
 }
 
 #define MASK0(x) ((( *(uint32_t*) (&x) ) >>  0) & 0xff)
@@ -142,6 +158,7 @@ int plugin_state_free(plugin_state_t *state)
 
 int plugin_state_serialize(plugin_state_t *state, char **output, uint32_t *length)
 {
+    TRACE_ZONE("plugin_state_serialize");
     assert(sizeof(uint32_t) == 4);
     assert(sizeof(float) == 4);
 
@@ -161,8 +178,7 @@ int plugin_state_serialize(plugin_state_t *state, char **output, uint32_t *lengt
     s_length += sizeof(uint32_t); // ir_bit_depth
     s_length += sizeof(uint32_t); // fft_block_size
     s_length += sizeof(char) * PLUGIN_STATE_FILENAME_LENGTH; // filename
-    s_length += sizeof(float)*state->ir_num_samples_per_channel; // ir_left
-    s_length += sizeof(float)*state->ir_num_samples_per_channel; // ir_right
+    s_length += sizeof(float)*state->ir_num_samples_per_channel*state->ir_num_channels; // ir
 
     // Serialize the struct.
     // Multibyte objects are encoded as Little Endian.
@@ -172,6 +188,7 @@ int plugin_state_serialize(plugin_state_t *state, char **output, uint32_t *lengt
         return 1;
     }
 
+    uint32_t c;
     uint32_t i;
     uint32_t n = 0;
 
@@ -211,19 +228,14 @@ int plugin_state_serialize(plugin_state_t *state, char **output, uint32_t *lengt
         s[n++] = S->filename[i];
     }
 
-    // Serialize dynamic-length members
-    for (i = 0; i < S->ir_num_samples_per_channel; i++) {
-        s[n++] = MASK0(S->ir_left[i]);
-        s[n++] = MASK1(S->ir_left[i]);
-        s[n++] = MASK2(S->ir_left[i]);
-        s[n++] = MASK3(S->ir_left[i]);
-    }
-
-    for (i = 0; i < S->ir_num_samples_per_channel; i++) {
-        s[n++] = MASK0(S->ir_right[i]);
-        s[n++] = MASK1(S->ir_right[i]);
-        s[n++] = MASK2(S->ir_right[i]);
-        s[n++] = MASK3(S->ir_right[i]);
+    // Serialize dynamic-length members, one channel after the other
+    for (c = 0; c < S->ir_num_channels; c++) {
+        for (i = 0; i < S->ir_num_samples_per_channel; i++) {
+            s[n++] = MASK0(S->ir[c][i]);
+            s[n++] = MASK1(S->ir[c][i]);
+            s[n++] = MASK2(S->ir[c][i]);
+            s[n++] = MASK3(S->ir[c][i]);
+        }
     }
 
     // Base64-encode the byte-string
@@ -248,13 +260,17 @@ int plugin_state_serialize(plugin_state_t *state, char **output, uint32_t *lengt
 
 int plugin_state_deserialize(plugin_state_t *state, char *input, uint32_t length)
 {
+    TRACE_ZONE("plugin_state_deserialize");
     assert(sizeof(float) == 4);
     assert(sizeof(uint32_t) == 4);
 
     uint32_t b;
-    plugin_state_t *S = state; // Short-hand for `state`
+    plugin_state_t decoded; // Only copied to `state` once it is complete
+    plugin_state_t *S = &decoded; // Short-hand for `decoded`
+    uint32_t c;
     uint32_t i;
     uint32_t n;
+    const uint32_t header_length = 6 * sizeof(uint32_t) + sizeof(char) * PLUGIN_STATE_FILENAME_LENGTH;
 
     // Decode byte-string from base64 string
     uint32_t x_length = 0;
@@ -264,6 +280,10 @@ int plugin_state_deserialize(plugin_state_t *state, char *input, uint32_t length
         return 1;
     }
     x_length = b64_decode((uint8_t *)input, length, x);
+    if (x_length < header_length) {
+        free(x);
+        return 1;
+    }
 
     n = 0;
 
@@ -285,33 +305,61 @@ int plugin_state_deserialize(plugin_state_t *state, char *input, uint32_t length
     for (i = 0; i < PLUGIN_STATE_FILENAME_LENGTH; i++) {
         S->filename[i] = x[n++];
     }
+    S->filename[PLUGIN_STATE_FILENAME_LENGTH - 1] = '\0';
 
-    // Allocate space for the dynamic-length members
-    S->ir_left = NULL;
-    S->ir_left = (float *)malloc(sizeof(float) * S->ir_num_samples_per_channel);
-    if (S->ir_left == NULL) {
+    // Version 2 stored the channel count of the file, but always two
+    // channels of data.
+    if (S->version < 3) {
+        S->ir_num_channels = 2;
+    }
+    if (S->ir_num_channels < 1 || S->ir_num_channels > PLUGIN_STATE_MAX_CHANNELS) {
+        free(x);
         return 1;
     }
-    S->ir_right = NULL;
-    S->ir_right = (float *)malloc(sizeof(float) * S->ir_num_samples_per_channel);
-    if (S->ir_right == NULL) {
+
+    // The impulse response must be as long as the header says
+    uint64_t ir_length = (uint64_t)sizeof(float) * S->ir_num_channels * S->ir_num_samples_per_channel;
+    if (S->ir_num_samples_per_channel < 1 || ir_length > x_length - n) {
+        free(x);
         return 1;
     }
 
-    // Decode dynamic-length members
-    for (i = 0; i < S->ir_num_samples_per_channel; i++) {
-        b = UNMASK_UINT32(x[n], x[n+1], x[n+2], x[n+3]);
-        n += 4;
-        S->ir_left[i] = FLOAT_FROM_UINT32(b);
+    // Allocate space for the dynamic-length members
+    if (allocate_channels(S, S->ir_num_channels, S->ir_num_samples_per_channel)) {
+        free(x);
+        return 1;
     }
 
-    for (i = 0; i < S->ir_num_samples_per_channel; i++) {
-        b = UNMASK_UINT32(x[n], x[n+1], x[n+2], x[n+3]);
-        n += 4;
-        S->ir_right[i] = FLOAT_FROM_UINT32(b);
+    // Decode dynamic-length members
+    for (c = 0; c < S->ir_num_channels; c++) {
+        for (i = 0; i < S->ir_num_samples_per_channel; i++) {
+            b = UNMASK_UINT32(x[n], x[n+1], x[n+2], x[n+3]);
+            n += 4;
+            S->ir[c][i] = FLOAT_FROM_UINT32(b);
+        }
     }
 
     // Clean up
     free(x);
+    *state = decoded;
     return 0;
 }
+
+const char *plugin_state_key(uint32_t slot)
+{
+    if (slot >= PLUGIN_STATE_NUM_SLOTS) {
+        return "";
+    }
+    return state_keys[slot];
+}
+
+int plugin_state_slot_from_key(const char *key)
+{
+    int slot;
+    for (slot = 0; slot < PLUGIN_STATE_NUM_SLOTS; slot++) {
+        if (strcmp(key, state_keys[slot]) == 0) {
+            return slot;
+        }
+    }
+    return -1;
+}
@@ -5,9 +5,20 @@
 
 // Plugin state ////////////////////////////////////////////////////////////////
 
-#define PLUGIN_STATE_VERSION 2
+#define PLUGIN_STATE_VERSION 3
 #define PLUGIN_STATE_FILENAME_LENGTH 1024
 
+// Impulse response channels stored in a state. Stereo builds store two
+// channels (a mono file is copied to both, and only the first two channels
+// of larger files are used). Multichannel builds (see DistrhoPluginInfo.h)
+// store all channels of the file, up to this limit. Version 2 states always
+// hold two channels.
+#define PLUGIN_STATE_MAX_CHANNELS 16
+
+// Each impulse response slot is stored under its own state key. The first
+// slot uses the original "state" key so that existing sessions still load.
+#define PLUGIN_STATE_NUM_SLOTS 2
+
 // The plugin state version is stored from version 2 and onwards.
 // This makes it possible to have backwards compatible plugin states.
 // Unfortunately, this was not included in the first version, so this is
@@ -21,8 +32,7 @@ typedef struct {
     uint32_t ir_bit_depth;
     uint32_t fft_block_size;
     char filename[PLUGIN_STATE_FILENAME_LENGTH];
-    float *ir_left;
-    float *ir_right;
+    float *ir[PLUGIN_STATE_MAX_CHANNELS]; // ir_num_channels are allocated, the rest are NULL
 } plugin_state_t;
 
 int plugin_state_init(plugin_state_t *state, const char *filename);
@@ -30,6 +40,10 @@ int plugin_state_init_dirac(plugin_state_t *state, uint32_t sample_rate_Hz);
 int plugin_state_reset(plugin_state_t *state, bool free_buffers, bool dirac_impulse_response);
 int plugin_state_free(plugin_state_t *state);
 int plugin_state_serialize(plugin_state_t *state, char **output, uint32_t *length);
+// The state is only written when the input is valid, and its previous
+// channels are not freed.
 int plugin_state_deserialize(plugin_state_t *state, char *input, uint32_t length);
+const char *plugin_state_key(uint32_t slot);
+int plugin_state_slot_from_key(const char *key);
 
 #endif
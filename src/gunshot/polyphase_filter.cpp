@@ -0,0 +1,214 @@
+#include "polyphase_filter.hpp"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace fftconvolver;
+
+// Kaiser window shape. About 80 dB stopband attenuation.
+#define POLYPHASE_KAISER_BETA 8.0
+
+// Cutoff relative to the Nyquist frequency of the lower rate. The transition
+// band ends before the first alias of the passband.
+#define POLYPHASE_CUTOFF 0.9
+
+// Zeroth order modified Bessel function of the first kind
+static double besselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; ++k) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < 1e-12 * sum) {
+            break;
+        }
+    }
+    return sum;
+}
+
+// Adds branch j times x[k - j] to output k for k in [0, len). Blocks of
+// outputs are kept in registers over all the taps of the branch instead of
+// being loaded and stored once per tap.
+#define POLYPHASE_BLOCK 8
+
+static void FilterBranch(const float* x, const float* branch, float* output, size_t len)
+{
+    size_t k = 0;
+    for (; k + POLYPHASE_BLOCK <= len; k += POLYPHASE_BLOCK) {
+        float sum[POLYPHASE_BLOCK] = {0.0f};
+        for (size_t j = 0; j < POLYPHASE_TAPS_PER_PHASE; ++j) {
+            const float tap = branch[j];
+            const float* xj = x + k - j;
+            for (size_t b = 0; b < POLYPHASE_BLOCK; ++b) {
+                sum[b] += tap * xj[b];
+            }
+        }
+        for (size_t b = 0; b < POLYPHASE_BLOCK; ++b) {
+            output[k + b] += sum[b];
+        }
+    }
+    for (; k < len; ++k) {
+        float sum = 0.0f;
+        for (size_t j = 0; j < POLYPHASE_TAPS_PER_PHASE; ++j) {
+            sum += branch[j] * x[k - j];
+        }
+        output[k] += sum;
+    }
+}
+
+void PolyphaseLowpass(size_t factor, std::vector<float>& taps)
+{
+    const size_t len = POLYPHASE_TAPS_PER_PHASE * factor - 1;
+    const double center = 0.5 * (len - 1);
+    const double cutoff = POLYPHASE_CUTOFF * 0.5 / factor; // Cycles per sample
+
+    std::vector<double> h(len);
+    double sum = 0.0;
+    for (size_t i = 0; i < len; ++i) {
+        const double t = i - center;
+        const double sinc = (t == 0.0) ? 2.0 * cutoff : sin(2.0 * M_PI * cutoff * t) / (M_PI * t);
+        const double r = t / center;
+        const double window = besselI0(POLYPHASE_KAISER_BETA * sqrt(1.0 - r * r)) / besselI0(POLYPHASE_KAISER_BETA);
+        h[i] = sinc * window;
+        sum += h[i];
+    }
+
+    taps.resize(len);
+    for (size_t i = 0; i < len; ++i) {
+        taps[i] = (float)(h[i] / sum);
+    }
+}
+
+PolyphaseDecimator::PolyphaseDecimator() :
+    _factor(1),
+    _maxLen(0),
+    _branches(),
+    _streams()
+{
+}
+
+void PolyphaseDecimator::init(size_t factor, size_t maxLen)
+{
+    _factor = factor;
+    _maxLen = maxLen / factor;
+    std::vector<float> taps;
+    PolyphaseLowpass(factor, taps);
+    _branches.assign(factor * POLYPHASE_TAPS_PER_PHASE, 0.0f);
+    for (size_t r = 0; r < factor; ++r) {
+        for (size_t j = 0; j < POLYPHASE_TAPS_PER_PHASE; ++j) {
+            const size_t i = r + j * factor;
+            _branches[r * POLYPHASE_TAPS_PER_PHASE + j] = (i < taps.size()) ? taps[i] : 0.0f;
+        }
+    }
+    _streams.assign(factor * (POLYPHASE_TAPS_PER_PHASE - 1 + _maxLen), 0.0f);
+}
+
+void PolyphaseDecimator::reset()
+{
+    std::fill(_streams.begin(), _streams.end(), 0.0f);
+}
+
+void PolyphaseDecimator::process(const Sample* input, Sample* output, size_t len)
+{
+    const size_t history = POLYPHASE_TAPS_PER_PHASE - 1;
+    const size_t streamLen = history + _maxLen;
+    const size_t outLen = len / _factor;
+
+    // Split the input into one stream per phase: stream q holds the input
+    // samples n * factor + q.
+    for (size_t q = 0; q < _factor; ++q) {
+        float* stream = _streams.data() + q * streamLen + history;
+        for (size_t n = 0; n < outLen; ++n) {
+            stream[n] = input[n * _factor + q];
+        }
+    }
+
+    // Output m = sum over taps i = j * factor + r of tap i times input
+    // (m - j) * factor + factor - 1 - r, i.e. branch r filters stream
+    // factor - 1 - r.
+    memset(output, 0, outLen * sizeof(Sample));
+    for (size_t r = 0; r < _factor; ++r) {
+        const float* stream = _streams.data() + (_factor - 1 - r) * streamLen + history;
+        FilterBranch(stream, _branches.data() + r * POLYPHASE_TAPS_PER_PHASE, output, outLen);
+    }
+
+    for (size_t q = 0; q < _factor; ++q) {
+        float* stream = _streams.data() + q * streamLen;
+        memmove(stream, stream + outLen, history * sizeof(float));
+    }
+}
+
+size_t PolyphaseDecimator::getDelay() const
+{
+    return (POLYPHASE_TAPS_PER_PHASE * _factor - 2) / 2;
+}
+
+size_t PolyphaseDecimator::getBufferBytes() const
+{
+    return (_branches.size() + _streams.size()) * sizeof(float);
+}
+
+PolyphaseInterpolator::PolyphaseInterpolator() :
+    _factor(1),
+    _branches(),
+    _buffer(),
+    _phase()
+{
+}
+
+void PolyphaseInterpolator::init(size_t factor, size_t maxLen)
+{
+    std::vector<float> taps;
+    PolyphaseLowpass(factor, taps);
+
+    // The gain of the factor makes up for the energy of the skipped zeros.
+    _factor = factor;
+    _branches.assign(factor * POLYPHASE_TAPS_PER_PHASE, 0.0f);
+    for (size_t r = 0; r < factor; ++r) {
+        for (size_t j = 0; j < POLYPHASE_TAPS_PER_PHASE; ++j) {
+            const size_t i = r + j * factor;
+            _branches[r * POLYPHASE_TAPS_PER_PHASE + j] = (i < taps.size()) ? factor * taps[i] : 0.0f;
+        }
+    }
+    _buffer.assign(POLYPHASE_TAPS_PER_PHASE - 1 + maxLen, 0.0f);
+    _phase.assign(maxLen, 0.0f);
+}
+
+void PolyphaseInterpolator::reset()
+{
+    std::fill(_buffer.begin(), _buffer.end(), 0.0f);
+}
+
+void PolyphaseInterpolator::process(const Sample* input, Sample* output, size_t len)
+{
+    const size_t history = POLYPHASE_TAPS_PER_PHASE - 1;
+    float* z = _buffer.data() + history;
+    float* phase = _phase.data();
+    memcpy(z, input, len * sizeof(Sample));
+
+    // Output k * factor + r = sum over j of tap (r + j * factor) times
+    // input k - j. Each phase is calculated for the whole block by branch r
+    // and then interleaved into the output.
+    for (size_t r = 0; r < _factor; ++r) {
+        const float* branch = _branches.data() + r * POLYPHASE_TAPS_PER_PHASE;
+        memset(phase, 0, len * sizeof(float));
+        FilterBranch(z, branch, phase, len);
+        for (size_t k = 0; k < len; ++k) {
+            output[k * _factor + r] = phase[k];
+        }
+    }
+
+    memmove(_buffer.data(), _buffer.data() + len, history * sizeof(float));
+}
+
+size_t PolyphaseInterpolator::getDelay() const
+{
+    return (POLYPHASE_TAPS_PER_PHASE * _factor - 2) / 2;
+}
+
+size_t PolyphaseInterpolator::getBufferBytes() const
+{
+    return (_branches.size() + _buffer.size() + _phase.size()) * sizeof(float);
+}
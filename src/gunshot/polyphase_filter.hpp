@@ -0,0 +1,80 @@
+#ifndef POLYPHASE_FILTER_H
+#define POLYPHASE_FILTER_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "fftconvolver/Utilities.h"
+
+// Largest supported rate change
+#define POLYPHASE_MAX_FACTOR 4
+
+// Filter taps per polyphase branch. The lowpass prototype has
+// POLYPHASE_TAPS_PER_PHASE * factor - 1 taps.
+#define POLYPHASE_TAPS_PER_PHASE 64
+
+// Linear phase lowpass prototype for changing the sample rate by an integer
+// factor: a Kaiser-windowed sinc with the cutoff just below the Nyquist
+// frequency of the lower rate and unity gain at DC. The filter delay is
+// (taps - 1) / 2 samples.
+void PolyphaseLowpass(size_t factor, std::vector<float>& taps);
+
+// Lowers the sample rate by an integer factor. Only the retained output
+// samples are calculated: the input is split into one stream per phase and
+// each stream is filtered by its branch of the prototype at the low rate.
+// Output m is the filtered input at sample m * factor + factor - 1, so each
+// group of factor input samples gives one output sample.
+class PolyphaseDecimator
+{
+public:
+    PolyphaseDecimator();
+
+    // maxLen is the longest block passed to process()
+    void init(size_t factor, size_t maxLen);
+    void reset();
+
+    // len must be a multiple of the factor. Writes len / factor samples.
+    void process(const fftconvolver::Sample* input, fftconvolver::Sample* output, size_t len);
+
+    size_t getDelay() const;
+    size_t getBufferBytes() const;
+
+private:
+    size_t _factor;
+    size_t _maxLen;             // At the low rate
+    std::vector<float> _branches; // Taps r + j * factor of the prototype per phase r
+    std::vector<float> _streams; // Per phase: previous input followed by the current block
+
+    PolyphaseDecimator(const PolyphaseDecimator&);
+    PolyphaseDecimator& operator=(const PolyphaseDecimator&);
+};
+
+// Raises the sample rate by an integer factor. Each output phase has its own
+// branch of the prototype, so zeros are never inserted or multiplied. Input
+// sample k is placed at output sample k * factor before filtering.
+class PolyphaseInterpolator
+{
+public:
+    PolyphaseInterpolator();
+
+    // maxLen is the longest block passed to process(), at the low rate
+    void init(size_t factor, size_t maxLen);
+    void reset();
+
+    // Writes len * factor samples.
+    void process(const fftconvolver::Sample* input, fftconvolver::Sample* output, size_t len);
+
+    size_t getDelay() const;
+    size_t getBufferBytes() const;
+
+private:
+    size_t _factor;
+    std::vector<float> _branches; // Branch r holds taps r, r + factor, ... times factor
+    std::vector<float> _buffer;   // Previous input followed by the current block
+    std::vector<float> _phase;    // One output phase of the current block
+
+    PolyphaseInterpolator(const PolyphaseInterpolator&);
+    PolyphaseInterpolator& operator=(const PolyphaseInterpolator&);
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "render_detector.h"
+
+static void _clear_window(render_detector_t *detector)
+{
+    detector->window_audio_s = 0.0;
+    detector->window_wall_s = 0.0;
+}
+
+void render_detector_init(render_detector_t *detector)
+{
+    _clear_window(detector);
+
+    detector->last_block_s = -1.0;
+    detector->fast_windows = 0;
+    detector->slow_windows = 0;
+    detector->offline = 0;
+}
+
+int render_detector_add(render_detector_t *detector, double now_s, uint32_t frames, float sample_rate_Hz)
+{
+    double elapsed_s = now_s - detector->last_block_s;
+    detector->last_block_s = now_s;
+
+    // The wall-clock time of a block is only known when the next one
+    // starts, so each block is paired with the time since the previous one.
+    if (elapsed_s < 0.0 || elapsed_s > 1.0) {
+        _clear_window(detector);
+        return detector->offline;
+    }
+    detector->window_wall_s += elapsed_s;
+    detector->window_audio_s += frames / sample_rate_Hz;
+
+    if (detector->window_audio_s >= 0.5) {
+        if (detector->window_audio_s > RENDER_DETECTOR_FAST_SPEED * detector->window_wall_s) {
+            detector->fast_windows++;
+            detector->slow_windows = 0;
+        }
+        else if (detector->window_audio_s <= RENDER_DETECTOR_SLOW_SPEED * detector->window_wall_s) {
+            detector->slow_windows++;
+            detector->fast_windows = 0;
+        }
+        else {
+            detector->fast_windows = 0;
+            detector->slow_windows = 0;
+        }
+
+        if (detector->fast_windows >= RENDER_DETECTOR_FAST_WINDOWS) {
+            detector->offline = 1;
+        }
+        if (detector->slow_windows >= RENDER_DETECTOR_SLOW_WINDOWS) {
+            detector->offline = 0;
+        }
+        _clear_window(detector);
+    }
+    return detector->offline;
+}
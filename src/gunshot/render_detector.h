@@ -0,0 +1,48 @@
+#ifndef RENDER_DETECTOR_H
+#define RENDER_DETECTOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Detects offline rendering from the pace of the audio thread.
+//
+// Plugins are not told when the host renders offline, but a host that plays
+// live can never process faster than real time, while exports usually do.
+// The audio time of the blocks is compared with the wall-clock time between
+// them over windows of about half a second. A window that runs more than
+// RENDER_DETECTOR_FAST_SPEED times faster than real time counts as fast and
+// one that runs at most RENDER_DETECTOR_SLOW_SPEED times as fast counts as
+// slow. RENDER_DETECTOR_FAST_WINDOWS fast windows in a row switch to offline,
+// and RENDER_DETECTOR_SLOW_WINDOWS slow windows in a row switch back. The
+// windows in between count as neither and break either run, so a live host
+// that catches up after a stall, or that runs a little ahead of real time,
+// does not flip the mode back and forth. A gap of more than a second between
+// blocks, e.g. while the host is stopped, starts over.
+
+#define RENDER_DETECTOR_FAST_SPEED 4.0
+#define RENDER_DETECTOR_SLOW_SPEED 1.5
+#define RENDER_DETECTOR_FAST_WINDOWS 4
+#define RENDER_DETECTOR_SLOW_WINDOWS 2
+
+typedef struct {
+    double last_block_s;  // Wall-clock time of the last block, < 0 if none
+    double window_audio_s;
+    double window_wall_s;
+    uint32_t fast_windows;
+    uint32_t slow_windows;
+    int offline;
+} render_detector_t;
+
+void render_detector_init(render_detector_t *detector);
+
+// Adds a block that started at now_s (wall-clock time in seconds) and returns
+// 1 while rendering is considered offline, otherwise 0.
+int render_detector_add(render_detector_t *detector, double now_s, uint32_t frames, float sample_rate_Hz);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
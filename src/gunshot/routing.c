@@ -0,0 +1,107 @@
+#include "routing.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+// Channel k of the impulse response connects input k and output k, wrapping
+// around whichever side has fewer channels. With as many inputs as outputs
+// this is the diagonal, e.g. "0:0:0 1:1:1" for stereo.
+void routing_init_default(routing_t *routing, uint32_t num_inputs, uint32_t num_outputs)
+{
+    uint32_t k;
+    uint32_t num_routes = num_inputs > num_outputs ? num_inputs : num_outputs;
+
+    if (num_inputs == 0 || num_outputs == 0) {
+        num_routes = 0;
+    }
+    if (num_routes > ROUTING_MAX_ROUTES) {
+        num_routes = ROUTING_MAX_ROUTES;
+    }
+
+    for (k = 0; k < num_routes; k++) {
+        routing->routes[k].input = k % num_inputs;
+        routing->routes[k].output = k % num_outputs;
+        routing->routes[k].ir_channel = k;
+    }
+    routing->num_routes = num_routes;
+}
+
+static int _parse_number(const char **text, uint32_t *value)
+{
+    char *end;
+    unsigned long x;
+
+    if (!isdigit((unsigned char)**text)) {
+        return 1;
+    }
+    x = strtoul(*text, &end, 10);
+    if (x >= ROUTING_MAX_CHANNELS) {
+        return 1;
+    }
+    *value = (uint32_t)x;
+    *text = end;
+    return 0;
+}
+
+// The routing is only changed if the whole text is valid.
+int routing_parse(routing_t *routing, const char *text, uint32_t num_inputs, uint32_t num_outputs)
+{
+    routing_t result;
+    routing_route_t route;
+    uint32_t r;
+
+    result.num_routes = 0;
+    while (1) {
+        while (isspace((unsigned char)*text) || *text == ',') {
+            text++;
+        }
+        if (*text == '\0') {
+            break;
+        }
+
+        if (_parse_number(&text, &route.input) || *text++ != ':' ||
+            _parse_number(&text, &route.output) || *text++ != ':' ||
+            _parse_number(&text, &route.ir_channel)) {
+            return 1;
+        }
+        if (*text != '\0' && !isspace((unsigned char)*text) && *text != ',') {
+            return 1;
+        }
+        if (route.input >= num_inputs || route.output >= num_outputs) {
+            return 1;
+        }
+        for (r = 0; r < result.num_routes; r++) {
+            if (result.routes[r].input == route.input && result.routes[r].output == route.output) {
+                return 1;
+            }
+        }
+
+        result.routes[result.num_routes++] = route;
+    }
+
+    *routing = result;
+    return 0;
+}
+
+int routing_format(const routing_t *routing, char *text, uint32_t length)
+{
+    uint32_t r;
+    uint32_t n = 0;
+    int written;
+
+    if (length == 0) {
+        return 1;
+    }
+    text[0] = '\0';
+
+    for (r = 0; r < routing->num_routes; r++) {
+        const routing_route_t *route = &routing->routes[r];
+        written = snprintf(text + n, length - n, "%s%u:%u:%u", r > 0 ? " " : "",
+                           route->input, route->output, route->ir_channel);
+        if (written < 0 || (uint32_t)written >= length - n) {
+            return 1;
+        }
+        n += written;
+    }
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef ROUTING_H
+#define ROUTING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// Routing matrix from plugin inputs to plugin outputs.
+//
+// Each route convolves one input with one channel of the impulse response and
+// adds the result to one output. The text form, which is stored in the plugin
+// state under ROUTING_STATE_KEY, is a list of routes separated by spaces or
+// commas, each written as "input:output:ir_channel", e.g. "0:0:0 1:1:1" for
+// plain stereo. An input or output may appear in any number of routes,
+// but each input/output pair only once.
+//
+// The impulse response channel wraps around the number of channels stored in
+// the state, so a mono impulse response can be used with any routing.
+
+#define ROUTING_STATE_KEY "routing"
+#define ROUTING_MAX_CHANNELS 16
+#define ROUTING_MAX_ROUTES (ROUTING_MAX_CHANNELS * ROUTING_MAX_CHANNELS)
+#define ROUTING_TEXT_LENGTH (ROUTING_MAX_ROUTES * 9)
+
+typedef struct {
+    uint32_t input;
+    uint32_t output;
+    uint32_t ir_channel;
+} routing_route_t;
+
+typedef struct {
+    uint32_t num_routes;
+    routing_route_t routes[ROUTING_MAX_ROUTES];
+} routing_t;
+
+void routing_init_default(routing_t *routing, uint32_t num_inputs, uint32_t num_outputs);
+int routing_parse(routing_t *routing, const char *text, uint32_t num_inputs, uint32_t num_outputs);
+int routing_format(const routing_t *routing, char *text, uint32_t length);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
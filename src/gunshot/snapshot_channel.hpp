@@ -0,0 +1,59 @@
+#ifndef SNAPSHOT_CHANNEL_H
+#define SNAPSHOT_CHANNEL_H
+
+#include <stdint.h>
+#include <atomic>
+
+// Lock-free channel that hands the latest value of T from one producer thread
+// to one consumer thread (triple buffering).
+//
+// The producer writes complete values and the consumer always reads the
+// latest complete value, so it never sees a value that is half written.
+// Values that are written faster than they are read are skipped. Neither side
+// blocks or allocates, so the consumer can be the audio thread.
+template <typename T>
+class SnapshotChannel
+{
+public:
+    explicit SnapshotChannel(const T& initial) :
+        _writeIndex(0),
+        _middle(1),
+        _readIndex(2)
+    {
+        for (int i = 0; i < 3; ++i) {
+            _buffers[i] = initial;
+        }
+    }
+
+    // Producer side
+    void write(const T& value)
+    {
+        _buffers[_writeIndex] = value;
+        const uint32_t previous = _middle.exchange(_writeIndex | Fresh, std::memory_order_acq_rel);
+        _writeIndex = previous & IndexMask;
+    }
+
+    // Consumer side. The reference stays valid until the next call.
+    const T& read()
+    {
+        if (_middle.load(std::memory_order_relaxed) & Fresh) {
+            const uint32_t previous = _middle.exchange(_readIndex, std::memory_order_acq_rel);
+            _readIndex = previous & IndexMask;
+        }
+        return _buffers[_readIndex];
+    }
+
+private:
+    static const uint32_t IndexMask = 0x3;
+    static const uint32_t Fresh = 0x4; // The middle buffer has not been read
+
+    T _buffers[3];
+    uint32_t _writeIndex;
+    std::atomic<uint32_t> _middle;
+    uint32_t _readIndex;
+
+    SnapshotChannel(const SnapshotChannel&);
+    SnapshotChannel& operator=(const SnapshotChannel&);
+};
+
+#endif
@@ -52,7 +52,7 @@ int main(void)
     free(state_str);
 
     // Initialize convolution kernel
-    convolver.init(state.fft_block_size, (fftconvolver::Sample *)state.ir_left, state.ir_num_samples_per_channel);
+    convolver.init(state.fft_block_size, (fftconvolver::Sample *)state.ir[0], state.ir_num_samples_per_channel);
 
     // Generate test data
     for (int n = 0; n < 24000; n++) {
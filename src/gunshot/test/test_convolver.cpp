@@ -0,0 +1,520 @@
+// Compares the output of `Convolver` with a direct convolution.
+//
+// The impulse response is long enough to use all three stages, and the
+// convolver is run while the tail is still being loaded. Once loading has
+// finished (plus the latency of the tail stages), the output must match the
+// direct convolution.
+//
+// The test is run with a single impulse response, with two slots mixed with
+// different gains, with a second slot that ends within the first tail
+// block, with the impulse response cut and faded out by
+// setEnvelope(), with the output delayed by setDelay(), and with the
+// background stage split across worker threads.
+//
+// A second test stalls the background thread. The tail blocks it misses
+// must be counted and played as silence, so that the output is that of the
+// stages in the audio thread alone, and once the thread runs again the
+// blocks that were skipped must keep the tail in time with the input.
+//
+// A third test changes the head block size of a loaded convolver, see
+// Convolver::setHeadBlockSize(). Only the first tail stage may be
+// transformed again, and the output from then on must match the direct
+// convolution of the input that follows.
+//
+// A fourth test convolves the background stage at a half and a quarter of the
+// sample rate, see Convolver::setTailDecimation(). For input below the
+// cutoff of the rate conversion filters the output must match the full rate
+// convolution, and the spectra of the background stage must shrink by about
+// the factor.
+//
+// A fifth test runs several convolvers with worker groups from threads of
+// their own, so that they compete for the shared workers. Groups that find
+// the workers busy are multiplied by the calling thread, which must not
+// change the output by a single bit.
+//
+// A sixth test convolves the background stages in the calling thread, see
+// Convolver::setSynchronousTail(), at the full and a reduced rate and with
+// worker groups. The output must match that of the background thread bit
+// for bit.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "convolver.hpp"
+
+#define BUFFER_SIZE 100
+#define HEAD_BLOCK_SIZE 128
+#define TAIL_BLOCK_SIZE 1024
+#define IR_LENGTH 20000
+#define NUM_TEST_SAMPLES 80000
+#define TOLERANCE 1e-4
+
+// Envelope: cut on a partition boundary within the background stage
+#define ENVELOPE_LENGTH (9 * TAIL_BLOCK_SIZE)
+#define ENVELOPE_DECAY 2e-4
+
+// Delay: whole blocks of each stage plus a remainder
+#define DELAY (2 * TAIL_BLOCK_SIZE + 3 * HEAD_BLOCK_SIZE + 37)
+
+// Workers: the background stage has enough partitions for two groups
+#define WORKERS 2
+
+// Short second slot: no partitions in the background stage
+#define SHORT_IR_LENGTH (3 * TAIL_BLOCK_SIZE / 2 + 5)
+
+// Stall: samples processed before the background thread is woken. The head
+// and first tail block are the part of the impulse response that plays
+// without it.
+#define STALL_SAMPLES (NUM_TEST_SAMPLES / 2)
+#define AUDIO_THREAD_IR_LENGTH (2 * TAIL_BLOCK_SIZE)
+
+// Convolver whose background thread is not woken while it is stalled, as if
+// it did not get scheduled.
+class StalledConvolver : public Convolver
+{
+public:
+    StalledConvolver() : _stalled(true) {}
+
+    void release()
+    {
+        _stalled = false;
+        Convolver::startBackgroundProcessing();
+    }
+
+protected:
+    void startBackgroundProcessing() override
+    {
+        if (!_stalled) {
+            Convolver::startBackgroundProcessing();
+        }
+    }
+
+private:
+    bool _stalled;
+};
+
+// Head block sizes that the loaded convolver changes to
+#define NEW_HEAD_BLOCK_SIZES {HEAD_BLOCK_SIZE / 2, HEAD_BLOCK_SIZE * 2, TAIL_BLOCK_SIZE}
+
+// Decimated tail: tones of the input, in cycles per sample, below the
+// passband edge of the quarter rate, and the error allowed relative to the
+// peak of the output
+#define DECIMATION_TONES 8
+#define DECIMATION_MAX_FREQUENCY 0.08
+#define DECIMATION_TOLERANCE 1e-3
+
+// Shared pool: convolvers that run at once, each with WORKERS workers
+#define POOL_CONVOLVERS 4
+
+static double convolve_direct(const std::vector<float>& ir, size_t length, const std::vector<float>& x, uint32_t n)
+{
+    double y = 0.0;
+    for (uint32_t k = 0; k < length && k <= n; k++) {
+        y += (double)ir[k] * x[n - k];
+    }
+    return y;
+}
+
+static int run_test(uint32_t slot_count, size_t length, float decay, size_t delay, size_t workers,
+                    size_t second_length = IR_LENGTH)
+{
+    std::vector<float> ir[2];
+    std::vector<float> mixed(IR_LENGTH, 0.0f);
+    const float gains[2] = {0.3f, 0.7f};
+    std::vector<float> x(NUM_TEST_SAMPLES);
+    std::vector<float> y(NUM_TEST_SAMPLES);
+    const float *irs[2];
+    size_t ir_lengths[2];
+    uint32_t n;
+    uint32_t k;
+    uint32_t s;
+
+    srand(1);
+    for (s = 0; s < slot_count; s++) {
+        ir[s].resize((s == 1) ? second_length : IR_LENGTH);
+        for (n = 0; n < ir[s].size(); n++) {
+            ir[s][n] = exp(-4.0 * n / IR_LENGTH) * (2.0 * rand() / RAND_MAX - 1.0);
+        }
+        irs[s] = ir[s].data();
+        ir_lengths[s] = ir[s].size();
+    }
+    for (n = 0; n < NUM_TEST_SAMPLES; n++) {
+        x[n] = 2.0 * rand() / RAND_MAX - 1.0;
+    }
+
+    // The tail is waited for however long it takes, so that the result does
+    // not depend on how the threads are scheduled
+    Convolver convolver;
+    convolver.setTailWaitBudget(UINT64_MAX);
+    convolver.setMaxDelay(delay);
+    convolver.setTailWorkerCount(workers);
+    convolver.init(HEAD_BLOCK_SIZE, TAIL_BLOCK_SIZE, irs, ir_lengths, slot_count);
+    convolver.setEnvelope(length, decay);
+    convolver.setDelay(delay);
+
+    // Expected impulse response
+    for (s = 0; s < slot_count; s++) {
+        float gain = (slot_count > 1) ? gains[s] : 1.0f;
+        convolver.setSlotGain(s, gain);
+        for (n = 0; n < ir[s].size() && n < length; n++) {
+            mixed[n] += gain * exp(-decay * n) * ir[s][n];
+        }
+    }
+
+    // Process the first half while the tail may still be loading, then wait
+    // for the loader before processing the rest.
+    for (n = 0; n < NUM_TEST_SAMPLES / 2; n += BUFFER_SIZE) {
+        convolver.process(&x[n], &y[n], BUFFER_SIZE);
+    }
+    while (!convolver.isLoaded()) {
+        usleep(1000);
+    }
+    uint32_t loaded_at = n;
+    for (; n < NUM_TEST_SAMPLES; n += BUFFER_SIZE) {
+        convolver.process(&x[n], &y[n], BUFFER_SIZE);
+    }
+    uint64_t tail_misses = convolver.takeTailMisses();
+    if (tail_misses != 0) {
+        printf("Tail misses: %d\nFAILED\n", (int)tail_misses);
+        return 1;
+    }
+
+    // Compare with direct convolution after the last partition has seen a
+    // full block.
+    double max_error = 0.0;
+    for (n = loaded_at + 2 * TAIL_BLOCK_SIZE; n < NUM_TEST_SAMPLES; n++) {
+        double expected = 0.0;
+        for (k = 0; k < IR_LENGTH && k + delay <= n; k++) {
+            expected += (double)mixed[k] * x[n - delay - k];
+        }
+        double error = fabs(expected - y[n]);
+        if (error > max_error) {
+            max_error = error;
+        }
+    }
+
+    printf("Slots: %d, length: %d, second length: %d, decay: %g, delay: %d, workers: %d, max error: %g\n", slot_count,
+           (int)std::min(length, (size_t)IR_LENGTH), (int)second_length, decay, (int)delay, (int)workers, max_error);
+    if (max_error > TOLERANCE) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
+
+static int run_stall_test(void)
+{
+    std::vector<float> ir(IR_LENGTH);
+    std::vector<float> x(NUM_TEST_SAMPLES);
+    std::vector<float> y(NUM_TEST_SAMPLES);
+    uint32_t n;
+
+    srand(2);
+    double bound = 0.0;
+    for (n = 0; n < IR_LENGTH; n++) {
+        ir[n] = exp(-4.0 * n / IR_LENGTH) * (2.0 * rand() / RAND_MAX - 1.0);
+        bound += fabs(ir[n]);
+    }
+    for (n = 0; n < NUM_TEST_SAMPLES; n++) {
+        x[n] = 2.0 * rand() / RAND_MAX - 1.0;
+    }
+
+    // Late blocks are not waited for at all
+    StalledConvolver convolver;
+    convolver.setBackgroundLoading(false);
+    convolver.setTailWaitBudget(0);
+    convolver.init(HEAD_BLOCK_SIZE, TAIL_BLOCK_SIZE, ir.data(), IR_LENGTH);
+
+    for (n = 0; n < STALL_SAMPLES; n += BUFFER_SIZE) {
+        convolver.process(&x[n], &y[n], BUFFER_SIZE);
+    }
+
+    // Every tail block but the first one, which plays the silence before
+    // the first job, is missed.
+    const uint64_t expected_misses = STALL_SAMPLES / TAIL_BLOCK_SIZE - 1;
+    uint64_t tail_misses = convolver.takeTailMisses();
+    double max_error = 0.0;
+    for (n = 0; n < STALL_SAMPLES; n++) {
+        max_error = std::max(max_error, fabs(convolve_direct(ir, AUDIO_THREAD_IR_LENGTH, x, n) - y[n]));
+    }
+    printf("Stalled: tail misses: %d, max error: %g\n", (int)tail_misses, max_error);
+    if (tail_misses != expected_misses || max_error > TOLERANCE) {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    // Once the input that was skipped has left the impulse response, the
+    // output must match the direct convolution again.
+    convolver.release();
+    convolver.setTailWaitBudget(UINT64_MAX);
+    for (; n < NUM_TEST_SAMPLES; n += BUFFER_SIZE) {
+        convolver.process(&x[n], &y[n], BUFFER_SIZE);
+    }
+    tail_misses = convolver.takeTailMisses();
+    max_error = 0.0;
+    for (n = STALL_SAMPLES + IR_LENGTH + 2 * TAIL_BLOCK_SIZE; n < NUM_TEST_SAMPLES; n++) {
+        max_error = std::max(max_error, fabs(convolve_direct(ir, IR_LENGTH, x, n) - y[n]));
+    }
+    float peak = 0.0f;
+    for (n = 0; n < NUM_TEST_SAMPLES; n++) {
+        peak = std::max(peak, fabsf(y[n]));
+    }
+    printf("Released: tail misses: %d, max error: %g, peak: %g, bound: %g\n", (int)tail_misses, max_error, peak, bound);
+    if (tail_misses != 0 || max_error > TOLERANCE || !(peak <= bound)) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void wait_until_loaded(const Convolver& convolver)
+{
+    while (!convolver.isLoaded()) {
+        usleep(1000);
+    }
+}
+
+static int run_head_block_size_test(void)
+{
+    std::vector<float> ir(IR_LENGTH);
+    std::vector<float> x(NUM_TEST_SAMPLES);
+    std::vector<float> y(NUM_TEST_SAMPLES);
+    const size_t head_block_sizes[] = NEW_HEAD_BLOCK_SIZES;
+    uint32_t n;
+
+    srand(4);
+    for (n = 0; n < IR_LENGTH; n++) {
+        ir[n] = exp(-4.0 * n / IR_LENGTH) * (2.0 * rand() / RAND_MAX - 1.0);
+    }
+    for (n = 0; n < NUM_TEST_SAMPLES; n++) {
+        x[n] = 2.0 * rand() / RAND_MAX - 1.0;
+    }
+
+    Convolver convolver;
+    convolver.setTailWaitBudget(UINT64_MAX);
+    convolver.init(HEAD_BLOCK_SIZE, TAIL_BLOCK_SIZE, ir.data(), IR_LENGTH);
+    wait_until_loaded(convolver);
+    const size_t loaded = convolver.takeLoadedPartitions();
+    for (n = 0; n < NUM_TEST_SAMPLES / 2; n += BUFFER_SIZE) {
+        convolver.process(&x[n], &y[n], BUFFER_SIZE);
+    }
+
+    for (size_t head_block_size : head_block_sizes) {
+        if (!convolver.setHeadBlockSize(head_block_size)) {
+            printf("Head block size %d: rejected\nFAILED\n", (int)head_block_size);
+            return 1;
+        }
+        wait_until_loaded(convolver);
+        const size_t reloaded = convolver.takeLoadedPartitions();
+
+        // The convolver continues from silence
+        for (n = 0; n < NUM_TEST_SAMPLES / 2; n += BUFFER_SIZE) {
+            convolver.process(&x[n], &y[n], BUFFER_SIZE);
+        }
+        uint64_t tail_misses = convolver.takeTailMisses();
+        double max_error = 0.0;
+        for (n = 0; n < NUM_TEST_SAMPLES / 2; n++) {
+            max_error = std::max(max_error, fabs(convolve_direct(ir, IR_LENGTH, x, n) - y[n]));
+        }
+        printf("Head block size %d: partitions loaded %d of %d, tail misses: %d, max error: %g\n",
+               (int)head_block_size, (int)reloaded, (int)loaded, (int)tail_misses, max_error);
+        if (reloaded != TAIL_BLOCK_SIZE / head_block_size || tail_misses != 0 || max_error > TOLERANCE) {
+            printf("FAILED\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Convolves band-limited input with the background stage at 1/factor of the
+// sample rate, without threads. Returns the spectrum bytes of the convolver.
+static size_t run_decimated(size_t factor, const std::vector<float>& ir, size_t length, const std::vector<float>& x,
+                            std::vector<float>& y)
+{
+    Convolver convolver;
+    convolver.setBackgroundLoading(false);
+    convolver.setSynchronousTail(true);
+    convolver.setTailDecimation(factor);
+    convolver.init(HEAD_BLOCK_SIZE, TAIL_BLOCK_SIZE, ir.data(), length);
+    for (uint32_t n = 0; n < NUM_TEST_SAMPLES; n += BUFFER_SIZE) {
+        convolver.process(&x[n], &y[n], BUFFER_SIZE);
+    }
+    return convolver.getSpectrumBytes();
+}
+
+static int run_decimation_test(size_t factor)
+{
+    std::vector<float> ir(IR_LENGTH);
+    std::vector<float> x(NUM_TEST_SAMPLES, 0.0f);
+    std::vector<float> y(NUM_TEST_SAMPLES);
+    uint32_t n;
+
+    srand(3);
+    for (n = 0; n < IR_LENGTH; n++) {
+        ir[n] = exp(-4.0 * n / IR_LENGTH) * (2.0 * rand() / RAND_MAX - 1.0);
+    }
+    for (int t = 0; t < DECIMATION_TONES; t++) {
+        const double frequency = DECIMATION_MAX_FREQUENCY * rand() / RAND_MAX;
+        const double phase = 2.0 * M_PI * rand() / RAND_MAX;
+        for (n = 0; n < NUM_TEST_SAMPLES; n++) {
+            x[n] += sin(2.0 * M_PI * frequency * n + phase) / DECIMATION_TONES;
+        }
+    }
+
+    // Spectra of the stages in the audio thread alone, and of the whole
+    // convolver at the full and at the reduced rate
+    const size_t early_bytes = run_decimated(1, ir, AUDIO_THREAD_IR_LENGTH, x, y);
+    const size_t full_bytes = run_decimated(1, ir, IR_LENGTH, x, y);
+    const size_t bytes = run_decimated(factor, ir, IR_LENGTH, x, y);
+
+    // The start of the input is not band-limited, so it is compared once
+    // the start has left the impulse response
+    double max_error = 0.0;
+    double peak = 0.0;
+    for (n = IR_LENGTH + 2 * TAIL_BLOCK_SIZE; n < NUM_TEST_SAMPLES; n++) {
+        const double expected = convolve_direct(ir, IR_LENGTH, x, n);
+        max_error = std::max(max_error, fabs(expected - y[n]));
+        peak = std::max(peak, fabs(expected));
+    }
+
+    // The first tail stage grows by a few partitions to cover the delay of
+    // the rate conversion filters
+    const double late_ratio = (double)(bytes - early_bytes) / (full_bytes - early_bytes);
+    printf("Tail decimation: %d, max error: %g, peak: %g, background stage spectra: %.2f of full rate\n", (int)factor,
+           max_error, peak, late_ratio);
+    if (max_error > DECIMATION_TOLERANCE * peak || late_ratio * factor > 1.25) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
+
+// Convolves with the background stages at 1/factor of the sample rate, split
+// into worker groups, either in the background thread or in the calling
+// thread. Returns the number of tail misses.
+static uint64_t run_tail_mode(bool synchronous, size_t factor, const std::vector<float>& ir,
+                              const std::vector<float>& x, std::vector<float>& y)
+{
+    Convolver convolver;
+    convolver.setBackgroundLoading(false);
+    convolver.setTailWaitBudget(UINT64_MAX);
+    convolver.setSynchronousTail(synchronous);
+    convolver.setTailDecimation(factor);
+    convolver.setTailWorkerCount(WORKERS);
+    convolver.init(HEAD_BLOCK_SIZE, TAIL_BLOCK_SIZE, ir.data(), IR_LENGTH);
+    for (uint32_t n = 0; n < NUM_TEST_SAMPLES; n += BUFFER_SIZE) {
+        convolver.process(&x[n], &y[n], BUFFER_SIZE);
+    }
+    return convolver.takeTailMisses();
+}
+
+static int run_synchronous_test(size_t factor)
+{
+    std::vector<float> ir(IR_LENGTH);
+    std::vector<float> x(NUM_TEST_SAMPLES);
+    std::vector<float> background(NUM_TEST_SAMPLES);
+    std::vector<float> synchronous(NUM_TEST_SAMPLES);
+    uint32_t n;
+
+    srand(5);
+    for (n = 0; n < IR_LENGTH; n++) {
+        ir[n] = exp(-4.0 * n / IR_LENGTH) * (2.0 * rand() / RAND_MAX - 1.0);
+    }
+    for (n = 0; n < NUM_TEST_SAMPLES; n++) {
+        x[n] = 2.0 * rand() / RAND_MAX - 1.0;
+    }
+
+    const uint64_t tail_misses = run_tail_mode(false, factor, ir, x, background);
+    run_tail_mode(true, factor, ir, x, synchronous);
+    const bool same = memcmp(synchronous.data(), background.data(), NUM_TEST_SAMPLES * sizeof(float)) == 0;
+    printf("Synchronous tail: decimation: %d, workers: %d, tail misses: %d, %s\n", (int)factor, WORKERS,
+           (int)tail_misses, same ? "same output" : "output differs");
+    if (tail_misses != 0 || !same) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void run_partitioned(PartitionedConvolver* convolver, const std::vector<float>* x, std::vector<float>* y)
+{
+    for (size_t n = 0; n < x->size(); n += BUFFER_SIZE) {
+        convolver->process(&(*x)[n], &(*y)[n], BUFFER_SIZE);
+    }
+}
+
+static int run_shared_pool_test(void)
+{
+    std::vector<float> ir(IR_LENGTH);
+    std::vector<float> x(NUM_TEST_SAMPLES);
+    std::vector<float> y[POOL_CONVOLVERS + 1];
+    PartitionedConvolver convolvers[POOL_CONVOLVERS + 1];
+    std::thread threads[POOL_CONVOLVERS];
+    uint32_t n;
+    uint32_t c;
+
+    srand(3);
+    for (n = 0; n < IR_LENGTH; n++) {
+        ir[n] = exp(-4.0 * n / IR_LENGTH) * (2.0 * rand() / RAND_MAX - 1.0);
+    }
+    for (n = 0; n < NUM_TEST_SAMPLES; n++) {
+        x[n] = 2.0 * rand() / RAND_MAX - 1.0;
+    }
+
+    for (c = 0; c <= POOL_CONVOLVERS; c++) {
+        PartitionedConvolver& convolver = convolvers[c];
+        convolver.setWorkerCount(WORKERS);
+        convolver.init(HEAD_BLOCK_SIZE, IR_LENGTH);
+        for (n = 0; n < convolver.getPartitionCount(); n++) {
+            convolver.loadPartition(0, 0, ir.data(), IR_LENGTH, n);
+        }
+        convolver.publishPartitions(convolver.getPartitionCount());
+        y[c].resize(NUM_TEST_SAMPLES);
+    }
+
+    // The first convolver has the workers to itself
+    run_partitioned(&convolvers[0], &x, &y[0]);
+    for (c = 0; c < POOL_CONVOLVERS; c++) {
+        threads[c] = std::thread(run_partitioned, &convolvers[c + 1], &x, &y[c + 1]);
+    }
+    for (c = 0; c < POOL_CONVOLVERS; c++) {
+        threads[c].join();
+    }
+
+    int err = 0;
+    for (c = 1; c <= POOL_CONVOLVERS; c++) {
+        if (memcmp(y[c].data(), y[0].data(), NUM_TEST_SAMPLES * sizeof(float)) != 0) {
+            printf("Shared pool: convolver %d differs\n", (int)c);
+            err = 1;
+        }
+    }
+    printf("Shared pool: %d convolvers, workers: %d\n", POOL_CONVOLVERS, WORKERS);
+    if (err) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    if (run_test(1, SIZE_MAX, 0.0f, 0, 0) || run_test(2, SIZE_MAX, 0.0f, 0, 0) ||
+        run_test(1, ENVELOPE_LENGTH, ENVELOPE_DECAY, 0, 0) || run_test(2, ENVELOPE_LENGTH, ENVELOPE_DECAY, 0, 0) ||
+        run_test(2, SIZE_MAX, 0.0f, DELAY, 0) || run_test(1, ENVELOPE_LENGTH, ENVELOPE_DECAY, DELAY, 0) ||
+        run_test(1, SIZE_MAX, 0.0f, 0, WORKERS) || run_test(2, SIZE_MAX, 0.0f, DELAY, WORKERS) ||
+        run_test(2, SIZE_MAX, 0.0f, 0, 0, SHORT_IR_LENGTH) || run_stall_test() ||
+        run_head_block_size_test() || run_decimation_test(2) || run_decimation_test(4) || run_shared_pool_test() ||
+        run_synchronous_test(1) || run_synchronous_test(2)) {
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,267 @@
+// Opens well-formed, truncated and malformed impulse response files.
+//
+// Each container (WAV, RF64, W64, AIFF and AIFF-C) is written once as a
+// valid file, which must be read back sample for sample, and then broken in
+// the ways a damaged or hostile file can be: cut short within a chunk
+// header or body, with chunk sizes beyond the end of the file, and with
+// sizes that overflow when they are added up. Broken files must be
+// rejected, or opened with the data clipped to the end of the file, without
+// reading outside of it or walking the chunks forever.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+#include "ir_file.hpp"
+
+#define FILENAME "test_ir_file.tmp"
+#define NUM_CHANNELS 2
+#define NUM_FRAMES 10
+#define SAMPLE_RATE_Hz 48000
+
+typedef std::vector<uint8_t> bytes_t;
+
+static const uint8_t W64_GUID_RIFF[16] = {'r', 'i', 'f', 'f', 0x2e, 0x91, 0xcf, 0x11, 0xa5, 0xd6, 0x28, 0xdb, 0x04, 0xc1, 0x00, 0x00};
+static const uint8_t W64_GUID_WAVE[16] = {'w', 'a', 'v', 'e', 0xf3, 0xac, 0xd3, 0x11, 0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a};
+static const uint8_t W64_GUID_FMT[16]  = {'f', 'm', 't', ' ', 0xf3, 0xac, 0xd3, 0x11, 0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a};
+static const uint8_t W64_GUID_DATA[16] = {'d', 'a', 't', 'a', 0xf3, 0xac, 0xd3, 0x11, 0x8c, 0xd1, 0x00, 0xc0, 0x4f, 0x8e, 0xdb, 0x8a};
+
+static void put(bytes_t &b, const void *p, size_t size)
+{
+    b.insert(b.end(), (const uint8_t *)p, (const uint8_t *)p + size);
+}
+
+static void put16le(bytes_t &b, uint16_t x) { b.push_back(x & 0xff); b.push_back(x >> 8); }
+static void put16be(bytes_t &b, uint16_t x) { b.push_back(x >> 8); b.push_back(x & 0xff); }
+static void put32le(bytes_t &b, uint32_t x) { put16le(b, x & 0xffff); put16le(b, x >> 16); }
+static void put32be(bytes_t &b, uint32_t x) { put16be(b, x >> 16); put16be(b, x & 0xffff); }
+static void put64le(bytes_t &b, uint64_t x) { put32le(b, (uint32_t)x); put32le(b, (uint32_t)(x >> 32)); }
+
+static int16_t get_sample(uint32_t c, uint32_t n)
+{
+    return (int16_t)(1000 * (c + 1) * ((int)n - NUM_FRAMES / 2));
+}
+
+// 16 bit PCM frames, in the byte order of the container
+static bytes_t frames(bool big_endian)
+{
+    bytes_t b;
+    for (uint32_t n = 0; n < NUM_FRAMES; n++) {
+        for (uint32_t c = 0; c < NUM_CHANNELS; c++) {
+            if (big_endian) {
+                put16be(b, (uint16_t)get_sample(c, n));
+            }
+            else {
+                put16le(b, (uint16_t)get_sample(c, n));
+            }
+        }
+    }
+    return b;
+}
+
+static bytes_t wave_fmt(void)
+{
+    bytes_t b;
+    put16le(b, 1); // PCM
+    put16le(b, NUM_CHANNELS);
+    put32le(b, SAMPLE_RATE_Hz);
+    put32le(b, SAMPLE_RATE_Hz * NUM_CHANNELS * 2);
+    put16le(b, NUM_CHANNELS * 2);
+    put16le(b, 16);
+    return b;
+}
+
+static void riff_chunk(bytes_t &b, const char *id, const bytes_t &body, uint32_t size)
+{
+    put(b, id, 4);
+    put32le(b, size);
+    put(b, body.data(), body.size());
+    if (body.size() & 1) {
+        b.push_back(0);
+    }
+}
+
+static bytes_t wav(bool rf64, uint32_t fmt_size, uint32_t data_size, bool junk)
+{
+    bytes_t b;
+    put(b, rf64 ? "RF64" : "RIFF", 4);
+    put32le(b, rf64 ? 0xffffffff : 0);
+    put(b, "WAVE", 4);
+    if (rf64) {
+        bytes_t ds64;
+        put64le(ds64, 0);
+        put64le(ds64, NUM_FRAMES * NUM_CHANNELS * 2);
+        put64le(ds64, NUM_FRAMES);
+        put32le(ds64, 0);
+        riff_chunk(b, "ds64", ds64, (uint32_t)ds64.size());
+    }
+    if (junk) {
+        riff_chunk(b, "JUNK", bytes_t(4), 0xffffffff);
+    }
+    riff_chunk(b, "fmt ", wave_fmt(), fmt_size);
+    riff_chunk(b, "data", frames(false), rf64 ? 0xffffffff : data_size);
+    return b;
+}
+
+static void w64_chunk(bytes_t &b, const uint8_t *guid, const bytes_t &body, uint64_t size)
+{
+    put(b, guid, 16);
+    put64le(b, size);
+    put(b, body.data(), body.size());
+    while (b.size() % 8) {
+        b.push_back(0);
+    }
+}
+
+static bytes_t w64(uint64_t fmt_size, uint64_t data_size)
+{
+    bytes_t b;
+    put(b, W64_GUID_RIFF, 16);
+    put64le(b, 0);
+    put(b, W64_GUID_WAVE, 16);
+    w64_chunk(b, W64_GUID_FMT, wave_fmt(), fmt_size);
+    w64_chunk(b, W64_GUID_DATA, frames(false), data_size);
+    return b;
+}
+
+static bytes_t aiff(bool aifc, uint32_t comm_size, uint32_t ssnd_offset)
+{
+    bytes_t b;
+    put(b, "FORM", 4);
+    put32be(b, 0);
+    put(b, aifc ? "AIFC" : "AIFF", 4);
+
+    // 48000 Hz as 80 bit extended precision
+    const uint8_t rate[10] = {0x40, 0x0e, 0xbb, 0x80, 0, 0, 0, 0, 0, 0};
+    bytes_t comm;
+    put16be(comm, NUM_CHANNELS);
+    put32be(comm, NUM_FRAMES);
+    put16be(comm, 16);
+    put(comm, rate, sizeof(rate));
+    if (aifc) {
+        put(comm, "NONE", 4);
+    }
+    put(b, "COMM", 4);
+    put32be(b, comm_size);
+    put(b, comm.data(), comm.size());
+
+    bytes_t ssnd;
+    put32be(ssnd, ssnd_offset);
+    put32be(ssnd, 0);
+    bytes_t data = frames(true);
+    put(ssnd, data.data(), data.size());
+    put(b, "SSND", 4);
+    put32be(b, (uint32_t)ssnd.size());
+    put(b, ssnd.data(), ssnd.size());
+    return b;
+}
+
+// Opens @a b cut to @a size bytes. A file that opens must hold
+// @a expected_frames frames of the test signal.
+static int check(const char *name, const bytes_t &b, size_t size, bool valid, uint64_t expected_frames)
+{
+    FILE *f = fopen(FILENAME, "wb");
+    if (f == NULL || fwrite(b.data(), 1, size, f) != size) {
+        printf("%s: could not write test file\n", name);
+        return 1;
+    }
+    fclose(f);
+
+    ir_file_t file;
+    if (ir_file_open(&file, FILENAME)) {
+        if (valid) {
+            printf("%s: not opened\n", name);
+            return 1;
+        }
+        return 0;
+    }
+    if (!valid) {
+        printf("%s: opened\n", name);
+        ir_file_close(&file);
+        return 1;
+    }
+
+    int err = 0;
+    if (file.num_channels != NUM_CHANNELS || file.sample_rate_Hz != SAMPLE_RATE_Hz ||
+        file.num_samples_per_channel != expected_frames) {
+        printf("%s: %u channels, %u Hz, %llu frames\n", name, file.num_channels, file.sample_rate_Hz,
+               (unsigned long long)file.num_samples_per_channel);
+        err = 1;
+    }
+    else if (expected_frames > 0) {
+        std::vector<float> x[NUM_CHANNELS];
+        float *channels[NUM_CHANNELS];
+        double energy[NUM_CHANNELS];
+        for (uint32_t c = 0; c < NUM_CHANNELS; c++) {
+            x[c].resize(expected_frames);
+            channels[c] = x[c].data();
+        }
+        err = ir_file_read(&file, channels, NUM_CHANNELS, energy);
+        for (uint32_t c = 0; c < NUM_CHANNELS && !err; c++) {
+            for (uint32_t n = 0; n < expected_frames; n++) {
+                if (x[c][n] != get_sample(c, n) / 32768.0f) {
+                    printf("%s: channel %u, sample %u: %g\n", name, c, n, x[c][n]);
+                    err = 1;
+                    break;
+                }
+            }
+        }
+    }
+    ir_file_close(&file);
+    return err;
+}
+
+int main(void)
+{
+    const uint32_t data_bytes = NUM_FRAMES * NUM_CHANNELS * 2;
+    int err = 0;
+
+    // WAV
+    bytes_t b = wav(false, 16, data_bytes, false);
+    err |= check("WAV", b, b.size(), true, NUM_FRAMES);
+    err |= check("WAV, data cut short", b, b.size() - 4 * 3, true, NUM_FRAMES - 3);
+    err |= check("WAV, data chunk larger than the file", wav(false, 16, 0x7fffffff, false), b.size(), true, NUM_FRAMES);
+    err |= check("WAV, cut in the fmt header", b, 12 + 6, false, 0);
+    err |= check("WAV, cut in the fmt body", b, 12 + 8 + 10, false, 0);
+    err |= check("WAV, fmt chunk larger than the file", wav(false, 0xfffffff0, data_bytes, false), 12 + 8 + 16, false, 0);
+    err |= check("WAV, fmt too small", wav(false, 12, data_bytes, false), b.size(), false, 0);
+    b = wav(false, 16, data_bytes, true);
+    err |= check("WAV, chunk past the end", b, b.size(), false, 0);
+
+    // RF64
+    b = wav(true, 16, 0, false);
+    err |= check("RF64", b, b.size(), true, NUM_FRAMES);
+    err |= check("RF64, cut in the ds64 body", b, 12 + 8 + 12, false, 0);
+    err |= check("RF64, data cut short", b, b.size() - 4, true, NUM_FRAMES - 1);
+
+    // W64
+    b = w64(24 + 16, 24 + data_bytes);
+    err |= check("W64", b, b.size(), true, NUM_FRAMES);
+    err |= check("W64, data cut short", b, b.size() - 4 * 2, true, NUM_FRAMES - 2);
+    err |= check("W64, cut in the fmt header", b, 40 + 20, false, 0);
+    err |= check("W64, cut in the fmt body", b, 40 + 24 + 8, false, 0);
+    err |= check("W64, chunk size below its header", w64(8, 24 + data_bytes), b.size(), false, 0);
+    err |= check("W64, chunk size wraps around", w64(UINT64_MAX - 3, 24 + data_bytes), b.size(), false, 0);
+    err |= check("W64, data size wraps around", w64(24 + 16, UINT64_MAX), b.size(), true, NUM_FRAMES);
+
+    // AIFF and AIFF-C
+    b = aiff(false, 18, 0);
+    err |= check("AIFF", b, b.size(), true, NUM_FRAMES);
+    err |= check("AIFF, data cut short", b, b.size() - 4, true, NUM_FRAMES - 1);
+    err |= check("AIFF, cut in the COMM body", b, 12 + 8 + 10, false, 0);
+    err |= check("AIFF, SSND offset past the end", aiff(false, 18, 0x7fffffff), b.size(), false, 0);
+    err |= check("AIFF, cut in the SSND header", b, b.size() - data_bytes - 4, false, 0);
+    b = aiff(true, 22, 0);
+    err |= check("AIFF-C", b, b.size(), true, NUM_FRAMES);
+    err |= check("AIFF-C, cut in the compression type", b, 12 + 8 + 20, false, 0);
+
+    remove(FILENAME);
+    if (err) {
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
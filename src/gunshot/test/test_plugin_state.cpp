@@ -0,0 +1,154 @@
+// Loads valid and invalid plugin states.
+//
+// A valid state is loaded first. Then states that are cut short, that hold
+// no channels or more than PLUGIN_STATE_MAX_CHANNELS, no samples, fewer
+// samples than the header says, or a length that overflows 32 bits must be
+// rejected without touching the loaded state: the same channels, with the
+// same samples, must still be in place afterwards.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "plugin_state.hpp"
+
+extern "C" {
+#include "base64/base64.h"
+}
+
+#define NUM_CHANNELS 3
+#define NUM_SAMPLES 5
+#define SAMPLE_RATE_Hz 48000
+#define HEADER_LENGTH (6 * 4 + PLUGIN_STATE_FILENAME_LENGTH)
+
+typedef std::vector<uint8_t> bytes_t;
+
+static void put32le(bytes_t &b, uint32_t x)
+{
+    for (int i = 0; i < 4; i++) {
+        b.push_back((x >> (8 * i)) & 0xff);
+    }
+}
+
+static float get_sample(uint32_t c, uint32_t n, float offset)
+{
+    return offset + 1000.0f * c + n;
+}
+
+// Serialized state with @a num_data_samples samples of data after the
+// header, whatever the header says
+static bytes_t state_bytes(uint32_t version, uint32_t num_channels, uint32_t num_samples,
+                           uint32_t num_data_samples, float offset)
+{
+    bytes_t b;
+    put32le(b, version);
+    put32le(b, SAMPLE_RATE_Hz);
+    put32le(b, num_channels);
+    put32le(b, num_samples);
+    put32le(b, 24);
+    put32le(b, 1024);
+    char filename[PLUGIN_STATE_FILENAME_LENGTH] = {0};
+    snprintf(filename, sizeof(filename), "%g.wav", offset);
+    b.insert(b.end(), filename, filename + sizeof(filename));
+    for (uint32_t k = 0; k < num_data_samples; k++) {
+        float x = get_sample(k / num_samples, k % num_samples, offset);
+        uint32_t u;
+        memcpy(&u, &x, 4);
+        put32le(b, u);
+    }
+    return b;
+}
+
+static int deserialize(plugin_state_t *state, const bytes_t &b)
+{
+    std::vector<uint8_t> text(b64e_size((unsigned int)b.size()) + 1);
+    unsigned int length = b64_encode(b.data(), (unsigned int)b.size(), text.data());
+    return plugin_state_deserialize(state, (char *)text.data(), length);
+}
+
+static int check_loaded(const char *name, const plugin_state_t *state, uint32_t num_channels, float offset)
+{
+    if (state->ir_num_channels != num_channels || state->ir_num_samples_per_channel != NUM_SAMPLES ||
+        state->ir_sample_rate_Hz != SAMPLE_RATE_Hz) {
+        printf("%s: %u channels, %u samples, %u Hz\n", name, state->ir_num_channels,
+               state->ir_num_samples_per_channel, state->ir_sample_rate_Hz);
+        return 1;
+    }
+    for (uint32_t c = 0; c < PLUGIN_STATE_MAX_CHANNELS; c++) {
+        if ((c < num_channels) != (state->ir[c] != NULL)) {
+            printf("%s: channel %u is %s\n", name, c, (state->ir[c] != NULL) ? "allocated" : "missing");
+            return 1;
+        }
+    }
+    for (uint32_t c = 0; c < num_channels; c++) {
+        for (uint32_t n = 0; n < NUM_SAMPLES; n++) {
+            if (state->ir[c][n] != get_sample(c, n, offset)) {
+                printf("%s: channel %u, sample %u: %g\n", name, c, n, state->ir[c][n]);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// The state must be rejected and leave the loaded one as it was
+static int check_rejected(const char *name, plugin_state_t *state, const bytes_t &b)
+{
+    const plugin_state_t loaded = *state;
+    if (deserialize(state, b) == 0) {
+        printf("%s: loaded\n", name);
+        return 1;
+    }
+    if (memcmp(&loaded, state, sizeof(loaded)) != 0) {
+        printf("%s: the loaded state was changed\n", name);
+        return 1;
+    }
+    return check_loaded(name, state, NUM_CHANNELS, 0.0f);
+}
+
+int main(void)
+{
+    const uint32_t num_data_samples = NUM_CHANNELS * NUM_SAMPLES;
+    plugin_state_t state;
+    int err = 0;
+
+    if (deserialize(&state, state_bytes(PLUGIN_STATE_VERSION, NUM_CHANNELS, NUM_SAMPLES, num_data_samples, 0.0f))) {
+        printf("Valid state: not loaded\n");
+        return 1;
+    }
+    err |= check_loaded("Valid state", &state, NUM_CHANNELS, 0.0f);
+
+    bytes_t b = state_bytes(PLUGIN_STATE_VERSION, NUM_CHANNELS, NUM_SAMPLES, num_data_samples, 1.0f);
+    err |= check_rejected("Cut in the header", &state, bytes_t(b.begin(), b.begin() + HEADER_LENGTH - 4));
+    err |= check_rejected("Cut in the samples", &state, bytes_t(b.begin(), b.end() - 4));
+    err |= check_rejected("No channels", &state, state_bytes(PLUGIN_STATE_VERSION, 0, NUM_SAMPLES, 0, 1.0f));
+    err |= check_rejected("Too many channels", &state,
+                          state_bytes(PLUGIN_STATE_VERSION, PLUGIN_STATE_MAX_CHANNELS + 1, NUM_SAMPLES,
+                                      (PLUGIN_STATE_MAX_CHANNELS + 1) * NUM_SAMPLES, 1.0f));
+    err |= check_rejected("No samples", &state, state_bytes(PLUGIN_STATE_VERSION, NUM_CHANNELS, 0, 0, 1.0f));
+    err |= check_rejected("Length overflows", &state,
+                          state_bytes(PLUGIN_STATE_VERSION, PLUGIN_STATE_MAX_CHANNELS, 0x40000000, num_data_samples, 1.0f));
+    err |= check_rejected("Version 2 with one channel of data", &state,
+                          state_bytes(2, 1, NUM_SAMPLES, NUM_SAMPLES, 1.0f));
+
+    // Version 2 always holds two channels, whatever the header says
+    plugin_state_t v2;
+    if (deserialize(&v2, state_bytes(2, 1, NUM_SAMPLES, 2 * NUM_SAMPLES, 2.0f))) {
+        printf("Version 2: not loaded\n");
+        err = 1;
+    }
+    else {
+        err |= check_loaded("Version 2", &v2, 2, 2.0f);
+        plugin_state_free(&v2);
+    }
+
+    plugin_state_free(&state);
+    if (err) {
+        return 1;
+    }
+
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,205 @@
+// Switches the quality tier of the plugin while its reverb rings.
+//
+// The first test feeds the render detector blocks at steady paces and checks
+// its hysteresis: a host that runs a few times faster than real time, but
+// not RENDER_DETECTOR_FAST_SPEED times, must never count as offline, a fast
+// one only after RENDER_DETECTOR_FAST_WINDOWS windows, and an offline render
+// must stay offline until the pace drops to about real time.
+//
+// The second test plays an impulse in Eco with the render mode set to Live,
+// and switches to HQ while the reverb rings. The HQ engine is built in the
+// background, so the test keeps processing silence until the plugin reports
+// HQ in use, and then plays a second impulse. The Eco reverb must ring out
+// as if nothing had happened, on top of the HQ response to the second
+// impulse: the output must match an Eco render of the first impulse plus an
+// HQ render of the second one. The impulse response is shorter than two tail
+// blocks, so the whole convolution runs in run() and the output does not
+// depend on thread timing.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
+#include "headless_host.hpp"
+#include "render_detector.h"
+
+#define SAMPLE_RATE_Hz 48000
+#define IR_SAMPLE_RATE_Hz 44100
+#define IR_LENGTH 11025
+#define BUFFER_SIZE 256
+#define NUM_FRAMES 24000
+#define SWITCH_FRAME 2048
+#define BUILD_WAIT_us 100000
+#define BUILD_TIMEOUT_TRIES 100
+#define TOLERANCE 1e-5
+
+#define QUALITY_ECO 0
+#define QUALITY_HQ 1
+
+typedef std::vector<float> signal_t;
+
+// Feeds @a seconds of audio in blocks that run @a speed times faster than
+// real time, starting at @a now_s, and returns the last result.
+static int feed(render_detector_t *detector, double *now_s, double speed, double seconds)
+{
+    const uint32_t frames = 512;
+    const double block_s = (double)frames / SAMPLE_RATE_Hz;
+    int offline = 0;
+    for (double t = 0.0; t < seconds; t += block_s) {
+        offline = render_detector_add(detector, *now_s, frames, SAMPLE_RATE_Hz);
+        *now_s += block_s / speed;
+    }
+    return offline;
+}
+
+static int run_detector_test(void)
+{
+    const double window_s = 0.5;
+    render_detector_t detector;
+    double now_s = 100.0;
+
+    render_detector_init(&detector);
+    if (feed(&detector, &now_s, 3.0, 10.0)) {
+        printf("Render detector: offline at 3 times real time\nFAILED\n");
+        return 1;
+    }
+    if (feed(&detector, &now_s, 8.0, (RENDER_DETECTOR_FAST_WINDOWS - 1) * window_s)) {
+        printf("Render detector: offline after %d fast windows\nFAILED\n", RENDER_DETECTOR_FAST_WINDOWS - 1);
+        return 1;
+    }
+    if (!feed(&detector, &now_s, 8.0, 2 * window_s)) {
+        printf("Render detector: not offline at 8 times real time\nFAILED\n");
+        return 1;
+    }
+    if (!feed(&detector, &now_s, 2.0, 10.0)) {
+        printf("Render detector: back to live at 2 times real time\nFAILED\n");
+        return 1;
+    }
+    if (feed(&detector, &now_s, 1.0, (RENDER_DETECTOR_SLOW_WINDOWS + 1) * window_s)) {
+        printf("Render detector: still offline at real time\nFAILED\n");
+        return 1;
+    }
+    printf("Render detector: OK\n");
+    return 0;
+}
+
+static HeadlessHost *new_host(const signal_t &ir, int quality)
+{
+    HeadlessHost *host = new HeadlessHost(SAMPLE_RATE_Hz, BUFFER_SIZE);
+    host->setParameter("render", RENDER_LIVE);
+    host->setParameter("quality", quality);
+    host->setParameter("dry", -1000.0f);
+    if (host->loadImpulseResponse(0, ir.data(), ir.data(), IR_LENGTH, IR_SAMPLE_RATE_Hz)) {
+        printf("Could not load the impulse response\n");
+        delete host;
+        return nullptr;
+    }
+    return host;
+}
+
+// Processes @a frames of the left input from @a offset, with a silent right
+// input, and stores the left output.
+static void process(HeadlessHost *host, const signal_t &x, signal_t &y, uint32_t offset, uint32_t frames)
+{
+    signal_t right_in(frames, 0.0f);
+    signal_t right_out(frames);
+    const float *inputs[2] = { &x[offset], right_in.data() };
+    float *outputs[2] = { &y[offset], right_out.data() };
+    host->run(inputs, outputs, frames);
+}
+
+// Output for an impulse at the first frame
+static int render(const signal_t &ir, int quality, signal_t &y)
+{
+    HeadlessHost *host = new_host(ir, quality);
+    if (host == nullptr) {
+        return 1;
+    }
+    signal_t x(NUM_FRAMES, 0.0f);
+    x[0] = 1.0f;
+    y.assign(NUM_FRAMES, 0.0f);
+    process(host, x, y, 0, NUM_FRAMES);
+    delete host;
+    return 0;
+}
+
+static int run_switch_test(void)
+{
+    signal_t ir(IR_LENGTH);
+    uint32_t seed = 1;
+    for (uint32_t n = 0; n < IR_LENGTH; n++) {
+        seed = seed * 1664525u + 1013904223u;
+        ir[n] = expf(-6.9f * n / IR_LENGTH) * ((float)(seed >> 8) / (1 << 23) - 1.0f);
+    }
+
+    signal_t eco;
+    signal_t hq;
+    if (render(ir, QUALITY_ECO, eco) || render(ir, QUALITY_HQ, hq)) {
+        printf("FAILED\n");
+        return 1;
+    }
+    double peak = 0.0;
+    double tier_difference = 0.0;
+    for (uint32_t n = 0; n < NUM_FRAMES; n++) {
+        peak = std::max(peak, (double)fabsf(hq[n]));
+        tier_difference = std::max(tier_difference, (double)fabsf(hq[n] - eco[n]));
+    }
+
+    HeadlessHost *host = new_host(ir, QUALITY_ECO);
+    if (host == nullptr) {
+        printf("FAILED\n");
+        return 1;
+    }
+    signal_t x(NUM_FRAMES, 0.0f);
+    signal_t y(NUM_FRAMES, 0.0f);
+    x[0] = 1.0f;
+    process(host, x, y, 0, SWITCH_FRAME);
+    const float quality_before = host->getParameter("quality_used");
+
+    // The Eco reverb rings on while the HQ engine is built
+    host->setParameter("quality", QUALITY_HQ);
+    uint32_t n = SWITCH_FRAME;
+    for (int tries = 0; tries < BUILD_TIMEOUT_TRIES && host->getParameter("quality_used") != QUALITY_HQ; tries++) {
+        usleep(BUILD_WAIT_us);
+        process(host, x, y, n, BUFFER_SIZE);
+        n += BUFFER_SIZE;
+    }
+    const uint32_t second_impulse = n;
+    if (host->getParameter("quality_used") != QUALITY_HQ || second_impulse + IR_LENGTH > NUM_FRAMES) {
+        printf("Switch: HQ not in use after %d frames\nFAILED\n", (int)(second_impulse - SWITCH_FRAME));
+        delete host;
+        return 1;
+    }
+    x[second_impulse] = 1.0f;
+    process(host, x, y, second_impulse, NUM_FRAMES - second_impulse);
+    delete host;
+
+    double max_error = 0.0;
+    for (n = 0; n < NUM_FRAMES; n++) {
+        double expected = eco[n];
+        if (n >= second_impulse) {
+            expected += hq[n - second_impulse];
+        }
+        max_error = std::max(max_error, fabs(y[n] - expected));
+    }
+    printf("Switch: at frame %d, second impulse at %d, max error: %g, Eco and HQ differ by: %g, peak: %g\n",
+           SWITCH_FRAME, (int)second_impulse, max_error, tier_difference, peak);
+    if (quality_before != QUALITY_ECO || max_error > TOLERANCE * peak || tier_difference < 10.0 * TOLERANCE * peak) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(void)
+{
+    if (run_detector_test() || run_switch_test()) {
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,202 @@
+// Benchmark of GunShotPlugin::run() through the headless host.
+//
+// Sweeps sample rates, block sizes and impulse response lengths and prints
+// one JSON object per combination with the time spent in run(). The impulse
+// response is decaying noise generated at the host sample rate. Loading and
+// resampling happen before the timing starts, so only run() is measured.
+//
+// Usage: gunshot-bench [-d SECONDS] [-s RATES] [-b SIZES] [-l LENGTHS]
+// where the lists are comma separated, e.g. -b 64,256 -l 0.5,2.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+
+#include "headless_host.hpp"
+
+#define DEFAULT_DURATION_S 5.0
+
+static const double default_sample_rates[] = {44100.0, 48000.0, 88200.0, 96000.0, 192000.0};
+static const double default_block_sizes[] = {16, 32, 64, 128, 256, 512, 1024, 2048, 4096};
+static const double default_ir_lengths_s[] = {0.01, 0.1, 0.5, 1.0, 2.0, 5.0, 10.0, 20.0};
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: gunshot-bench [-d SECONDS] [-s RATES] [-b SIZES] [-l LENGTHS]\n"
+        "\n"
+        "  -d SECONDS  audio processed per combination (default: %g)\n"
+        "  -s RATES    sample rates in Hz (default: 44100 to 192000)\n"
+        "  -b SIZES    block sizes in frames (default: 16 to 4096)\n"
+        "  -l LENGTHS  impulse response lengths in seconds (default: 0.01 to 20)\n"
+        "\n"
+        "Lists are comma separated. The result is written to stdout as JSON.\n",
+        DEFAULT_DURATION_S);
+}
+
+static int parse_list(const char *s, std::vector<double> &list)
+{
+    char *end;
+
+    list.clear();
+    while (*s != '\0') {
+        double value = strtod(s, &end);
+        if (end == s || value <= 0.0) {
+            return 1;
+        }
+        list.push_back(value);
+        s = (*end == ',') ? end + 1 : end;
+    }
+    return list.empty() ? 1 : 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Deterministic white noise in [-1, 1).
+static float noise(uint32_t *seed)
+{
+    *seed = *seed * 1664525u + 1013904223u;
+    return (float)(*seed >> 8) / (1 << 23) - 1.0f;
+}
+
+static int run_benchmark(double sample_rate, uint32_t block_size, double ir_length_s, double duration_s, bool first)
+{
+    uint32_t n;
+    uint32_t seed = 1;
+
+    // Impulse response: exponentially decaying noise (-60 dB at the end)
+    uint32_t ir_length = (uint32_t)(ir_length_s * sample_rate);
+    if (ir_length < 1) {
+        ir_length = 1;
+    }
+    std::vector<float> ir_left(ir_length);
+    std::vector<float> ir_right(ir_length);
+    for (n = 0; n < ir_length; n++) {
+        float envelope = expf(-6.9f * n / ir_length);
+        ir_left[n] = envelope * noise(&seed);
+        ir_right[n] = envelope * noise(&seed);
+    }
+
+    HeadlessHost host(sample_rate, block_size);
+    if (host.loadImpulseResponse(0, ir_left.data(), ir_right.data(), ir_length, (uint32_t)sample_rate)) {
+        return 1;
+    }
+
+    // Input: one block of noise, reused for every call
+    std::vector<float> in_left(block_size);
+    std::vector<float> in_right(block_size);
+    std::vector<float> out_left(block_size);
+    std::vector<float> out_right(block_size);
+    for (n = 0; n < block_size; n++) {
+        in_left[n] = noise(&seed);
+        in_right[n] = noise(&seed);
+    }
+    const float *inputs[2] = {in_left.data(), in_right.data()};
+    float *outputs[2] = {out_left.data(), out_right.data()};
+
+    // Warm up for one second so that caches and the background thread are in
+    // a steady state, then time each call.
+    uint32_t num_warmup_blocks = (uint32_t)(sample_rate / block_size) + 1;
+    uint32_t num_blocks = (uint32_t)(duration_s * sample_rate / block_size) + 1;
+    std::vector<uint64_t> block_ns(num_blocks);
+
+    for (n = 0; n < num_warmup_blocks; n++) {
+        host.run(inputs, outputs, block_size);
+    }
+    for (n = 0; n < num_blocks; n++) {
+        uint64_t t0 = now_ns();
+        host.run(inputs, outputs, block_size);
+        block_ns[n] = now_ns() - t0;
+    }
+
+    uint64_t total_ns = 0;
+    for (n = 0; n < num_blocks; n++) {
+        total_ns += block_ns[n];
+    }
+    std::sort(block_ns.begin(), block_ns.end());
+
+    double frames = (double)num_blocks * block_size;
+    double audio_ns = frames / sample_rate * 1e9;
+
+    printf("%s\n  {\"sample_rate\": %.0f, \"block_size\": %u, \"ir_length_s\": %g, "
+           "\"ns_per_sample\": %.3f, \"realtime_factor\": %.2f, "
+           "\"block_us_p50\": %.3f, \"block_us_p99\": %.3f, \"block_us_max\": %.3f, "
+           "\"block_deadline_us\": %.3f}",
+           first ? "" : ",",
+           sample_rate, block_size, ir_length_s,
+           total_ns / frames,
+           audio_ns / total_ns,
+           block_ns[num_blocks / 2] / 1e3,
+           block_ns[(uint32_t)(0.99 * (num_blocks - 1))] / 1e3,
+           block_ns[num_blocks - 1] / 1e3,
+           block_size / sample_rate * 1e6);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    double duration_s = DEFAULT_DURATION_S;
+    std::vector<double> sample_rates(default_sample_rates, default_sample_rates + sizeof(default_sample_rates) / sizeof(double));
+    std::vector<double> block_sizes(default_block_sizes, default_block_sizes + sizeof(default_block_sizes) / sizeof(double));
+    std::vector<double> ir_lengths_s(default_ir_lengths_s, default_ir_lengths_s + sizeof(default_ir_lengths_s) / sizeof(double));
+
+    while ((opt = getopt(argc, argv, "d:s:b:l:h")) != -1) {
+        int err = 0;
+        switch (opt) {
+        case 'd':
+            duration_s = atof(optarg);
+            err = duration_s <= 0.0;
+            break;
+
+        case 's':
+            err = parse_list(optarg, sample_rates);
+            break;
+
+        case 'b':
+            err = parse_list(optarg, block_sizes);
+            break;
+
+        case 'l':
+            err = parse_list(optarg, ir_lengths_s);
+            break;
+
+        default:
+            err = 1;
+            break;
+        }
+        if (err) {
+            usage();
+            return 2;
+        }
+    }
+
+    bool first = true;
+    printf("[");
+    for (double sample_rate : sample_rates) {
+        for (double ir_length_s : ir_lengths_s) {
+            for (double block_size : block_sizes) {
+                if (run_benchmark(sample_rate, (uint32_t)block_size, ir_length_s, duration_s, first)) {
+                    fprintf(stderr, "Benchmark failed\n");
+                    return 1;
+                }
+                first = false;
+            }
+        }
+    }
+    printf("\n]\n");
+
+    return 0;
+}
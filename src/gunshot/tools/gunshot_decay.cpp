@@ -0,0 +1,183 @@
+// Benchmark of GunShotPlugin::run() on a decaying signal.
+//
+// The input is one second of noise that then fades out exponentially, so the
+// input, the tail of the convolution and the filter states pass through the
+// denormal range and end up at zero. The time spent in run() is reported per
+// window of audio. Without denormal protection the windows late in the decay
+// are many times slower than the first ones; with it the time is flat.
+//
+// Usage: gunshot-decay [-r RATE] [-b FRAMES] [-l SECONDS] [-f DB_PER_SECOND] [-d SECONDS] [-w SECONDS]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+
+#include "headless_host.hpp"
+
+#define DEFAULT_SAMPLE_RATE 48000.0
+#define DEFAULT_BUFFER_SIZE 256
+#define DEFAULT_IR_LENGTH_S 3.0
+#define DEFAULT_FADE_dB_PER_S 100.0
+#define DEFAULT_DURATION_S 20.0
+#define DEFAULT_WINDOW_S 0.5
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: gunshot-decay [-r RATE] [-b FRAMES] [-l SECONDS] [-f DB_PER_SECOND] [-d SECONDS] [-w SECONDS]\n"
+        "\n"
+        "  -r RATE           sample rate in Hz (default: %g)\n"
+        "  -b FRAMES         buffer size (default: %d)\n"
+        "  -l SECONDS        impulse response length (default: %g)\n"
+        "  -f DB_PER_SECOND  fade out rate of the input (default: %g)\n"
+        "  -d SECONDS        audio processed (default: %g)\n"
+        "  -w SECONDS        window length (default: %g)\n"
+        "\n"
+        "The result is written to stdout as JSON.\n",
+        DEFAULT_SAMPLE_RATE, DEFAULT_BUFFER_SIZE, DEFAULT_IR_LENGTH_S,
+        DEFAULT_FADE_dB_PER_S, DEFAULT_DURATION_S, DEFAULT_WINDOW_S);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Deterministic white noise in [-1, 1).
+static float noise(uint32_t *seed)
+{
+    *seed = *seed * 1664525u + 1013904223u;
+    return (float)(*seed >> 8) / (1 << 23) - 1.0f;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    uint32_t n;
+    uint32_t seed = 1;
+    double sample_rate = DEFAULT_SAMPLE_RATE;
+    uint32_t buffer_size = DEFAULT_BUFFER_SIZE;
+    double ir_length_s = DEFAULT_IR_LENGTH_S;
+    double fade_dB_per_s = DEFAULT_FADE_dB_PER_S;
+    double duration_s = DEFAULT_DURATION_S;
+    double window_s = DEFAULT_WINDOW_S;
+
+    while ((opt = getopt(argc, argv, "r:b:l:f:d:w:h")) != -1) {
+        int err = 0;
+        switch (opt) {
+        case 'r':
+            sample_rate = atof(optarg);
+            err = sample_rate <= 0.0;
+            break;
+        case 'b':
+            buffer_size = atoi(optarg);
+            err = buffer_size == 0;
+            break;
+        case 'l':
+            ir_length_s = atof(optarg);
+            err = ir_length_s <= 0.0;
+            break;
+        case 'f':
+            fade_dB_per_s = atof(optarg);
+            err = fade_dB_per_s <= 0.0;
+            break;
+        case 'd':
+            duration_s = atof(optarg);
+            err = duration_s <= 0.0;
+            break;
+        case 'w':
+            window_s = atof(optarg);
+            err = window_s <= 0.0;
+            break;
+        default:
+            err = 1;
+            break;
+        }
+        if (err) {
+            usage();
+            return 2;
+        }
+    }
+
+    // Impulse response: exponentially decaying noise (-60 dB at the end)
+    uint32_t ir_length = (uint32_t)(ir_length_s * sample_rate);
+    std::vector<float> ir_left(ir_length);
+    std::vector<float> ir_right(ir_length);
+    for (n = 0; n < ir_length; n++) {
+        float envelope = expf(-6.9f * n / ir_length);
+        ir_left[n] = envelope * noise(&seed);
+        ir_right[n] = envelope * noise(&seed);
+    }
+
+    HeadlessHost host(sample_rate, buffer_size);
+    if (host.loadImpulseResponse(0, ir_left.data(), ir_right.data(), ir_length, (uint32_t)sample_rate)) {
+        fprintf(stderr, "Could not load impulse response\n");
+        return 1;
+    }
+
+    // Both filters are enabled so that their states decay as well.
+    host.setParameter("highpass", 80.0f);
+    host.setParameter("lowpass", 8000.0f);
+
+    // Input: noise at full scale for one second, then an exponential fade.
+    // The fade is computed in double precision so that the input itself
+    // passes through the denormal range of float.
+    uint32_t total_length = (uint32_t)(duration_s * sample_rate);
+    std::vector<float> in_left(total_length);
+    std::vector<float> in_right(total_length);
+    for (n = 0; n < total_length; n++) {
+        double t_s = n / sample_rate;
+        double gain = t_s < 1.0 ? 1.0 : pow(10.0, -fade_dB_per_s * (t_s - 1.0) / 20.0);
+        in_left[n] = (float)(gain * noise(&seed));
+        in_right[n] = (float)(gain * noise(&seed));
+    }
+    std::vector<float> out_left(buffer_size);
+    std::vector<float> out_right(buffer_size);
+
+    uint32_t window_length = (uint32_t)(window_s * sample_rate);
+    uint32_t window_start = 0;
+    uint64_t window_ns = 0;
+    double min_ns_per_sample = 0.0;
+    double max_ns_per_sample = 0.0;
+    bool first = true;
+
+    printf("{\"sample_rate\": %.0f, \"buffer_size\": %u, \"ir_length_s\": %g, \"fade_dB_per_s\": %g,\n \"windows\": [",
+           sample_rate, buffer_size, ir_length_s, fade_dB_per_s);
+
+    for (uint32_t position = 0; position + buffer_size <= total_length; position += buffer_size) {
+        const float *inputs[2] = {&in_left[position], &in_right[position]};
+        float *outputs[2] = {out_left.data(), out_right.data()};
+
+        uint64_t t0 = now_ns();
+        host.run(inputs, outputs, buffer_size);
+        window_ns += now_ns() - t0;
+
+        uint32_t window_frames = position + buffer_size - window_start;
+        if (window_frames >= window_length) {
+            double t_s = window_start / sample_rate;
+            double input_dB = t_s < 1.0 ? 0.0 : -fade_dB_per_s * (t_s - 1.0);
+            double ns_per_sample = (double)window_ns / window_frames;
+            printf("%s\n  {\"time_s\": %.2f, \"input_dB\": %.1f, \"ns_per_sample\": %.3f}",
+                   first ? "" : ",", t_s, input_dB, ns_per_sample);
+
+            if (first || ns_per_sample < min_ns_per_sample) {
+                min_ns_per_sample = ns_per_sample;
+            }
+            if (first || ns_per_sample > max_ns_per_sample) {
+                max_ns_per_sample = ns_per_sample;
+            }
+            first = false;
+            window_start = position + buffer_size;
+            window_ns = 0;
+        }
+    }
+
+    printf("\n ],\n \"max_over_min\": %.2f}\n", min_ns_per_sample > 0.0 ? max_ns_per_sample / min_ns_per_sample : 0.0);
+    return 0;
+}
@@ -0,0 +1,374 @@
+// Replays a scripted session on GunShotPlugin.
+//
+// The session file sets up the input and output files and lists timed
+// events: state changes, parameter automation and changes of the host sample
+// rate and buffer size. Audio is processed in buffer-sized blocks and events
+// are applied between blocks, like automation in a host. Every call into the
+// plugin is timed and written to an optional CSV trace.
+//
+// Usage: gunshot-host SESSION
+//
+// Session file example:
+//
+//     # Settings
+//     input guitar.wav
+//     output out.wav
+//     trace trace.csv
+//     buffersize 256
+//     length 12           # Seconds to render (default: input + tail)
+//
+//     # Events: @SECONDS COMMAND ARGUMENTS
+//     @0 state A cab.wav
+//     @0 param wet -6
+//     @2.5 param morph 1
+//     @4 state B room.wav
+//     @6 buffersize 64
+//     @8 samplerate 96000
+//     @10 routing 0:0:0,1:0:1   # Input:output:IR channel, see routing.h
+//
+// The sample rate starts at the rate of the input file.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "audiofile/AudioFile.h"
+#include "headless_host.hpp"
+#include "ir_file.hpp"
+
+#define DEFAULT_BUFFER_SIZE 256
+#define MAX_LINE_LENGTH 2048
+
+typedef enum {
+    EVENT_STATE,
+    EVENT_PARAM,
+    EVENT_SAMPLE_RATE,
+    EVENT_BUFFER_SIZE,
+    EVENT_ROUTING,
+} event_type_t;
+
+typedef struct {
+    double time_s;
+    event_type_t type;
+    uint32_t slot;
+    std::string name; // File name, parameter symbol or routing
+    double value;
+} event_t;
+
+typedef struct {
+    std::string input;
+    std::string output;
+    std::string trace;
+    uint32_t buffer_size;
+    double length_s; // Negative: input length plus the tail
+    std::vector<event_t> events;
+} session_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int parse_event(const char *time, const char *command, const char *arg1, const char *arg2, event_t *event)
+{
+    event->time_s = atof(time);
+    event->slot = 0;
+    event->value = 0.0;
+
+    if (strcmp(command, "state") == 0 && arg1 != NULL && arg2 != NULL) {
+        if (arg1[0] >= 'A' && arg1[0] < 'A' + PLUGIN_STATE_NUM_SLOTS && arg1[1] == '\0') {
+            event->slot = arg1[0] - 'A';
+        }
+        else {
+            return 1;
+        }
+        event->type = EVENT_STATE;
+        event->name = arg2;
+    }
+    else if (strcmp(command, "param") == 0 && arg1 != NULL && arg2 != NULL) {
+        event->type = EVENT_PARAM;
+        event->name = arg1;
+        event->value = atof(arg2);
+    }
+    else if (strcmp(command, "samplerate") == 0 && arg1 != NULL) {
+        event->type = EVENT_SAMPLE_RATE;
+        event->value = atof(arg1);
+        return event->value > 0.0 ? 0 : 1;
+    }
+    else if (strcmp(command, "buffersize") == 0 && arg1 != NULL) {
+        event->type = EVENT_BUFFER_SIZE;
+        event->value = atoi(arg1);
+        return event->value > 0.0 ? 0 : 1;
+    }
+    else if (strcmp(command, "routing") == 0 && arg1 != NULL) {
+        event->type = EVENT_ROUTING;
+        event->name = arg1;
+    }
+    else {
+        return 1;
+    }
+    return 0;
+}
+
+static int parse_session(const char *filename, session_t *session)
+{
+    char line[MAX_LINE_LENGTH];
+    uint32_t line_number = 0;
+
+    FILE *f = fopen(filename, "r");
+    if (f == NULL) {
+        fprintf(stderr, "%s: could not open file\n", filename);
+        return 1;
+    }
+
+    session->buffer_size = DEFAULT_BUFFER_SIZE;
+    session->length_s = -1.0;
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        char *words[4] = {NULL, NULL, NULL, NULL};
+        uint32_t num_words = 0;
+        for (char *word = strtok(line, " \t\r\n"); word != NULL && num_words < 4; word = strtok(NULL, " \t\r\n")) {
+            words[num_words++] = word;
+        }
+        if (num_words == 0) {
+            continue;
+        }
+
+        int err = 0;
+        if (words[0][0] == '@') {
+            event_t event;
+            err = parse_event(words[0] + 1, words[1] != NULL ? words[1] : "", words[2], words[3], &event);
+            if (!err) {
+                session->events.push_back(event);
+            }
+        }
+        else if (strcmp(words[0], "input") == 0 && num_words == 2) {
+            session->input = words[1];
+        }
+        else if (strcmp(words[0], "output") == 0 && num_words == 2) {
+            session->output = words[1];
+        }
+        else if (strcmp(words[0], "trace") == 0 && num_words == 2) {
+            session->trace = words[1];
+        }
+        else if (strcmp(words[0], "buffersize") == 0 && num_words == 2) {
+            session->buffer_size = atoi(words[1]);
+            err = session->buffer_size == 0;
+        }
+        else if (strcmp(words[0], "length") == 0 && num_words == 2) {
+            session->length_s = atof(words[1]);
+        }
+        else {
+            err = 1;
+        }
+
+        if (err) {
+            fprintf(stderr, "%s:%u: invalid line\n", filename, line_number);
+            fclose(f);
+            return 1;
+        }
+    }
+    fclose(f);
+
+    if (session->input.empty() || session->output.empty()) {
+        fprintf(stderr, "%s: input and output must be set\n", filename);
+        return 1;
+    }
+
+    // Events are applied in time order. Events at the same time keep the
+    // order of the file.
+    std::stable_sort(session->events.begin(), session->events.end(), [](const event_t &a, const event_t &b) {
+        return a.time_s < b.time_s;
+    });
+    return 0;
+}
+
+static int apply_event(HeadlessHost *host, const event_t *event)
+{
+    switch (event->type) {
+    case EVENT_STATE:
+        return host->loadImpulseResponse(event->slot, event->name.c_str());
+
+    case EVENT_PARAM:
+        return host->setParameter(event->name.c_str(), event->value);
+
+    case EVENT_SAMPLE_RATE:
+        host->setSampleRate(event->value);
+        return 0;
+
+    case EVENT_BUFFER_SIZE:
+        host->setBufferSize((uint32_t)event->value);
+        return 0;
+
+    case EVENT_ROUTING:
+        return host->setRouting(event->name.c_str());
+    }
+    return 1;
+}
+
+static const char *event_name(event_type_t type)
+{
+    switch (type) {
+    case EVENT_STATE:
+        return "setState";
+    case EVENT_PARAM:
+        return "setParameterValue";
+    case EVENT_SAMPLE_RATE:
+        return "sampleRateChanged";
+    case EVENT_BUFFER_SIZE:
+        return "bufferSizeChanged";
+    case EVENT_ROUTING:
+        return "setState";
+    }
+    return "";
+}
+
+// Applies an event and writes its timing to the trace.
+static void process_event(HeadlessHost *host, const event_t *event, double position_s, FILE *trace)
+{
+    uint64_t t0 = now_ns();
+    int err = apply_event(host, event);
+    uint64_t t1 = now_ns();
+
+    if (err) {
+        fprintf(stderr, "Event at %g s failed: %s %s\n", event->time_s, event_name(event->type), event->name.c_str());
+    }
+    if (trace != NULL) {
+        fprintf(trace, "%.6f,%s,0,%.3f,", position_s, event_name(event->type), (t1 - t0) / 1e3);
+        if (event->type == EVENT_STATE || event->type == EVENT_PARAM || event->type == EVENT_ROUTING) {
+            fprintf(trace, "%s", event->name.c_str());
+        }
+        if (event->type != EVENT_STATE && event->type != EVENT_ROUTING) {
+            fprintf(trace, "%s%g", event->type == EVENT_PARAM ? "=" : "", event->value);
+        }
+        fprintf(trace, "\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int err;
+    session_t session;
+    ir_file_t input;
+    double energy[DISTRHO_PLUGIN_NUM_INPUTS];
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: gunshot-host SESSION\n");
+        return 2;
+    }
+    if (parse_session(argv[1], &session)) {
+        return 1;
+    }
+
+    err = ir_file_open(&input, session.input.c_str());
+    if (err) {
+        fprintf(stderr, "%s: could not open file\n", session.input.c_str());
+        return 1;
+    }
+
+    FILE *trace = NULL;
+    if (!session.trace.empty()) {
+        trace = fopen(session.trace.c_str(), "w");
+        if (trace == NULL) {
+            fprintf(stderr, "%s: could not open file\n", session.trace.c_str());
+            ir_file_close(&input);
+            return 1;
+        }
+        fprintf(trace, "position_s,call,frames,duration_us,detail\n");
+    }
+
+    HeadlessHost host(input.sample_rate_Hz, session.buffer_size);
+
+    // Apply the events at time zero first so that the tail length is known.
+    size_t next_event = 0;
+    while (next_event < session.events.size() && session.events[next_event].time_s <= 0.0) {
+        process_event(&host, &session.events[next_event++], 0.0, trace);
+    }
+
+    // The output has the length of the session at the input sample rate.
+    // Changing the host sample rate only changes what the plugin is told.
+    uint32_t input_length = (uint32_t)input.num_samples_per_channel;
+    uint32_t total_length = input_length + host.getTailLength();
+    if (session.length_s >= 0.0) {
+        total_length = (uint32_t)(session.length_s * input.sample_rate_Hz);
+    }
+    uint32_t buffer_length = total_length > input_length ? total_length : input_length;
+
+    AudioFile<float>::AudioBuffer in(DISTRHO_PLUGIN_NUM_INPUTS, std::vector<float>(buffer_length, 0.0f));
+    AudioFile<float>::AudioBuffer out(DISTRHO_PLUGIN_NUM_OUTPUTS, std::vector<float>(total_length, 0.0f));
+
+    float *in_channels[DISTRHO_PLUGIN_NUM_INPUTS];
+    for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_INPUTS; c++) {
+        in_channels[c] = in[c].data();
+    }
+    err = ir_file_read(&input, in_channels, DISTRHO_PLUGIN_NUM_INPUTS, energy);
+    uint32_t input_sample_rate = input.sample_rate_Hz;
+    ir_file_close(&input);
+    if (err) {
+        fprintf(stderr, "%s: could not read file\n", session.input.c_str());
+        return 1;
+    }
+
+    // Process the session block by block
+    uint32_t position = 0;
+    while (position < total_length) {
+        double position_s = (double)position / input_sample_rate;
+
+        while (next_event < session.events.size() && session.events[next_event].time_s <= position_s) {
+            process_event(&host, &session.events[next_event++], position_s, trace);
+        }
+
+        uint32_t frames = host.getBufferSize();
+        if (frames > total_length - position) {
+            frames = total_length - position;
+        }
+
+        const float *inputs[DISTRHO_PLUGIN_NUM_INPUTS];
+        float *outputs[DISTRHO_PLUGIN_NUM_OUTPUTS];
+        for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_INPUTS; c++) {
+            inputs[c] = in[c].data() + position;
+        }
+        for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_OUTPUTS; c++) {
+            outputs[c] = out[c].data() + position;
+        }
+
+        uint64_t t0 = now_ns();
+        host.run(inputs, outputs, frames);
+        uint64_t t1 = now_ns();
+        if (trace != NULL) {
+            fprintf(trace, "%.6f,run,%u,%.3f,\n", position_s, frames, (t1 - t0) / 1e3);
+        }
+
+        position += frames;
+    }
+
+    if (trace != NULL) {
+        fclose(trace);
+    }
+
+    // Write output file
+    AudioFile<float> output;
+    output.setAudioBuffer(out);
+    output.setBitDepth(32);
+    output.setSampleRate(input_sample_rate);
+    if (!output.save(session.output)) {
+        fprintf(stderr, "%s: could not write file\n", session.output.c_str());
+        return 1;
+    }
+
+    return 0;
+}
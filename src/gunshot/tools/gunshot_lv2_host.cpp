@@ -0,0 +1,751 @@
+// Minimal LV2 host for testing the LV2 build of GunShot without a DAW.
+//
+// The plugin binary and its ports are looked up in the bundle's Turtle files,
+// and the plugin is run the way an LV2 host runs it: with a worker thread
+// behind the worker:schedule feature, buffer size options and the state
+// interface. An impulse response given with -i is restored through the state
+// interface before processing starts. An impulse response given with -l is
+// sent to the plugin during processing the way the plugin UI sends it, as a
+// state message on the event input, so that it is prepared by the worker
+// while run() keeps being called, and the timing of both is reported.
+//
+// Usage: gunshot-lv2-host [options] BUNDLE INPUT OUTPUT
+//
+// Example, after building the plugin with make:
+//
+//     gunshot-lv2-host -r -i cab.wav -l room.wav -t 2 ../../../bin/gunshot.lv2 guitar.wav out.wav
+//
+// Without -r, blocks are processed as fast as possible, so run() may wait for
+// background tail work that would be done in time in a real-time host.
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lv2/lv2.h"
+#include "lv2/atom.h"
+#include "lv2/atom-util.h"
+#include "lv2/buf-size.h"
+#include "lv2/options.h"
+#include "lv2/parameters.h"
+#include "lv2/state.h"
+#include "lv2/urid.h"
+#include "lv2/worker.h"
+
+#include "audiofile/AudioFile.h"
+#include "ir_file.hpp"
+#include "plugin_state.hpp"
+
+#define DEFAULT_BUFFER_SIZE 256
+#define DEFAULT_LOAD_TIME_s 1.0
+#define MAX_PARAMETERS 16
+#define MAX_CHANNELS 16
+
+// Type of the state messages that DPF plugin UIs send to the DSP. The body
+// is the state key and value, each terminated by a null character.
+#define DPF_KEY_VALUE_STATE_URI "urn:distrho:KeyValueState"
+
+// DPF stores each state key of a plugin under this prefix.
+#define DPF_STATE_KEY_PREFIX "urn:distrho:"
+
+typedef struct {
+    char symbol[64];
+    float value;
+} parameter_t;
+
+typedef struct {
+    const char *ir_restore;
+    const char *ir_load;
+    double load_time_s;
+    uint32_t buffer_size;
+    bool real_time;
+    parameter_t parameters[MAX_PARAMETERS];
+    uint32_t num_parameters;
+    const char *bundle;
+    const char *input;
+    const char *output;
+} options_t;
+
+typedef struct {
+    uint32_t index;
+    std::string symbol;
+    bool is_input;
+    bool is_audio;
+    bool is_control;
+    bool is_atom;
+    float value;
+} port_t;
+
+typedef struct {
+    std::mutex mutex;
+    std::vector<std::string> uris;
+} urid_map_t;
+
+typedef struct {
+    LV2_Handle instance;
+    const LV2_Worker_Interface *worker_interface;
+
+    // Requests from schedule_work() and the responses of the worker. A real
+    // host uses lock-free ring buffers; here the audio thread only try-locks
+    // the responses so that run() never waits for the worker.
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::deque<std::vector<uint8_t>> requests;
+    std::deque<std::vector<uint8_t>> responses;
+    bool quit;
+
+    std::atomic<uint32_t> busy;
+    std::atomic<uint64_t> work_ns;
+} worker_t;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: gunshot-lv2-host [options] BUNDLE INPUT OUTPUT\n"
+        "\n"
+        "  -i FILE     impulse response for slot A, restored before processing\n"
+        "  -l FILE     impulse response for slot A, loaded by the worker while processing\n"
+        "  -t SECONDS  time of the -l load (default: %g)\n"
+        "  -p SYM=VAL  set a parameter, e.g. -p wet=-6 -p morph=0.5\n"
+        "  -b FRAMES   buffer size (default: %d)\n"
+        "  -r          process in real time, one block per block duration\n",
+        DEFAULT_LOAD_TIME_s, DEFAULT_BUFFER_SIZE);
+}
+
+static int parse_options(options_t *options, int argc, char **argv)
+{
+    int opt;
+
+    options->ir_restore = NULL;
+    options->ir_load = NULL;
+    options->load_time_s = DEFAULT_LOAD_TIME_s;
+    options->buffer_size = DEFAULT_BUFFER_SIZE;
+    options->real_time = false;
+    options->num_parameters = 0;
+
+    while ((opt = getopt(argc, argv, "i:l:t:p:b:rh")) != -1) {
+        switch (opt) {
+        case 'i':
+            options->ir_restore = optarg;
+            break;
+
+        case 'l':
+            options->ir_load = optarg;
+            break;
+
+        case 't':
+            options->load_time_s = atof(optarg);
+            break;
+
+        case 'p': {
+            const char *eq = strchr(optarg, '=');
+            parameter_t *p = &options->parameters[options->num_parameters];
+            if (eq == NULL || eq - optarg >= (long)sizeof(p->symbol) || options->num_parameters == MAX_PARAMETERS) {
+                fprintf(stderr, "Invalid parameter: %s\n", optarg);
+                return 1;
+            }
+            memcpy(p->symbol, optarg, eq - optarg);
+            p->symbol[eq - optarg] = '\0';
+            p->value = atof(eq + 1);
+            options->num_parameters++;
+            break;
+        }
+
+        case 'b':
+            options->buffer_size = atoi(optarg);
+            break;
+
+        case 'r':
+            options->real_time = true;
+            break;
+
+        default:
+            return 1;
+        }
+    }
+
+    if (argc - optind != 3 || options->buffer_size == 0) {
+        return 1;
+    }
+    options->bundle = argv[optind];
+    options->input = argv[optind + 1];
+    options->output = argv[optind + 2];
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Turtle files
+
+static int read_text_file(const std::string &filename, std::string *text)
+{
+    FILE *f = fopen(filename.c_str(), "rb");
+    if (f == NULL) {
+        fprintf(stderr, "%s: could not open file\n", filename.c_str());
+        return 1;
+    }
+    char buffer[4096];
+    size_t n;
+    text->clear();
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+        text->append(buffer, n);
+    }
+    fclose(f);
+    return 0;
+}
+
+// Returns the IRIs <...> that follow each occurrence of the predicate.
+static std::vector<std::string> find_iris(const std::string &text, const char *predicate)
+{
+    std::vector<std::string> iris;
+    size_t pos = 0;
+    while ((pos = text.find(predicate, pos)) != std::string::npos) {
+        pos += strlen(predicate);
+        size_t begin = text.find('<', pos);
+        size_t end = text.find('>', begin);
+        if (begin == std::string::npos || end == std::string::npos) {
+            break;
+        }
+        iris.push_back(text.substr(begin + 1, end - begin - 1));
+        pos = end;
+    }
+    return iris;
+}
+
+// Returns the text after the predicate up to the end of the statement, or an
+// empty string.
+static std::string find_object(const std::string &block, const char *predicate)
+{
+    size_t pos = block.find(predicate);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += strlen(predicate);
+    size_t end = block.find_first_of(";]", pos);
+    std::string object = block.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+
+    size_t begin = object.find_first_not_of(" \t\r\n\"");
+    size_t last = object.find_last_not_of(" \t\r\n\",");
+    return begin == std::string::npos ? "" : object.substr(begin, last - begin + 1);
+}
+
+// Parses the port descriptions, i.e. the top-level [...] blocks with an
+// lv2:index, as written by DPF's lv2_ttl_generator.
+static void parse_ports(const std::string &text, std::vector<port_t> *ports)
+{
+    int depth = 0;
+    bool in_string = false;
+    size_t begin = 0;
+
+    for (size_t i = 0; i < text.size(); i++) {
+        char c = text[i];
+        if (c == '"') {
+            in_string = !in_string;
+        }
+        if (in_string) {
+            continue;
+        }
+        if (c == '[' && depth++ == 0) {
+            begin = i;
+        }
+        else if (c == ']' && depth > 0 && --depth == 0) {
+            std::string block = text.substr(begin, i - begin + 1);
+            std::string index = find_object(block, "lv2:index");
+            if (index.empty()) {
+                continue;
+            }
+            port_t port;
+            port.index = atoi(index.c_str());
+            port.symbol = find_object(block, "lv2:symbol");
+            port.is_input = block.find("lv2:InputPort") != std::string::npos;
+            port.is_audio = block.find("lv2:AudioPort") != std::string::npos;
+            port.is_control = block.find("lv2:ControlPort") != std::string::npos;
+            port.is_atom = block.find("atom:AtomPort") != std::string::npos;
+            port.value = atof(find_object(block, "lv2:default").c_str());
+            ports->push_back(port);
+        }
+    }
+}
+
+static int load_bundle(const char *bundle, std::string *binary, std::vector<port_t> *ports)
+{
+    std::string path(bundle);
+    std::string manifest;
+    if (!path.empty() && path[path.size() - 1] != '/') {
+        path += "/";
+    }
+    if (read_text_file(path + "manifest.ttl", &manifest)) {
+        return 1;
+    }
+
+    std::vector<std::string> binaries = find_iris(manifest, "lv2:binary");
+    if (binaries.empty()) {
+        fprintf(stderr, "%s: no plugin binary in manifest.ttl\n", bundle);
+        return 1;
+    }
+    *binary = path + binaries[0];
+
+    // The ports are described in one of the files the manifest refers to
+    for (const std::string &see_also : find_iris(manifest, "rdfs:seeAlso")) {
+        std::string text;
+        if (read_text_file(path + see_also, &text)) {
+            return 1;
+        }
+        parse_ports(text, ports);
+    }
+    if (ports->empty()) {
+        fprintf(stderr, "%s: no ports found\n", bundle);
+        return 1;
+    }
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+// Host features
+
+static LV2_URID map_uri(LV2_URID_Map_Handle handle, const char *uri)
+{
+    urid_map_t *map = (urid_map_t *)handle;
+    std::lock_guard<std::mutex> lock(map->mutex);
+    for (size_t n = 0; n < map->uris.size(); n++) {
+        if (map->uris[n] == uri) {
+            return n + 1;
+        }
+    }
+    map->uris.push_back(uri);
+    return map->uris.size();
+}
+
+static const char *unmap_uri(LV2_URID_Unmap_Handle handle, LV2_URID urid)
+{
+    urid_map_t *map = (urid_map_t *)handle;
+    std::lock_guard<std::mutex> lock(map->mutex);
+    if (urid == 0 || urid > map->uris.size()) {
+        return NULL;
+    }
+    return map->uris[urid - 1].c_str();
+}
+
+static LV2_Worker_Status schedule_work(LV2_Worker_Schedule_Handle handle, uint32_t size, const void *data)
+{
+    worker_t *worker = (worker_t *)handle;
+    const uint8_t *bytes = (const uint8_t *)data;
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->requests.push_back(std::vector<uint8_t>(bytes, bytes + size));
+        worker->busy++;
+    }
+    worker->condition.notify_one();
+    return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status respond(LV2_Worker_Respond_Handle handle, uint32_t size, const void *data)
+{
+    worker_t *worker = (worker_t *)handle;
+    const uint8_t *bytes = (const uint8_t *)data;
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    worker->responses.push_back(std::vector<uint8_t>(bytes, bytes + size));
+    return LV2_WORKER_SUCCESS;
+}
+
+static void run_worker(worker_t *worker)
+{
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    while (true) {
+        worker->condition.wait(lock, [worker]() { return worker->quit || !worker->requests.empty(); });
+        if (worker->requests.empty()) {
+            break;
+        }
+        std::vector<uint8_t> request;
+        request.swap(worker->requests.front());
+        worker->requests.pop_front();
+        lock.unlock();
+
+        uint64_t t0 = now_ns();
+        if (worker->worker_interface != NULL) {
+            worker->worker_interface->work(worker->instance, respond, worker, request.size(), request.data());
+        }
+        worker->work_ns += now_ns() - t0;
+        worker->busy--;
+
+        lock.lock();
+    }
+}
+
+// Hands the worker responses to the plugin. Called on the audio thread after
+// run(), as the worker extension requires.
+static void deliver_responses(worker_t *worker)
+{
+    std::unique_lock<std::mutex> lock(worker->mutex, std::try_to_lock);
+    if (!lock.owns_lock() || worker->worker_interface == NULL) {
+        return;
+    }
+    while (!worker->responses.empty()) {
+        const std::vector<uint8_t> &response = worker->responses.front();
+        worker->worker_interface->work_response(worker->instance, response.size(), response.data());
+        worker->responses.pop_front();
+    }
+    if (worker->worker_interface->end_run != NULL) {
+        worker->worker_interface->end_run(worker->instance);
+    }
+}
+
+// -----------------------------------------------------------------------------
+// State
+
+typedef struct {
+    LV2_URID key;
+    LV2_URID type;
+    const char *value;
+} restore_t;
+
+static const void *retrieve(LV2_State_Handle handle, uint32_t key, size_t *size, uint32_t *type, uint32_t *flags)
+{
+    restore_t *restore = (restore_t *)handle;
+    if (key != restore->key) {
+        return NULL;
+    }
+    *size = strlen(restore->value) + 1;
+    *type = restore->type;
+    *flags = LV2_STATE_IS_POD | LV2_STATE_IS_PORTABLE;
+    return restore->value;
+}
+
+// Serializes an impulse response file into the state value of a slot.
+static int serialize_impulse_response(const char *filename, std::string *value)
+{
+    int err;
+    plugin_state_t state;
+    char *str = NULL;
+    uint32_t length = 0;
+
+    err = plugin_state_init(&state, filename);
+    if (err) {
+        fprintf(stderr, "%s: could not load impulse response\n", filename);
+        return 1;
+    }
+    err = plugin_state_serialize(&state, &str, &length);
+    plugin_state_free(&state);
+    if (err) {
+        fprintf(stderr, "%s: could not serialize impulse response\n", filename);
+        return 1;
+    }
+    value->assign(str);
+    free(str);
+    return 0;
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+    int err;
+    options_t options;
+
+    if (parse_options(&options, argc, argv)) {
+        usage();
+        return 2;
+    }
+
+    std::string binary;
+    std::vector<port_t> ports;
+    if (load_bundle(options.bundle, &binary, &ports)) {
+        return 1;
+    }
+
+    for (uint32_t n = 0; n < options.num_parameters; n++) {
+        bool found = false;
+        for (port_t &port : ports) {
+            if (port.is_control && port.is_input && port.symbol == options.parameters[n].symbol) {
+                port.value = options.parameters[n].value;
+                found = true;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Unknown parameter: %s\n", options.parameters[n].symbol);
+            return 1;
+        }
+    }
+
+    // Serialize the impulse responses up front, so that only the plugin's
+    // own work is timed.
+    std::string restore_value;
+    std::string load_value;
+    if (options.ir_restore != NULL && serialize_impulse_response(options.ir_restore, &restore_value)) {
+        return 1;
+    }
+    if (options.ir_load != NULL && serialize_impulse_response(options.ir_load, &load_value)) {
+        return 1;
+    }
+
+    ir_file_t input;
+    err = ir_file_open(&input, options.input);
+    if (err) {
+        fprintf(stderr, "%s: could not open file\n", options.input);
+        return 1;
+    }
+    const uint32_t sample_rate = input.sample_rate_Hz;
+    const uint32_t length = (uint32_t)input.num_samples_per_channel;
+
+    void *library = dlopen(binary.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (library == NULL) {
+        fprintf(stderr, "%s: %s\n", binary.c_str(), dlerror());
+        ir_file_close(&input);
+        return 1;
+    }
+    LV2_Descriptor_Function get_descriptor = (LV2_Descriptor_Function)dlsym(library, "lv2_descriptor");
+    const LV2_Descriptor *descriptor = get_descriptor != NULL ? get_descriptor(0) : NULL;
+    if (descriptor == NULL) {
+        fprintf(stderr, "%s: no LV2 plugin\n", binary.c_str());
+        ir_file_close(&input);
+        return 1;
+    }
+
+    // Features
+    urid_map_t urids;
+    LV2_URID_Map map = {&urids, map_uri};
+    LV2_URID_Unmap unmap = {&urids, unmap_uri};
+
+    worker_t worker;
+    worker.instance = NULL;
+    worker.worker_interface = NULL;
+    worker.quit = false;
+    worker.busy = 0;
+    worker.work_ns = 0;
+    LV2_Worker_Schedule schedule = {&worker, schedule_work};
+
+    const int32_t block_length = options.buffer_size;
+    const float sample_rate_option = sample_rate;
+    const LV2_URID atom_int = map_uri(&urids, LV2_ATOM__Int);
+    const LV2_URID atom_float = map_uri(&urids, LV2_ATOM__Float);
+    const LV2_Options_Option host_options[] = {
+        {LV2_OPTIONS_INSTANCE, 0, map_uri(&urids, LV2_BUF_SIZE__minBlockLength), sizeof(int32_t), atom_int, &block_length},
+        {LV2_OPTIONS_INSTANCE, 0, map_uri(&urids, LV2_BUF_SIZE__maxBlockLength), sizeof(int32_t), atom_int, &block_length},
+        {LV2_OPTIONS_INSTANCE, 0, map_uri(&urids, LV2_BUF_SIZE__nominalBlockLength), sizeof(int32_t), atom_int, &block_length},
+        {LV2_OPTIONS_INSTANCE, 0, map_uri(&urids, LV2_PARAMETERS__sampleRate), sizeof(float), atom_float, &sample_rate_option},
+        {LV2_OPTIONS_INSTANCE, 0, 0, 0, 0, NULL},
+    };
+
+    const LV2_Feature map_feature = {LV2_URID__map, &map};
+    const LV2_Feature unmap_feature = {LV2_URID__unmap, &unmap};
+    const LV2_Feature schedule_feature = {LV2_WORKER__schedule, &schedule};
+    const LV2_Feature options_feature = {LV2_OPTIONS__options, (void *)host_options};
+    const LV2_Feature bounded_feature = {LV2_BUF_SIZE__boundedBlockLength, NULL};
+    const LV2_Feature *features[] = {&map_feature, &unmap_feature, &schedule_feature, &options_feature, &bounded_feature, NULL};
+
+    std::string bundle_path(options.bundle);
+    if (bundle_path[bundle_path.size() - 1] != '/') {
+        bundle_path += "/";
+    }
+    LV2_Handle instance = descriptor->instantiate(descriptor, sample_rate, bundle_path.c_str(), features);
+    if (instance == NULL) {
+        fprintf(stderr, "%s: could not instantiate plugin\n", descriptor->URI);
+        ir_file_close(&input);
+        return 1;
+    }
+    worker.instance = instance;
+    if (descriptor->extension_data != NULL) {
+        worker.worker_interface = (const LV2_Worker_Interface *)descriptor->extension_data(LV2_WORKER__interface);
+    }
+    std::thread worker_thread(run_worker, &worker);
+
+    // Ports. The event input carries at most one state message per block.
+    uint32_t num_inputs = 0;
+    uint32_t num_outputs = 0;
+    for (const port_t &port : ports) {
+        if (port.is_audio) {
+            (port.is_input ? num_inputs : num_outputs)++;
+        }
+    }
+    if (num_inputs > MAX_CHANNELS || num_outputs > MAX_CHANNELS) {
+        fprintf(stderr, "%s: too many channels\n", descriptor->URI);
+        ir_file_close(&input);
+        return 1;
+    }
+
+    AudioFile<float>::AudioBuffer in(num_inputs, std::vector<float>(length, 0.0f));
+    AudioFile<float>::AudioBuffer out(num_outputs, std::vector<float>(length, 0.0f));
+    std::vector<std::vector<float>> control_outputs(ports.size(), std::vector<float>(1, 0.0f));
+
+    const LV2_URID sequence_type = map_uri(&urids, LV2_ATOM__Sequence);
+    const LV2_URID chunk_type = map_uri(&urids, LV2_ATOM__Chunk);
+    const uint32_t event_capacity = sizeof(LV2_Atom_Sequence) + sizeof(LV2_Atom_Event) + load_value.size() + 64;
+    std::vector<uint64_t> events_in((event_capacity + 7) / 8, 0);
+    std::vector<uint64_t> events_out(8192, 0);
+    LV2_Atom_Sequence *seq_in = (LV2_Atom_Sequence *)events_in.data();
+    LV2_Atom_Sequence *seq_out = (LV2_Atom_Sequence *)events_out.data();
+
+    float *in_channels[MAX_CHANNELS];
+    for (uint32_t c = 0; c < num_inputs; c++) {
+        in_channels[c] = in[c].data();
+    }
+    double energy[MAX_CHANNELS];
+    err = ir_file_read(&input, in_channels, num_inputs, energy);
+    ir_file_close(&input);
+    if (err) {
+        fprintf(stderr, "%s: could not read file\n", options.input);
+        return 1;
+    }
+
+    // Restore the state before processing, as a host does when loading a
+    // session.
+    descriptor->activate(instance);
+    if (options.ir_restore != NULL) {
+        const LV2_State_Interface *state_interface = NULL;
+        if (descriptor->extension_data != NULL) {
+            state_interface = (const LV2_State_Interface *)descriptor->extension_data(LV2_STATE__interface);
+        }
+        if (state_interface == NULL) {
+            fprintf(stderr, "%s: no state interface\n", descriptor->URI);
+            return 1;
+        }
+        restore_t restore;
+        restore.key = map_uri(&urids, (std::string(DPF_STATE_KEY_PREFIX) + plugin_state_key(0)).c_str());
+        restore.type = map_uri(&urids, LV2_ATOM__String);
+        restore.value = restore_value.c_str();
+
+        uint64_t t0 = now_ns();
+        state_interface->restore(instance, retrieve, &restore, 0, features);
+        printf("state restore: %.3f ms\n", (now_ns() - t0) / 1e6);
+    }
+
+    // Process block by block, with the input copied into the port buffers
+    // like a host does.
+    std::vector<std::vector<float>> in_buffers(num_inputs, std::vector<float>(options.buffer_size));
+    std::vector<std::vector<float>> out_buffers(num_outputs, std::vector<float>(options.buffer_size));
+    uint32_t audio_in = 0;
+    uint32_t audio_out = 0;
+    for (size_t n = 0; n < ports.size(); n++) {
+        port_t &port = ports[n];
+        if (port.is_audio) {
+            descriptor->connect_port(instance, port.index, port.is_input ? in_buffers[audio_in++].data() : out_buffers[audio_out++].data());
+        }
+        else if (port.is_control) {
+            descriptor->connect_port(instance, port.index, port.is_input ? &port.value : control_outputs[n].data());
+        }
+        else if (port.is_atom) {
+            descriptor->connect_port(instance, port.index, port.is_input ? (void *)seq_in : (void *)seq_out);
+        }
+    }
+
+    const uint32_t load_position = (uint32_t)(options.load_time_s * sample_rate);
+    const LV2_URID key_value_state = map_uri(&urids, DPF_KEY_VALUE_STATE_URI);
+    bool load_sent = options.ir_load == NULL;
+    uint64_t load_start_ns = 0;
+    uint64_t load_end_ns = 0;
+    uint32_t load_blocks = 0;
+    uint64_t max_run_ns = 0;
+    uint64_t max_run_loading_ns = 0;
+    const uint64_t start_ns = now_ns();
+
+    for (uint32_t position = 0; position < length; position += options.buffer_size) {
+        if (options.real_time) {
+            const uint64_t deadline_ns = start_ns + (uint64_t)(1e9 * position / sample_rate);
+            const uint64_t t = now_ns();
+            if (deadline_ns > t) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(deadline_ns - t));
+            }
+        }
+
+        uint32_t frames = length - position < options.buffer_size ? length - position : options.buffer_size;
+        for (uint32_t c = 0; c < num_inputs; c++) {
+            memcpy(in_buffers[c].data(), in[c].data() + position, sizeof(float) * frames);
+        }
+
+        seq_in->atom.type = sequence_type;
+        seq_in->body.unit = 0;
+        seq_in->body.pad = 0;
+        lv2_atom_sequence_clear(seq_in);
+        seq_out->atom.type = chunk_type;
+        seq_out->atom.size = sizeof(uint64_t) * events_out.size() - sizeof(LV2_Atom);
+
+        bool sending = false;
+        if (!load_sent && position >= load_position) {
+            const char *key = plugin_state_key(0);
+            const uint32_t key_size = strlen(key) + 1;
+            const uint32_t body_size = key_size + load_value.size() + 1;
+            LV2_Atom_Event *event = lv2_atom_sequence_end(&seq_in->body, seq_in->atom.size);
+            event->time.frames = 0;
+            event->body.type = key_value_state;
+            event->body.size = body_size;
+            char *body = (char *)LV2_ATOM_BODY(&event->body);
+            memcpy(body, key, key_size);
+            memcpy(body + key_size, load_value.c_str(), load_value.size() + 1);
+            seq_in->atom.size += lv2_atom_pad_size(sizeof(LV2_Atom_Event) + body_size);
+            load_sent = true;
+            sending = true;
+        }
+
+        const bool loading = worker.busy.load() > 0;
+        uint64_t t0 = now_ns();
+        descriptor->run(instance, frames);
+        uint64_t t1 = now_ns();
+        deliver_responses(&worker);
+
+        if (sending) {
+            load_start_ns = t0;
+            printf("run with the state message: %.3f ms\n", (t1 - t0) / 1e6);
+        }
+        else if (loading) {
+            load_blocks++;
+            max_run_loading_ns = std::max(max_run_loading_ns, t1 - t0);
+            load_end_ns = t1;
+        }
+        else {
+            max_run_ns = std::max(max_run_ns, t1 - t0);
+        }
+
+        for (uint32_t c = 0; c < num_outputs; c++) {
+            memcpy(out[c].data() + position, out_buffers[c].data(), sizeof(float) * frames);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.quit = true;
+    }
+    worker.condition.notify_one();
+    worker_thread.join();
+
+    if (options.ir_load != NULL) {
+        printf("worker: %.3f ms in work(), %u blocks processed meanwhile (%.3f ms)\n",
+            worker.work_ns.load() / 1e6, load_blocks, load_blocks > 0 ? (load_end_ns - load_start_ns) / 1e6 : 0.0);
+        printf("run while loading: max %.3f ms\n", max_run_loading_ns / 1e6);
+    }
+    printf("run: max %.3f ms, block duration %.3f ms\n", max_run_ns / 1e6, 1e3 * options.buffer_size / sample_rate);
+
+    descriptor->deactivate(instance);
+    descriptor->cleanup(instance);
+    dlclose(library);
+
+    // Write output file
+    AudioFile<float> output;
+    output.setAudioBuffer(out);
+    output.setBitDepth(32);
+    output.setSampleRate(sample_rate);
+    if (!output.save(options.output)) {
+        fprintf(stderr, "%s: could not write file\n", options.output);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,273 @@
+// Offline batch convolution with the GunShot engine.
+//
+// Every input file is rendered with every impulse response given with -i.
+// The files are processed in parallel, one plugin instance per job, and the
+// output only depends on the input files and options, never on the number of
+// jobs or the machine load.
+//
+// Usage: gunshot-render [options] -i IR [-i IR ...] INPUT...
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audiofile/AudioFile.h"
+#include "headless_host.hpp"
+#include "ir_file.hpp"
+#include "plugin_state.hpp"
+#include "utils.h"
+
+#define DEFAULT_BLOCK_SIZE 4096
+#define DEFAULT_BIT_DEPTH 24
+#define MAX_PARAMETERS 16
+
+typedef struct {
+    char symbol[64];
+    float value;
+} parameter_t;
+
+typedef struct {
+    std::vector<const char *> irs;
+    const char *ir_b;
+    std::vector<const char *> inputs;
+    const char *output_dir;
+    uint32_t block_size;
+    uint32_t num_jobs;
+    uint32_t bit_depth;
+    double tail_seconds; // Negative: use the impulse response length
+    parameter_t parameters[MAX_PARAMETERS];
+    uint32_t num_parameters;
+} options_t;
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: gunshot-render [options] -i IR [-i IR ...] INPUT...\n"
+        "\n"
+        "  -i FILE     impulse response for slot A (repeat to render several)\n"
+        "  -B FILE     impulse response for slot B\n"
+        "  -p SYM=VAL  set a parameter, e.g. -p wet=-6 -p morph=0.5\n"
+        "  -o DIR      output directory (default: .)\n"
+        "  -b FRAMES   block size (default: %d)\n"
+        "  -j JOBS     number of files processed in parallel (default: all cores)\n"
+        "  -d BITS     output bit depth, 16, 24 or 32 (default: %d)\n"
+        "  -t SECONDS  length of the tail rendered after the input\n"
+        "              (default: the length of the impulse response)\n"
+        "\n"
+        "Outputs are written as DIR/<input>_<ir>.wav at the sample rate of the input.\n",
+        DEFAULT_BLOCK_SIZE, DEFAULT_BIT_DEPTH);
+}
+
+// File name without directory and extension.
+static std::string stem(const char *path)
+{
+    std::string name(path + find_basename(path));
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) {
+        name.resize(dot);
+    }
+    return name;
+}
+
+static int render(const options_t *options, const char *input_filename, const char *ir_filename)
+{
+    int err;
+    ir_file_t input;
+    double energy[DISTRHO_PLUGIN_NUM_INPUTS];
+
+    err = ir_file_open(&input, input_filename);
+    if (err) {
+        fprintf(stderr, "%s: could not open file\n", input_filename);
+        return 1;
+    }
+
+    HeadlessHost host(input.sample_rate_Hz, options->block_size);
+
+    if (host.loadImpulseResponse(0, ir_filename)) {
+        fprintf(stderr, "%s: could not load impulse response\n", ir_filename);
+        ir_file_close(&input);
+        return 1;
+    }
+    if (options->ir_b != NULL && host.loadImpulseResponse(1, options->ir_b)) {
+        fprintf(stderr, "%s: could not load impulse response\n", options->ir_b);
+        ir_file_close(&input);
+        return 1;
+    }
+    for (uint32_t i = 0; i < options->num_parameters; i++) {
+        if (host.setParameter(options->parameters[i].symbol, options->parameters[i].value)) {
+            fprintf(stderr, "Unknown parameter: %s\n", options->parameters[i].symbol);
+            ir_file_close(&input);
+            return 1;
+        }
+    }
+
+    uint32_t input_length = (uint32_t)input.num_samples_per_channel;
+    uint32_t tail_length = host.getTailLength();
+    if (options->tail_seconds >= 0.0) {
+        tail_length = (uint32_t)(options->tail_seconds * input.sample_rate_Hz);
+    }
+    uint32_t total_length = input_length + tail_length;
+
+    // Mono inputs are fed to both plugin inputs. The tail is rendered by
+    // processing silence after the input.
+    AudioFile<float>::AudioBuffer in(DISTRHO_PLUGIN_NUM_INPUTS, std::vector<float>(total_length, 0.0f));
+    AudioFile<float>::AudioBuffer out(DISTRHO_PLUGIN_NUM_OUTPUTS, std::vector<float>(total_length, 0.0f));
+
+    float *in_channels[DISTRHO_PLUGIN_NUM_INPUTS];
+    for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_INPUTS; c++) {
+        in_channels[c] = in[c].data();
+    }
+    err = ir_file_read(&input, in_channels, DISTRHO_PLUGIN_NUM_INPUTS, energy);
+    ir_file_close(&input);
+    if (err) {
+        fprintf(stderr, "%s: could not read file\n", input_filename);
+        return 1;
+    }
+
+    const float *inputs[DISTRHO_PLUGIN_NUM_INPUTS];
+    float *outputs[DISTRHO_PLUGIN_NUM_OUTPUTS];
+    for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_INPUTS; c++) {
+        inputs[c] = in[c].data();
+    }
+    for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_OUTPUTS; c++) {
+        outputs[c] = out[c].data();
+    }
+    host.run(inputs, outputs, total_length);
+
+    // Write output file
+    std::string output_filename = std::string(options->output_dir) + "/" + stem(input_filename) + "_" + stem(ir_filename) + ".wav";
+
+    AudioFile<float> output;
+    output.setAudioBuffer(out);
+    output.setBitDepth(options->bit_depth);
+    output.setSampleRate(host.getSampleRate());
+    if (!output.save(output_filename)) {
+        fprintf(stderr, "%s: could not write file\n", output_filename.c_str());
+        return 1;
+    }
+
+    printf("%s\n", output_filename.c_str());
+    return 0;
+}
+
+static int parse_options(options_t *options, int argc, char **argv)
+{
+    int opt;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    options->ir_b = NULL;
+    options->output_dir = ".";
+    options->block_size = DEFAULT_BLOCK_SIZE;
+    options->num_jobs = cores > 0 ? cores : 1;
+    options->bit_depth = DEFAULT_BIT_DEPTH;
+    options->tail_seconds = -1.0;
+    options->num_parameters = 0;
+
+    while ((opt = getopt(argc, argv, "i:B:p:o:b:j:d:t:h")) != -1) {
+        switch (opt) {
+        case 'i':
+            options->irs.push_back(optarg);
+            break;
+
+        case 'B':
+            options->ir_b = optarg;
+            break;
+
+        case 'p': {
+            const char *eq = strchr(optarg, '=');
+            parameter_t *p = &options->parameters[options->num_parameters];
+            if (eq == NULL || eq - optarg >= (long)sizeof(p->symbol) || options->num_parameters == MAX_PARAMETERS) {
+                fprintf(stderr, "Invalid parameter: %s\n", optarg);
+                return 1;
+            }
+            memcpy(p->symbol, optarg, eq - optarg);
+            p->symbol[eq - optarg] = '\0';
+            p->value = atof(eq + 1);
+            options->num_parameters++;
+            break;
+        }
+
+        case 'o':
+            options->output_dir = optarg;
+            break;
+
+        case 'b':
+            options->block_size = atoi(optarg);
+            break;
+
+        case 'j':
+            options->num_jobs = atoi(optarg);
+            break;
+
+        case 'd':
+            options->bit_depth = atoi(optarg);
+            break;
+
+        case 't':
+            options->tail_seconds = atof(optarg);
+            break;
+
+        default:
+            return 1;
+        }
+    }
+
+    for (int n = optind; n < argc; n++) {
+        options->inputs.push_back(argv[n]);
+    }
+
+    if (options->irs.empty() || options->inputs.empty()) {
+        return 1;
+    }
+    if (options->block_size == 0 || options->num_jobs == 0) {
+        return 1;
+    }
+    if (options->bit_depth != 16 && options->bit_depth != 24 && options->bit_depth != 32) {
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    options_t options;
+
+    if (parse_options(&options, argc, argv)) {
+        usage();
+        return 2;
+    }
+
+    // Each job renders one input with one impulse response. The workers take
+    // the next job from a shared counter until all jobs are done.
+    uint32_t num_jobs = options.inputs.size() * options.irs.size();
+    std::atomic<uint32_t> next_job(0);
+    std::atomic<uint32_t> failed(0);
+
+    auto worker = [&]() {
+        uint32_t job;
+        while ((job = next_job++) < num_jobs) {
+            const char *input = options.inputs[job / options.irs.size()];
+            const char *ir = options.irs[job % options.irs.size()];
+            if (render(&options, input, ir)) {
+                failed++;
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    uint32_t num_workers = options.num_jobs < num_jobs ? options.num_jobs : num_jobs;
+    for (uint32_t n = 0; n < num_workers; n++) {
+        workers.push_back(std::thread(worker));
+    }
+    for (uint32_t n = 0; n < num_workers; n++) {
+        workers[n].join();
+    }
+
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,336 @@
+// Multi-instance scaling benchmark.
+//
+// Creates N plugin instances in one process and runs them the way a host
+// does: one audio thread wakes up once per buffer period and calls run() on
+// every instance in turn. A period where the calls do not finish before the
+// next period starts is counted as a deadline miss. The background threads
+// of the convolvers run concurrently, as they would in a host.
+//
+// For each instance count the tool reports the process CPU usage, the number
+// of threads, the number of deadline misses, the resident memory and a
+// breakdown of the memory used per instance.
+//
+// Usage: gunshot-scale [-n COUNTS] [-b FRAMES] [-r RATE] [-l SECONDS] [-d SECONDS] [-f]
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <vector>
+
+#include "headless_host.hpp"
+#include "convolver.hpp"
+
+#define DEFAULT_BUFFER_SIZE 256
+#define DEFAULT_SAMPLE_RATE 48000.0
+#define DEFAULT_IR_LENGTH_S 2.0
+#define DEFAULT_DURATION_S 10.0
+
+static const uint32_t default_instance_counts[] = {1, 8, 64, 256};
+
+typedef struct {
+    std::vector<uint32_t> instance_counts;
+    uint32_t buffer_size;
+    double sample_rate;
+    double ir_length_s;
+    double duration_s;
+    bool free_running;
+} options_t;
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: gunshot-scale [-n COUNTS] [-b FRAMES] [-r RATE] [-l SECONDS] [-d SECONDS] [-f]\n"
+        "\n"
+        "  -n COUNTS   comma separated instance counts (default: 1,8,64,256)\n"
+        "  -b FRAMES   buffer size (default: %d)\n"
+        "  -r RATE     sample rate in Hz (default: %g)\n"
+        "  -l SECONDS  impulse response length (default: %g)\n"
+        "  -d SECONDS  audio processed per instance count (default: %g)\n"
+        "  -f          free running, i.e. do not wait for the next period\n"
+        "\n"
+        "The result is written to stdout as JSON.\n",
+        DEFAULT_BUFFER_SIZE, DEFAULT_SAMPLE_RATE, DEFAULT_IR_LENGTH_S, DEFAULT_DURATION_S);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t t)
+{
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000ull;
+    ts.tv_nsec = t % 1000000000ull;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) {
+    }
+}
+
+static double cpu_seconds(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 +
+           usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+}
+
+static size_t resident_bytes(void)
+{
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL) {
+        return 0;
+    }
+    if (fscanf(f, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(f);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static uint32_t thread_count(void)
+{
+    uint32_t count = 0;
+    struct dirent *entry;
+    DIR *dir = opendir("/proc/self/task");
+    if (dir == NULL) {
+        return 0;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            count++;
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+// Deterministic white noise in [-1, 1).
+static float noise(uint32_t *seed)
+{
+    *seed = *seed * 1664525u + 1013904223u;
+    return (float)(*seed >> 8) / (1 << 23) - 1.0f;
+}
+
+// Memory used by one instance for the impulse response copies and spectra.
+// A reference convolver is set up with the same sizes as the plugin uses for
+// each channel, i.e. slot A holding the impulse response and slot B holding
+// the default dirac.
+static void convolver_bytes(const options_t *options, const std::vector<float> &ir, size_t *ir_bytes, size_t *spectrum_bytes, size_t *buffer_bytes)
+{
+    Convolver reference;
+    const float dirac = 1.0f;
+    const fftconvolver::Sample *irs[PLUGIN_STATE_NUM_SLOTS] = {ir.data(), &dirac};
+    size_t ir_lengths[PLUGIN_STATE_NUM_SLOTS] = {ir.size(), 1};
+
+    size_t head = fftconvolver::NextPowerOf2((size_t)options->buffer_size);
+    size_t tail = head > 8192 ? head : 8192;
+    reference.setBackgroundLoading(false);
+    reference.init(head, tail, irs, ir_lengths, PLUGIN_STATE_NUM_SLOTS);
+
+    *ir_bytes = DISTRHO_PLUGIN_NUM_OUTPUTS * reference.getImpulseResponseBytes();
+    *spectrum_bytes = DISTRHO_PLUGIN_NUM_OUTPUTS * reference.getSpectrumBytes();
+    *buffer_bytes = DISTRHO_PLUGIN_NUM_OUTPUTS * reference.getBufferBytes();
+}
+
+static int run_scale(const options_t *options, uint32_t num_instances, bool first)
+{
+    uint32_t n;
+    uint32_t i;
+    uint32_t seed = 1;
+
+    uint32_t ir_length = (uint32_t)(options->ir_length_s * options->sample_rate);
+    if (ir_length < 1) {
+        ir_length = 1;
+    }
+    std::vector<float> ir_left(ir_length);
+    std::vector<float> ir_right(ir_length);
+    for (n = 0; n < ir_length; n++) {
+        float envelope = expf(-6.9f * n / ir_length);
+        ir_left[n] = envelope * noise(&seed);
+        ir_right[n] = envelope * noise(&seed);
+    }
+
+    size_t rss_before = resident_bytes();
+    uint32_t threads_before = thread_count();
+
+    // Create instances
+    std::vector<HeadlessHost *> hosts(num_instances);
+    for (i = 0; i < num_instances; i++) {
+        hosts[i] = new HeadlessHost(options->sample_rate, options->buffer_size);
+        hosts[i]->setParameter("render", RENDER_LIVE);
+        if (hosts[i]->loadImpulseResponse(0, ir_left.data(), ir_right.data(), ir_length, (uint32_t)options->sample_rate)) {
+            return 1;
+        }
+    }
+
+    // Each instance has its own input and output buffers, as on a host's
+    // mixer channels.
+    const uint32_t frames = options->buffer_size;
+    std::vector<float> in(num_instances * 2 * frames);
+    std::vector<float> out(num_instances * 2 * frames);
+    for (n = 0; n < in.size(); n++) {
+        in[n] = noise(&seed);
+    }
+
+    size_t rss_after = resident_bytes();
+    uint32_t threads_after = thread_count();
+
+    // Host loop
+    uint64_t period_ns = (uint64_t)(1e9 * frames / options->sample_rate);
+    uint32_t num_periods = (uint32_t)(options->duration_s * options->sample_rate / frames) + 1;
+    uint32_t misses = 0;
+    uint64_t max_callback_ns = 0;
+    uint64_t total_callback_ns = 0;
+
+    double cpu_start = cpu_seconds();
+    uint64_t wall_start = now_ns();
+
+    for (n = 0; n < num_periods; n++) {
+        uint64_t period_start = wall_start + n * period_ns;
+        if (options->free_running) {
+            period_start = now_ns();
+        }
+        else {
+            sleep_until_ns(period_start);
+        }
+
+        uint64_t t0 = now_ns();
+        for (i = 0; i < num_instances; i++) {
+            const float *inputs[2] = {&in[(2 * i) * frames], &in[(2 * i + 1) * frames]};
+            float *outputs[2] = {&out[(2 * i) * frames], &out[(2 * i + 1) * frames]};
+            hosts[i]->run(inputs, outputs, frames);
+        }
+        uint64_t t1 = now_ns();
+
+        uint64_t callback_ns = t1 - t0;
+        total_callback_ns += callback_ns;
+        if (callback_ns > max_callback_ns) {
+            max_callback_ns = callback_ns;
+        }
+        if (t1 > period_start + period_ns) {
+            misses++;
+        }
+    }
+
+    double wall_s = (now_ns() - wall_start) * 1e-9;
+    double cpu_s = cpu_seconds() - cpu_start;
+
+    // Memory breakdown per instance
+    size_t ir_bytes;
+    size_t spectrum_bytes;
+    size_t buffer_bytes;
+    convolver_bytes(options, ir_left, &ir_bytes, &spectrum_bytes, &buffer_bytes);
+    size_t state_bytes = hosts[0]->getStateBytes();
+
+    for (i = 0; i < num_instances; i++) {
+        delete hosts[i];
+    }
+
+    printf("%s\n  {\"instances\": %u, \"buffer_size\": %u, \"sample_rate\": %.0f, \"ir_length_s\": %g, "
+           "\"cpu_cores\": %.3f, \"cpu_percent_per_instance\": %.3f, "
+           "\"audio_thread_load\": %.3f, \"callback_us_max\": %.3f, \"period_us\": %.3f, "
+           "\"periods\": %u, \"deadline_misses\": %u, "
+           "\"threads\": %u, \"threads_per_instance\": %.2f, "
+           "\"rss_bytes\": %zu, \"rss_bytes_per_instance\": %.0f, "
+           "\"state_bytes_per_instance\": %zu, \"ir_copy_bytes_per_instance\": %zu, "
+           "\"spectrum_bytes_per_instance\": %zu, \"buffer_bytes_per_instance\": %zu}",
+           first ? "" : ",",
+           num_instances, frames, options->sample_rate, options->ir_length_s,
+           cpu_s / wall_s, 100.0 * cpu_s / wall_s / num_instances,
+           (double)total_callback_ns / (num_periods * period_ns), max_callback_ns / 1e3, period_ns / 1e3,
+           num_periods, misses,
+           threads_after, (double)(threads_after - threads_before) / num_instances,
+           rss_after, (double)(rss_after - rss_before) / num_instances,
+           state_bytes, ir_bytes,
+           spectrum_bytes, buffer_bytes);
+    fflush(stdout);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    options_t options;
+
+    options.instance_counts.assign(default_instance_counts, default_instance_counts + sizeof(default_instance_counts) / sizeof(uint32_t));
+    options.buffer_size = DEFAULT_BUFFER_SIZE;
+    options.sample_rate = DEFAULT_SAMPLE_RATE;
+    options.ir_length_s = DEFAULT_IR_LENGTH_S;
+    options.duration_s = DEFAULT_DURATION_S;
+    options.free_running = false;
+
+    while ((opt = getopt(argc, argv, "n:b:r:l:d:fh")) != -1) {
+        int err = 0;
+        switch (opt) {
+        case 'n': {
+            char *s = optarg;
+            char *end;
+            options.instance_counts.clear();
+            while (*s != '\0') {
+                long count = strtol(s, &end, 10);
+                if (end == s || count <= 0) {
+                    err = 1;
+                    break;
+                }
+                options.instance_counts.push_back(count);
+                s = (*end == ',') ? end + 1 : end;
+            }
+            break;
+        }
+
+        case 'b':
+            options.buffer_size = atoi(optarg);
+            err = options.buffer_size == 0;
+            break;
+
+        case 'r':
+            options.sample_rate = atof(optarg);
+            err = options.sample_rate <= 0.0;
+            break;
+
+        case 'l':
+            options.ir_length_s = atof(optarg);
+            break;
+
+        case 'd':
+            options.duration_s = atof(optarg);
+            err = options.duration_s <= 0.0;
+            break;
+
+        case 'f':
+            options.free_running = true;
+            break;
+
+        default:
+            err = 1;
+            break;
+        }
+        if (err) {
+            usage();
+            return 2;
+        }
+    }
+
+    bool first = true;
+    printf("[");
+    for (uint32_t count : options.instance_counts) {
+        if (run_scale(&options, count, first)) {
+            fprintf(stderr, "Benchmark failed\n");
+            return 1;
+        }
+        first = false;
+    }
+    printf("\n]\n");
+
+    return 0;
+}
@@ -0,0 +1,225 @@
+#include "headless_host.hpp"
+#include "routing.h"
+
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <mutex>
+
+START_NAMESPACE_DISTRHO
+
+// createPlugin() picks up the sample rate and buffer size from these globals,
+// which DPF's own wrappers set right before instantiating a plugin.
+extern uint32_t d_lastBufferSize;
+extern double d_lastSampleRate;
+
+END_NAMESPACE_DISTRHO
+
+USE_NAMESPACE_DISTRHO
+
+// Protects the globals above when hosts are created from several threads.
+static std::mutex instantiate_mutex;
+
+HeadlessHost::HeadlessHost(double sample_rate, uint32_t buffer_size) :
+    plugin(nullptr),
+    sample_rate(sample_rate),
+    buffer_size(buffer_size),
+    tail_length_s(0.0)
+{
+    for (uint32_t s = 0; s < PLUGIN_STATE_NUM_SLOTS; s++) {
+        state_bytes[s] = 0;
+    }
+
+    std::lock_guard<std::mutex> lock(instantiate_mutex);
+
+    d_lastBufferSize = buffer_size;
+    d_lastSampleRate = sample_rate;
+    plugin = new PluginExporter(nullptr, nullptr);
+    d_lastBufferSize = 0;
+    d_lastSampleRate = 0.0;
+
+    // Renders from here on are offline: deterministic, and without
+    // deadlines, however fast they run
+    setParameter("render", RENDER_OFFLINE);
+    plugin->activate();
+}
+
+HeadlessHost::~HeadlessHost()
+{
+    plugin->deactivate();
+    delete plugin;
+}
+
+int HeadlessHost::loadImpulseResponse(uint32_t slot, const char *filename)
+{
+    int err;
+    plugin_state_t state;
+
+    err = plugin_state_init(&state, filename);
+    if (err) {
+        return 1;
+    }
+
+    err = setPluginState(slot, &state);
+    plugin_state_free(&state);
+    return err;
+}
+
+int HeadlessHost::loadImpulseResponse(uint32_t slot, const float *left, const float *right, uint32_t length, uint32_t sample_rate_Hz)
+{
+    int err;
+    plugin_state_t state;
+
+    err = plugin_state_init_dirac(&state, sample_rate_Hz);
+    if (err) {
+        return 1;
+    }
+
+    float *ir_left = (float *)realloc(state.ir[0], sizeof(float) * length);
+    if (ir_left != NULL) {
+        state.ir[0] = ir_left;
+    }
+    float *ir_right = (float *)realloc(state.ir[1], sizeof(float) * length);
+    if (ir_right != NULL) {
+        state.ir[1] = ir_right;
+    }
+    if (ir_left == NULL || ir_right == NULL) {
+        plugin_state_free(&state);
+        return 1;
+    }
+
+    memcpy(state.ir[0], left, sizeof(float) * length);
+    memcpy(state.ir[1], right, sizeof(float) * length);
+    state.ir_num_samples_per_channel = length;
+    strncpy(state.filename, "Generated", PLUGIN_STATE_FILENAME_LENGTH - 1);
+
+    err = setPluginState(slot, &state);
+    plugin_state_free(&state);
+    return err;
+}
+
+// Passes a state to the plugin the same way the UI does, i.e. serialized.
+int HeadlessHost::setPluginState(uint32_t slot, plugin_state_t *state)
+{
+    int err;
+    char *str = NULL;
+    uint32_t length = 0;
+
+    if (slot >= PLUGIN_STATE_NUM_SLOTS) {
+        return 1;
+    }
+
+    err = plugin_state_serialize(state, &str, &length);
+    if (err) {
+        return 1;
+    }
+
+    double length_s = (double)state->ir_num_samples_per_channel / state->ir_sample_rate_Hz;
+    if (length_s > tail_length_s) {
+        tail_length_s = length_s;
+    }
+
+    plugin->setState(plugin_state_key(slot), str);
+    state_bytes[slot] = length + state->ir_num_channels * sizeof(float) * state->ir_num_samples_per_channel;
+
+    free(str);
+    return 0;
+}
+
+int HeadlessHost::setRouting(const char *text)
+{
+    // The plugin ignores invalid routings, so they are caught here.
+    routing_t routing;
+    if (routing_parse(&routing, text, DISTRHO_PLUGIN_NUM_INPUTS, DISTRHO_PLUGIN_NUM_OUTPUTS)) {
+        return 1;
+    }
+
+    plugin->setState(ROUTING_STATE_KEY, text);
+    return 0;
+}
+
+int HeadlessHost::setParameter(const char *symbol, float value)
+{
+    for (uint32_t i = 0; i < plugin->getParameterCount(); i++) {
+        if (strcmp(plugin->getParameterSymbol(i), symbol) == 0 && !plugin->isParameterOutput(i)) {
+            const ParameterRanges &ranges = plugin->getParameterRanges(i);
+            plugin->setParameterValue(i, ranges.getFixedValue(value));
+            return 0;
+        }
+    }
+    return 1;
+}
+
+float HeadlessHost::getParameter(const char *symbol) const
+{
+    for (uint32_t i = 0; i < plugin->getParameterCount(); i++) {
+        if (strcmp(plugin->getParameterSymbol(i), symbol) == 0) {
+            return plugin->getParameterValue(i);
+        }
+    }
+    return NAN;
+}
+
+void HeadlessHost::run(const float **inputs, float **outputs, uint32_t frames)
+{
+    uint32_t processed = 0;
+
+    while (processed < frames) {
+        uint32_t processing = frames - processed;
+        if (processing > buffer_size) {
+            processing = buffer_size;
+        }
+
+        const float *in[DISTRHO_PLUGIN_NUM_INPUTS];
+        float *out[DISTRHO_PLUGIN_NUM_OUTPUTS];
+        for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_INPUTS; c++) {
+            in[c] = inputs[c] + processed;
+        }
+        for (uint32_t c = 0; c < DISTRHO_PLUGIN_NUM_OUTPUTS; c++) {
+            out[c] = outputs[c] + processed;
+        }
+
+        plugin->run(in, out, processing);
+        processed += processing;
+    }
+}
+
+void HeadlessHost::setSampleRate(double sample_rate)
+{
+    this->sample_rate = sample_rate;
+    plugin->deactivate();
+    plugin->setSampleRate(sample_rate, true);
+    plugin->activate();
+}
+
+void HeadlessHost::setBufferSize(uint32_t buffer_size)
+{
+    this->buffer_size = buffer_size;
+    plugin->deactivate();
+    plugin->setBufferSize(buffer_size, true);
+    plugin->activate();
+}
+
+uint32_t HeadlessHost::getTailLength() const
+{
+    return (uint32_t)ceil(tail_length_s * sample_rate);
+}
+
+size_t HeadlessHost::getStateBytes() const
+{
+    size_t bytes = 0;
+    for (uint32_t s = 0; s < PLUGIN_STATE_NUM_SLOTS; s++) {
+        bytes += state_bytes[s];
+    }
+    return bytes;
+}
+
+double HeadlessHost::getSampleRate() const
+{
+    return sample_rate;
+}
+
+uint32_t HeadlessHost::getBufferSize() const
+{
+    return buffer_size;
+}
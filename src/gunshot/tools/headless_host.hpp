@@ -0,0 +1,62 @@
+#ifndef HEADLESS_HOST_H
+#define HEADLESS_HOST_H
+
+#include <stdint.h>
+
+#include "DistrhoPluginInternal.hpp"
+#include "plugin_state.hpp"
+
+// Minimal host that runs GunShotPlugin without a DAW.
+//
+// The plugin is driven through DPF's PluginExporter, i.e. the same calls a
+// plugin wrapper makes, so impulse responses go through plugin_state_init(),
+// serialization and setState() exactly as when loaded from the UI, and audio
+// goes through the plugin's own resampling, filter and mix path. The render
+// parameter starts at Offline.
+class HeadlessHost
+{
+public:
+    HeadlessHost(double sample_rate, uint32_t buffer_size);
+    ~HeadlessHost();
+
+    int loadImpulseResponse(uint32_t slot, const char *filename);
+    int loadImpulseResponse(uint32_t slot, const float *left, const float *right, uint32_t length, uint32_t sample_rate_Hz);
+    int setParameter(const char *symbol, float value);
+
+    // Value of an input or output parameter, NAN if there is none.
+    float getParameter(const char *symbol) const;
+
+    // Sets the routing matrix in the text form of routing.h.
+    int setRouting(const char *routing);
+
+    // Changes the host settings the way a host does: the plugin is
+    // deactivated, notified through sampleRateChanged()/bufferSizeChanged()
+    // and activated again.
+    void setSampleRate(double sample_rate);
+    void setBufferSize(uint32_t buffer_size);
+
+    // Any number of frames may be processed. The audio is passed to the
+    // plugin in chunks of at most the buffer size.
+    void run(const float **inputs, float **outputs, uint32_t frames);
+
+    // Length of the longest loaded impulse response at the host sample rate.
+    uint32_t getTailLength() const;
+
+    // Memory held by the plugin for the loaded states: the deserialized
+    // impulse responses plus the cached serialized strings.
+    size_t getStateBytes() const;
+
+    double getSampleRate() const;
+    uint32_t getBufferSize() const;
+
+private:
+    int setPluginState(uint32_t slot, plugin_state_t *state);
+
+    DISTRHO_NAMESPACE::PluginExporter *plugin;
+    double sample_rate;
+    uint32_t buffer_size;
+    double tail_length_s;
+    size_t state_bytes[PLUGIN_STATE_NUM_SLOTS];
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include "trace.hpp"
+
+#ifdef GUNSHOT_TRACE_FILE
+
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+
+#define TRACE_MAX_THREADS 32
+#define TRACE_EVENTS_PER_THREAD 32768
+
+typedef struct {
+    const char *name;
+    uint64_t begin_ns;
+    uint64_t duration_ns;
+} trace_event_t;
+
+typedef struct {
+    const char *thread_name;
+    std::atomic<uint32_t> count;
+    trace_event_t events[TRACE_EVENTS_PER_THREAD];
+} trace_thread_t;
+
+// All buffers are allocated when the library is loaded, so that recording a
+// zone never allocates. A thread claims a buffer the first time it records
+// something.
+class Tracer
+{
+public:
+    Tracer() :
+        start(std::chrono::steady_clock::now()),
+        num_threads(0),
+        threads(new trace_thread_t[TRACE_MAX_THREADS])
+    {
+        for (uint32_t n = 0; n < TRACE_MAX_THREADS; n++) {
+            threads[n].thread_name = NULL;
+            threads[n].count.store(0);
+        }
+    }
+
+    ~Tracer()
+    {
+        // The UI library has its own tracer, which usually records nothing
+        // and must not overwrite the trace of the plugin.
+        if (num_threads.load() > 0) {
+            write(GUNSHOT_TRACE_FILE);
+        }
+    }
+
+    uint64_t now()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    trace_thread_t *getThread()
+    {
+        static thread_local trace_thread_t *thread = NULL;
+        if (thread == NULL) {
+            uint32_t index = num_threads.fetch_add(1);
+            if (index >= TRACE_MAX_THREADS) {
+                return NULL;
+            }
+            thread = &threads[index];
+        }
+        return thread;
+    }
+
+    int write(const char *filename)
+    {
+        FILE *f = fopen(filename, "w");
+        if (f == NULL) {
+            return 1;
+        }
+
+        const char *separator = "";
+        uint32_t thread_count = num_threads.load();
+        if (thread_count > TRACE_MAX_THREADS) {
+            thread_count = TRACE_MAX_THREADS;
+        }
+
+        fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+        for (uint32_t t = 0; t < thread_count; t++) {
+            trace_thread_t *thread = &threads[t];
+            uint32_t count = thread->count.load(std::memory_order_acquire);
+
+            if (thread->thread_name != NULL) {
+                fprintf(f, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                        separator, t + 1, thread->thread_name);
+                separator = ",";
+            }
+            for (uint32_t n = 0; n < count; n++) {
+                const trace_event_t *e = &thread->events[n];
+                fprintf(f, "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                        separator, e->name, t + 1, e->begin_ns * 1e-3, e->duration_ns * 1e-3);
+                separator = ",";
+            }
+        }
+        fprintf(f, "\n]}\n");
+
+        fclose(f);
+        return 0;
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+    std::atomic<uint32_t> num_threads;
+    trace_thread_t *threads;
+};
+
+static Tracer tracer;
+
+TraceZone::TraceZone(const char *name) :
+    _name(name),
+    _begin(tracer.now())
+{
+}
+
+TraceZone::~TraceZone()
+{
+    const uint64_t end = tracer.now();
+    trace_thread_t *thread = tracer.getThread();
+    if (thread == NULL) {
+        return;
+    }
+
+    // Only the owning thread writes to its buffer, so the event is filled in
+    // before the count is published to trace_write().
+    uint32_t count = thread->count.load(std::memory_order_relaxed);
+    if (count >= TRACE_EVENTS_PER_THREAD) {
+        return;
+    }
+    trace_event_t *e = &thread->events[count];
+    e->name = _name;
+    e->begin_ns = _begin;
+    e->duration_ns = end - _begin;
+    thread->count.store(count + 1, std::memory_order_release);
+}
+
+// The name must be a string literal or otherwise outlive the trace.
+void trace_set_thread_name(const char *name)
+{
+    trace_thread_t *thread = tracer.getThread();
+    if (thread != NULL) {
+        thread->thread_name = name;
+    }
+}
+
+int trace_write(void)
+{
+    return tracer.write(GUNSHOT_TRACE_FILE);
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Timeline tracing.
+//
+// TRACE_ZONE("name") records the time from the macro to the end of the
+// enclosing scope on the calling thread. The zones of all threads are written
+// as a Chrome trace (JSON), which can be opened in Perfetto
+// (ui.perfetto.dev) or chrome://tracing, when the plugin library is unloaded.
+//
+// Tracing is compiled out unless GUNSHOT_TRACE_FILE is defined as the output
+// path, e.g. -DGUNSHOT_TRACE_FILE='"/tmp/gunshot-trace.json"'. Recording a
+// zone only writes to a preallocated per-thread buffer; zones are dropped
+// when the buffer is full.
+
+#ifdef GUNSHOT_TRACE_FILE
+
+#include <stdint.h>
+
+class TraceZone
+{
+public:
+    explicit TraceZone(const char *name);
+    ~TraceZone();
+
+private:
+    const char *_name;
+    uint64_t _begin;
+};
+
+void trace_set_thread_name(const char *name);
+int trace_write(void);
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(trace_zone_, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) trace_set_thread_name(name)
+
+#else
+
+#define TRACE_ZONE(name)
+#define TRACE_THREAD_NAME(name)
+
+#endif
+
+#endif
@@ -18,10 +18,10 @@ uint32_t find_basename(const char *abspath)
     int32_t n;
 
 #ifdef DISTRHO_OS_WINDOWS
-    log_write("Detected Windows");
+    log_write_level(LOG_LEVEL_DEBUG, "Detected Windows");
     char sep = '\\';
 #else
-    log_write("Detected non-Windows");
+    log_write_level(LOG_LEVEL_DEBUG, "Detected non-Windows");
     char sep = '/';
 #endif
 
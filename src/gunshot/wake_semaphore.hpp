@@ -0,0 +1,82 @@
+#ifndef WAKE_SEMAPHORE_H
+#define WAKE_SEMAPHORE_H
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <errno.h>
+#include <semaphore.h>
+#endif
+
+// Counting semaphore of the operating system, used to wake threads from the
+// audio thread.
+//
+// post() never blocks: it increments the count with an atomic operation and
+// only enters the kernel when a thread is waiting, to wake it. Unlike a
+// condition variable, it takes no mutex that the woken thread could be
+// holding, so a waiting thread cannot make the audio thread wait for it.
+class WakeSemaphore
+{
+public:
+    WakeSemaphore()
+    {
+#if defined(_WIN32)
+        _semaphore = CreateSemaphoreA(NULL, 0, LONG_MAX, NULL);
+#elif defined(__APPLE__)
+        _semaphore = dispatch_semaphore_create(0);
+#else
+        sem_init(&_semaphore, 0, 0);
+#endif
+    }
+
+    ~WakeSemaphore()
+    {
+#if defined(_WIN32)
+        CloseHandle(_semaphore);
+#elif defined(__APPLE__)
+        dispatch_release(_semaphore);
+#else
+        sem_destroy(&_semaphore);
+#endif
+    }
+
+    void post()
+    {
+#if defined(_WIN32)
+        ReleaseSemaphore(_semaphore, 1, NULL);
+#elif defined(__APPLE__)
+        dispatch_semaphore_signal(_semaphore);
+#else
+        sem_post(&_semaphore);
+#endif
+    }
+
+    // Blocks until the count is above zero and decrements it.
+    void wait()
+    {
+#if defined(_WIN32)
+        WaitForSingleObject(_semaphore, INFINITE);
+#elif defined(__APPLE__)
+        dispatch_semaphore_wait(_semaphore, DISPATCH_TIME_FOREVER);
+#else
+        while (sem_wait(&_semaphore) != 0 && errno == EINTR) {
+        }
+#endif
+    }
+
+private:
+#if defined(_WIN32)
+    HANDLE _semaphore;
+#elif defined(__APPLE__)
+    dispatch_semaphore_t _semaphore;
+#else
+    sem_t _semaphore;
+#endif
+
+    WakeSemaphore(const WakeSemaphore&);
+    WakeSemaphore& operator=(const WakeSemaphore&);
+};
+
+#endif